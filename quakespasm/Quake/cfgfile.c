@@ -152,23 +152,19 @@ void CFG_CloseConfig (void)
 
 int CFG_OpenConfig (const char *cfg_name)
 {
-	FILE	*f;
+	fshandle_t	fh;
 	long		length;
-	qboolean	pak;
 
 	CFG_CloseConfig ();
 
-	length = (long) COM_FOpenFile (cfg_name, &f, NULL);
-	pak = file_from_pak;
+	COM_TraceLoader ("config");
+	length = FS_fopen (cfg_name, &fh, NULL);
+	COM_TraceLoader (NULL);
 	if (length == -1)
 		return -1;
 
 	cfg_file = (fshandle_t *) Z_Malloc(sizeof(fshandle_t));
-	cfg_file->file = f;
-	cfg_file->start = ftell(f);
-	cfg_file->pos = 0;
-	cfg_file->length = length;
-	cfg_file->pak = pak;
+	*cfg_file = fh;
 
 	return 0;
 }
@@ -293,6 +293,7 @@ void CL_Record_f (void)
 		Con_Printf ("ERROR: couldn't create %s\n", name);
 		return;
 	}
+	COM_FlushMissCache ();	// so "playdemo" finds it
 
 	cls.forcetrack = track;
 	fprintf (cls.demofile, "%i\n", cls.forcetrack);
@@ -403,7 +404,9 @@ void CL_PlayDemo_f (void)
 
 	Con_Printf ("Playing demo from %s.\n", name);
 
+	COM_TraceLoader ("demo");
 	COM_FOpenFile (name, &cls.demofile, NULL);
+	COM_TraceLoader (NULL);
 	if (!cls.demofile)
 	{
 		Con_Printf ("ERROR: couldn't open %s\n", name);
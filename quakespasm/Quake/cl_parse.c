@@ -387,6 +387,7 @@ void CL_ParseServerInfo (void)
 		CL_KeepaliveMessage ();
 	}
 	S_EndPrecaching ();
+	COM_PrefetchClear ();
 
 // local state
 	cl_entities[0].model = cl.worldmodel = cl.model_precache[1];
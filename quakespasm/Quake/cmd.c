@@ -23,6 +23,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // cmd.c -- Quake script command processing module
 
 #include "quakedef.h"
+#include "q_ctype.h"
 
 void Cmd_ForwardToServer (void);
 
@@ -35,6 +36,7 @@ typedef struct cmdalias_s
 	struct cmdalias_s	*next;
 	char	name[MAX_ALIAS_NAME];
 	char	*value;
+	cmdname_t	hash;
 } cmdalias_t;
 
 cmdalias_t	*cmd_alias;
@@ -57,15 +59,134 @@ void Cmd_Wait_f (void)
 	cmd_wait = true;
 }
 
+/*
+=============================================================================
+
+						NAME LOOKUP
+
+=============================================================================
+*/
+
+#define	CMD_HASHSIZE	1024
+
+static cmdname_t	*cmd_hash[CMD_HASHSIZE];
+static int		cmd_numnames;
+static int		cmd_lookups, cmd_misses, cmd_compares;
+
+/*
+============
+Cmd_HashName -- FNV-1a, like COM_HashString, but ignoring case
+============
+*/
+static unsigned int Cmd_HashName (const char *name)
+{
+	unsigned int	hash = 2166136261U;
+
+	while (*name)
+	{
+		hash ^= (byte) q_tolower (*name++);
+		hash *= 16777619U;
+	}
+	return hash & (CMD_HASHSIZE - 1);
+}
+
+/*
+============
+Cmd_AddName
+============
+*/
+void Cmd_AddName (cmdname_t *node, const char *name, cmdnametype_t type, void *data)
+{
+	unsigned int	bucket;
+
+	bucket = Cmd_HashName (name);
+	node->name = name;
+	node->type = type;
+	node->data = data;
+	node->hashnext = cmd_hash[bucket];
+	cmd_hash[bucket] = node;
+	cmd_numnames++;
+}
+
+/*
+============
+Cmd_RemoveName
+============
+*/
+void Cmd_RemoveName (cmdname_t *node)
+{
+	cmdname_t	**link;
+
+	for (link = &cmd_hash[Cmd_HashName (node->name)]; *link; link = &(*link)->hashnext)
+	{
+		if (*link == node)
+		{
+			*link = node->hashnext;
+			cmd_numnames--;
+			return;
+		}
+	}
+
+	Sys_Error ("Cmd_RemoveName: %s not found", node->name);
+}
+
+/*
+============
+Cmd_LookupName
+
+With a type of -1, returns the match that takes precedence
+============
+*/
+static cmdname_t *Cmd_LookupName (const char *name, int type)
+{
+	cmdname_t	*node, *best;
+
+	cmd_lookups++;
+	best = NULL;
+	for (node = cmd_hash[Cmd_HashName (name)]; node; node = node->hashnext)
+	{
+		if (type >= 0 ? (int)node->type != type : (best && node->type >= best->type))
+			continue;
+		cmd_compares++;
+		if (q_strcasecmp (name, node->name))
+			continue;
+		best = node;
+		if (type >= 0 || best->type == cmdname_command)
+			break;
+	}
+
+	if (!best)
+		cmd_misses++;
+	return best;
+}
+
+/*
+============
+Cmd_FindName
+============
+*/
+cmdname_t *Cmd_FindName (const char *name, cmdnametype_t type)
+{
+	return Cmd_LookupName (name, type);
+}
+
 /*
 =============================================================================
 
 						COMMAND BUFFER
 
+The unexecuted text is cbuf_text[cbuf_start..cbuf_end), with free space
+kept on both sides of it: executing a line just advances cbuf_start, and
+inserted text is written in front of it.  The text is only moved when one
+of the ends runs out of room.
 =============================================================================
 */
 
-sizebuf_t	cmd_text;
+#define	CBUF_SIZE	(1<<18)		// space for commands and script files. spike -- was 8192, but modern configs can be _HUGE_, at least if they contain lots of comments/docs for things.
+
+static char	*cbuf_text;
+static int	cbuf_start, cbuf_end;
+static int	cbuf_frame, cbuf_framebytes, cbuf_lastframebytes, cbuf_peakbytes;
 
 /*
 ============
@@ -74,9 +195,35 @@ Cbuf_Init
 */
 void Cbuf_Init (void)
 {
-	SZ_Alloc (&cmd_text, 1<<18);		// space for commands and script files. spike -- was 8192, but modern configs can be _HUGE_, at least if they contain lots of comments/docs for things.
+	cbuf_text = (char *) Hunk_AllocName (CBUF_SIZE, "cbuf");
+	cbuf_start = cbuf_end = 0;
 }
 
+/*
+============
+Cbuf_MakeRoom
+
+Makes sure there are at least front bytes free before the text and back
+bytes after it, returns false if the buffer can't hold that much
+============
+*/
+static qboolean Cbuf_MakeRoom (int front, int back)
+{
+	int		len, start;
+
+	len = cbuf_end - cbuf_start;
+	if (front + len + back > CBUF_SIZE)
+		return false;
+	if (cbuf_start >= front && CBUF_SIZE - cbuf_end >= back)
+		return true;
+
+// move the text so the space that's left over is split between both ends
+	start = front + (CBUF_SIZE - front - len - back) / 2;
+	memmove (cbuf_text + start, cbuf_text + cbuf_start, len);
+	cbuf_start = start;
+	cbuf_end = start + len;
+	return true;
+}
 
 /*
 ============
@@ -91,13 +238,14 @@ void Cbuf_AddText (const char *text)
 
 	l = Q_strlen (text);
 
-	if (cmd_text.cursize + l >= cmd_text.maxsize)
+	if (!Cbuf_MakeRoom (0, l))
 	{
 		Con_Printf ("Cbuf_AddText: overflow\n");
 		return;
 	}
 
-	SZ_Write (&cmd_text, text, Q_strlen (text));
+	memcpy (cbuf_text + cbuf_end, text, l);
+	cbuf_end += l;
 }
 
 
@@ -107,34 +255,23 @@ Cbuf_InsertText
 
 Adds command text immediately after the current command
 Adds a \n to the text
-FIXME: actually change the command buffer to do less copying
 ============
 */
 void Cbuf_InsertText (const char *text)
 {
-	char	*temp;
-	int		templen;
+	int		l;
 
-// copy off any commands still remaining in the exec buffer
-	templen = cmd_text.cursize;
-	if (templen)
-	{
-		temp = (char *) Z_Malloc (templen);
-		Q_memcpy (temp, cmd_text.data, templen);
-		SZ_Clear (&cmd_text);
-	}
-	else
-		temp = NULL;	// shut up compiler
+	l = Q_strlen (text);
 
-// add the entire text of the file
-	Cbuf_AddText (text);
-	SZ_Write (&cmd_text, "\n", 1);
-// add the copied off data
-	if (templen)
+	if (!Cbuf_MakeRoom (l + 1, 0))
 	{
-		SZ_Write (&cmd_text, temp, templen);
-		Z_Free (temp);
+		Con_Printf ("Cbuf_InsertText: overflow\n");
+		return;
 	}
+
+	cbuf_start -= l + 1;
+	memcpy (cbuf_text + cbuf_start, text, l);
+	cbuf_text[cbuf_start + l] = '\n';
 }
 
 /*
@@ -144,18 +281,26 @@ Cbuf_Execute
 */
 void Cbuf_Execute (void)
 {
-	int		i;
+	int		i, len;
 	char	*text;
 	char	line[1024];
 	int		quotes;
 
-	while (cmd_text.cursize)
+	if (cbuf_frame != host_framecount)
+	{
+		cbuf_frame = host_framecount;
+		cbuf_lastframebytes = cbuf_framebytes;
+		cbuf_framebytes = 0;
+	}
+
+	while (cbuf_start < cbuf_end)
 	{
 // find a \n or ; line break
-		text = (char *)cmd_text.data;
+		text = cbuf_text + cbuf_start;
+		len = cbuf_end - cbuf_start;
 
 		quotes = 0;
-		for (i=0 ; i< cmd_text.cursize ; i++)
+		for (i=0 ; i< len ; i++)
 		{
 			if (text[i] == '"')
 				quotes++;
@@ -176,18 +321,14 @@ void Cbuf_Execute (void)
 			line[i] = 0;
 		}
 
-// delete the text from the command buffer and move remaining commands down
-// this is necessary because commands (exec, alias) can insert data at the
-// beginning of the text buffer
-
-		if (i == cmd_text.cursize)
-			cmd_text.cursize = 0;
-		else
-		{
+// consume the line before executing it, because commands (exec, alias)
+// can insert text at the front of the buffer
+		if (i < len)
 			i++;
-			cmd_text.cursize -= i;
-			memmove (text, text + i, cmd_text.cursize);
-		}
+		cbuf_start += i;
+		cbuf_framebytes += i;
+		if (cbuf_peakbytes < cbuf_framebytes)
+			cbuf_peakbytes = cbuf_framebytes;
 
 // execute the command line
 		Cmd_ExecuteString (line, src_command);
@@ -201,6 +342,17 @@ void Cbuf_Execute (void)
 	}
 }
 
+/*
+============
+Cbuf_Stats -- for cmd_stats
+============
+*/
+static void Cbuf_Stats (void)
+{
+	Con_Printf ("command buffer: %i bytes queued, %i executed last frame, %i at most\n",
+		    cbuf_end - cbuf_start, cbuf_lastframebytes, cbuf_peakbytes);
+}
+
 /*
 ==============================================================================
 
@@ -267,7 +419,9 @@ void Cmd_Exec_f (void)
 	}
 
 	mark = Hunk_LowMark ();
+	COM_TraceLoader ("config");
 	f = (char *)COM_LoadHunkFile (Cmd_Argv(1), NULL);
+	COM_TraceLoader (NULL);
 	if (!f)
 	{
 		Con_Printf ("couldn't exec %s\n",Cmd_Argv(1));
@@ -306,6 +460,7 @@ Creates a new command that executes a command string (possibly ; seperated)
 void Cmd_Alias_f (void)
 {
 	cmdalias_t	*a;
+	cmdname_t	*node;
 	char		cmd[1024];
 	int			i, c;
 	const char	*s;
@@ -322,9 +477,12 @@ void Cmd_Alias_f (void)
 			Con_SafePrintf ("no alias commands found\n");
 		break;
 	case 2: //output current alias string
-		for (a = cmd_alias ; a ; a=a->next)
-			if (!strcmp(Cmd_Argv(1), a->name))
-				Con_Printf ("   %s: %s", a->name, a->value);
+		node = Cmd_FindName (Cmd_Argv(1), cmdname_alias);
+		if (node)
+		{
+			a = (cmdalias_t *) node->data;
+			Con_Printf ("   %s: %s", a->name, a->value);
+		}
 		break;
 	default: //set alias string
 		s = Cmd_Argv(1);
@@ -335,22 +493,22 @@ void Cmd_Alias_f (void)
 		}
 
 		// if the alias allready exists, reuse it
-		for (a = cmd_alias ; a ; a=a->next)
+		node = Cmd_FindName (s, cmdname_alias);
+		if (node)
 		{
-			if (!strcmp(s, a->name))
-			{
-				Z_Free (a->value);
-				break;
-			}
+			a = (cmdalias_t *) node->data;
+			Z_Free (a->value);
+			strcpy (a->name, s);
 		}
-
-		if (!a)
+		else
 		{
 			a = (cmdalias_t *) Z_Malloc (sizeof(cmdalias_t));
 			a->next = cmd_alias;
 			cmd_alias = a;
+			strcpy (a->name, s);
+			Cmd_AddName (&a->hash, a->name, cmdname_alias, a);
+			TabIndex_Add (&con_tabnames, a->name, "alias");
 		}
-		strcpy (a->name, s);
 
 		// copy the rest of the command line
 		cmd[0] = 0;		// start out with a null string
@@ -381,6 +539,7 @@ Cmd_Unalias_f -- johnfitz
 void Cmd_Unalias_f (void)
 {
 	cmdalias_t	*a, *prev;
+	cmdname_t	*node;
 
 	switch (Cmd_Argc())
 	{
@@ -389,23 +548,24 @@ void Cmd_Unalias_f (void)
 		Con_Printf("unalias <name> : delete alias\n");
 		break;
 	case 2:
-		prev = NULL;
-		for (a = cmd_alias; a; a = a->next)
+		node = Cmd_FindName (Cmd_Argv(1), cmdname_alias);
+		if (!node)
 		{
-			if (!strcmp(Cmd_Argv(1), a->name))
-			{
-				if (prev)
-					prev->next = a->next;
-				else
-					cmd_alias  = a->next;
-
-				Z_Free (a->value);
-				Z_Free (a);
-				return;
-			}
-			prev = a;
+			Con_Printf ("No alias named %s\n", Cmd_Argv(1));
+			break;
 		}
-		Con_Printf ("No alias named %s\n", Cmd_Argv(1));
+		prev = NULL;
+		for (a = cmd_alias; a != node->data; a = a->next)
+			prev = a;
+		if (prev)
+			prev->next = a->next;
+		else
+			cmd_alias  = a->next;
+
+		Cmd_RemoveName (&a->hash);
+		TabIndex_Remove (&con_tabnames, a->name);
+		Z_Free (a->value);
+		Z_Free (a);
 		break;
 	}
 }
@@ -422,6 +582,8 @@ void Cmd_Unaliasall_f (void)
 	while (cmd_alias)
 	{
 		blah = cmd_alias->next;
+		Cmd_RemoveName (&cmd_alias->hash);
+		TabIndex_Remove (&con_tabnames, cmd_alias->name);
 		Z_Free(cmd_alias->value);
 		Z_Free(cmd_alias);
 		cmd_alias = blah;
@@ -441,6 +603,7 @@ typedef struct cmd_function_s
 	struct cmd_function_s	*next;
 	const char		*name;
 	xcommand_t		function;
+	cmdname_t		hash;
 } cmd_function_t;
 
 
@@ -555,6 +718,33 @@ void Cmd_Apropos_f(void)
 		Con_SafePrintf ("no cvars nor commands contain that substring\n");
 }
 
+/*
+============
+Cmd_Stats_f
+============
+*/
+static void Cmd_Stats_f (void)
+{
+	cmdname_t	*node;
+	int		i, len, used, longest;
+
+	used = longest = 0;
+	for (i = 0; i < CMD_HASHSIZE; i++)
+	{
+		for (len = 0, node = cmd_hash[i]; node; node = node->hashnext)
+			len++;
+		if (len)
+			used++;
+		if (longest < len)
+			longest = len;
+	}
+
+	Con_Printf ("%i names in %i of %i buckets, longest chain %i\n", cmd_numnames, used, CMD_HASHSIZE, longest);
+	Con_Printf ("%i lookups, %i misses, %.2f compares per lookup\n", cmd_lookups, cmd_misses,
+		    cmd_lookups ? (float)cmd_compares / cmd_lookups : 0.f);
+	Cbuf_Stats ();
+}
+
 /*
 ============
 Cmd_Init
@@ -575,6 +765,7 @@ void Cmd_Init (void)
 
 	Cmd_AddCommand ("apropos", Cmd_Apropos_f);
 	Cmd_AddCommand ("find", Cmd_Apropos_f);
+	Cmd_AddCommand ("cmd_stats", Cmd_Stats_f);
 }
 
 /*
@@ -682,18 +873,17 @@ void	Cmd_AddCommand (const char *cmd_name, xcommand_t function)
 	}
 
 // fail if the command already exists
-	for (cmd=cmd_functions ; cmd ; cmd=cmd->next)
+	if (Cmd_FindName (cmd_name, cmdname_command))
 	{
-		if (!Q_strcmp (cmd_name, cmd->name))
-		{
-			Con_Printf ("Cmd_AddCommand: %s already defined\n", cmd_name);
-			return;
-		}
+		Con_Printf ("Cmd_AddCommand: %s already defined\n", cmd_name);
+		return;
 	}
 
 	cmd = (cmd_function_t *) Hunk_Alloc (sizeof(cmd_function_t));
 	cmd->name = cmd_name;
 	cmd->function = function;
+	Cmd_AddName (&cmd->hash, cmd->name, cmdname_command, cmd);
+	TabIndex_Add (&con_tabnames, cmd->name, "command");
 
 	//johnfitz -- insert each entry in alphabetical order
 	if (cmd_functions == NULL || strcmp(cmd->name, cmd_functions->name) < 0) //insert at front
@@ -723,15 +913,7 @@ Cmd_Exists
 */
 qboolean	Cmd_Exists (const char *cmd_name)
 {
-	cmd_function_t	*cmd;
-
-	for (cmd=cmd_functions ; cmd ; cmd=cmd->next)
-	{
-		if (!Q_strcmp (cmd_name,cmd->name))
-			return true;
-	}
-
-	return false;
+	return Cmd_FindName (cmd_name, cmdname_command) != NULL;
 }
 
 
@@ -764,13 +946,11 @@ const char *Cmd_CompleteCommand (const char *partial)
 Cmd_ExecuteString
 
 A complete command line has been parsed, so try to execute it
-FIXME: lookupnoadd the token to speed search?
 ============
 */
 void	Cmd_ExecuteString (const char *text, cmd_source_t src)
 {
-	cmd_function_t	*cmd;
-	cmdalias_t		*a;
+	cmdname_t	*node;
 
 	cmd_source = src;
 	Cmd_TokenizeString (text);
@@ -779,28 +959,13 @@ void	Cmd_ExecuteString (const char *text, cmd_source_t src)
 	if (!Cmd_Argc())
 		return;		// no tokens
 
-// check functions
-	for (cmd=cmd_functions ; cmd ; cmd=cmd->next)
-	{
-		if (!q_strcasecmp (cmd_argv[0],cmd->name))
-		{
-			cmd->function ();
-			return;
-		}
-	}
-
-// check alias
-	for (a=cmd_alias ; a ; a=a->next)
-	{
-		if (!q_strcasecmp (cmd_argv[0], a->name))
-		{
-			Cbuf_InsertText (a->value);
-			return;
-		}
-	}
-
-// check cvars
-	if (!Cvar_Command ())
+// functions, then aliases, then cvars
+	node = Cmd_LookupName (cmd_argv[0], -1);
+	if (node && node->type == cmdname_command)
+		((cmd_function_t *)node->data)->function ();
+	else if (node && node->type == cmdname_alias)
+		Cbuf_InsertText (((cmdalias_t *)node->data)->value);
+	else if (!node || !Cvar_Command ((cvar_t *)node->data))
 		Con_Printf ("Unknown command \"%s\"\n", Cmd_Argv(0));
 
 }
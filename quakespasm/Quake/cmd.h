@@ -83,6 +83,28 @@ extern	cmd_source_t	cmd_source;
 
 void	Cmd_Init (void);
 
+// the names of commands, aliases and cvars share one case insensitive hash
+// table.  where a name is used twice, commands win over aliases, and
+// aliases over cvars.  the owner of the name provides the node.
+typedef enum
+{
+	cmdname_command,
+	cmdname_alias,
+	cmdname_cvar
+} cmdnametype_t;
+
+typedef struct cmdname_s
+{
+	struct cmdname_s	*hashnext;
+	const char		*name;
+	cmdnametype_t		type;
+	void			*data;
+} cmdname_t;
+
+void	Cmd_AddName (cmdname_t *node, const char *name, cmdnametype_t type, void *data);
+void	Cmd_RemoveName (cmdname_t *node);
+cmdname_t *Cmd_FindName (const char *name, cmdnametype_t type);
+
 void	Cmd_AddCommand (const char *cmd_name, xcommand_t function);
 // called by the init functions of other parts of the program to
 // register commands and functions to call for them.
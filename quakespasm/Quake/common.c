@@ -25,6 +25,12 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "quakedef.h"
 #include "q_ctype.h"
 #include <errno.h>
+#ifndef _WIN32
+#include <dirent.h>
+#endif
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
 
 static char	*largv[MAX_NUM_ARGVS + 1];
 static char	argvdummy[] = " ";
@@ -39,6 +45,7 @@ static qboolean		com_modified;	// set true if using non-id files
 qboolean		fitzmode;
 
 static void COM_Path_f (void);
+static int COM_FindFile (const char *filename, int *handle, FILE **file, unsigned int *path_id);
 
 // if a packfile directory differs from this, it is assumed to be hacked
 #define PAK0_COUNT		339	/* id1/pak0.pak - v1.0x */
@@ -1152,6 +1159,24 @@ void COM_AddExtension (char *path, const char *extension, size_t len)
 		q_strlcat(path, extension, len);
 }
 
+/*
+==================
+COM_HashString
+FNV-1a hash of a nul terminated string, for the lookup tables.
+==================
+*/
+unsigned int COM_HashString (const char *str)
+{
+	unsigned int	hash = 2166136261U;
+
+	while (*str)
+	{
+		hash ^= (byte)*str++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
 
 /*
 ==============
@@ -1504,280 +1529,1364 @@ typedef struct
 char	com_gamedir[MAX_OSPATH];
 char	com_basedir[MAX_OSPATH];
 int	file_from_pak;		// ZOID: global indicating that file came from a pak
+static pack_t	*com_foundpack;		// pak and entry of the last file found in a pak
+static packfile_t	*com_foundfile;
+static searchpath_t	*com_founddir;		// directory of the last loose file found
+static int		com_touchcount;		// pak entries used, for pak_reorder
+static qboolean	com_nopakmap;		// -nopakmap: read paks through stdio only
 
 searchpath_t	*com_searchpaths;
 searchpath_t	*com_base_searchpaths;
 
+/*
+=============================================================================
+
+MISSING FILE CACHE
+
+Optional files (.lit, .ent, external skins and textures) are looked up in
+every directory of the search path on each map load, and nearly all of
+them are missing.  Each (directory, name) pair that failed a Sys_FileTime
+is remembered so the next lookup can skip the stat.  The cache is dropped
+whenever the search path changes, when the engine writes a file itself
+and on "fs_rescan", which is needed after copying files in by hand.
+The count of skipped lookups shown by "path" outlives those flushes, it
+starts over on "game", "fs_rescan" and after each "path".
+
+=============================================================================
+*/
+
+#define	MISSHASH_SIZE	1024	/* power of two */
+#define	MAX_MISSFILES	16384	/* flush everything beyond this */
+
+typedef struct missfile_s
+{
+	struct missfile_s	*next;
+	searchpath_t	*search;
+	char		name[1];	/* allocated to length */
+} missfile_t;
+
+static missfile_t	*com_misshash[MISSHASH_SIZE];
+static int		com_misscount;
+static int		com_missavoided;	// stat() calls saved, reset by game, path and fs_rescan
+
 /*
 ============
-COM_Path_f
+COM_FlushMissCache
 ============
 */
-static void COM_Path_f (void)
+void COM_FlushMissCache (void)
 {
-	searchpath_t	*s;
+	missfile_t	*miss, *next;
+	int		i;
 
-	Con_Printf ("Current search path:\n");
-	for (s = com_searchpaths; s; s = s->next)
+	for (i = 0; i < MISSHASH_SIZE; i++)
 	{
-		if (s->pack)
+		for (miss = com_misshash[i]; miss; miss = next)
 		{
-			Con_Printf ("%s (%i files)\n", s->pack->filename, s->pack->numfiles);
+			next = miss->next;
+			free (miss);
 		}
-		else
-			Con_Printf ("%s\n", s->filename);
+		com_misshash[i] = NULL;
 	}
+	com_misscount = 0;
 }
 
 /*
 ============
-COM_WriteFile
-
-The filename will be prefixed by the current game directory
+COM_IsKnownMissing
 ============
 */
-void COM_WriteFile (const char *filename, const void *data, int len)
+static qboolean COM_IsKnownMissing (searchpath_t *search, const char *filename, unsigned int hash)
 {
-	int		handle;
-	char	name[MAX_OSPATH];
-
-	Sys_mkdir (com_gamedir); //johnfitz -- if we've switched to a nonexistant gamedir, create it now so we don't crash
-
-	q_snprintf (name, sizeof(name), "%s/%s", com_gamedir, filename);
+	missfile_t	*miss;
 
-	handle = Sys_FileOpenWrite (name);
-	if (handle == -1)
+	for (miss = com_misshash[hash & (MISSHASH_SIZE - 1)]; miss; miss = miss->next)
 	{
-		Sys_Printf ("COM_WriteFile: failed on %s\n", name);
-		return;
+		if (miss->search == search && !strcmp(miss->name, filename))
+		{
+			com_missavoided++;
+			return true;
+		}
 	}
-
-	Sys_Printf ("COM_WriteFile: %s\n", name);
-	Sys_FileWrite (handle, data, len);
-	Sys_FileClose (handle);
+	return false;
 }
 
 /*
 ============
-COM_CreatePath
+COM_AddKnownMissing
 ============
 */
-void COM_CreatePath (char *path)
+static void COM_AddKnownMissing (searchpath_t *search, const char *filename, unsigned int hash)
 {
-	char	*ofs;
+	missfile_t	*miss;
+	size_t		len;
 
-	for (ofs = path + 1; *ofs; ofs++)
-	{
-		if (*ofs == '/')
-		{	// create the directory
-			*ofs = 0;
-			Sys_mkdir (path);
-			*ofs = '/';
-		}
-	}
+	if (com_misscount >= MAX_MISSFILES)
+		COM_FlushMissCache ();
+
+	len = strlen (filename);
+	miss = (missfile_t *) malloc (sizeof(missfile_t) + len);
+	if (!miss)
+		return;
+	miss->search = search;
+	memcpy (miss->name, filename, len + 1);
+	miss->next = com_misshash[hash & (MISSHASH_SIZE - 1)];
+	com_misshash[hash & (MISSHASH_SIZE - 1)] = miss;
+	com_misscount++;
 }
 
 /*
-================
-COM_filelength
-================
+============
+COM_Rescan_f
+============
 */
-long COM_filelength (FILE *f)
+static void COM_Rescan_f (void)
 {
-	long		pos, end;
+	COM_FlushMissCache ();
+	com_missavoided = 0;
+}
 
-	pos = ftell (f);
-	fseek (f, 0, SEEK_END);
-	end = ftell (f);
-	fseek (f, pos, SEEK_SET);
+/*
+=============================================================================
 
-	return end;
+FILE INDEX
+
+The directories of all pak files in the search path are merged into a
+single hash table, so COM_FindFile doesn't need to strcmp its way through
+every pak.  Only the first (highest priority) occurence of a name gets an
+entry, which remembers the search path element it came from: directories
+ahead of it are still checked, so loose files keep overriding as before.
+
+=============================================================================
+*/
+
+typedef struct
+{
+	searchpath_t	*search;
+	packfile_t	*file;
+	int		next;		// next entry in the hash chain, -1 terminates
+} fileindex_t;
+
+static fileindex_t	*com_fileindex;
+static int		*com_filehash;		// chain heads, com_filehashsize of them
+static int		com_filehashsize;	// always a power of two
+static int		com_fileindexcount;
+
+/*
+============
+COM_FreeFileIndex
+
+Must be called before any searchpath_t / pack_t is freed.  Drops the
+missing file cache and the prefetched files too, they refer to the same
+search path elements.
+============
+*/
+static void COM_FreeFileIndex (void)
+{
+	COM_FlushMissCache ();
+	COM_PrefetchClear ();
+	free (com_fileindex);
+	free (com_filehash);
+	com_fileindex = NULL;
+	com_filehash = NULL;
+	com_filehashsize = 0;
+	com_fileindexcount = 0;
 }
 
 /*
-===========
-COM_FindFile
+============
+COM_BuildFileIndex
 
-Finds the file in the search path.
-Sets com_filesize and one of handle or file
-If neither of file or handle is set, this
-can be used for detecting a file's presence.
-===========
+(Re)builds the index from the current search path.
+============
 */
-static int COM_FindFile (const char *filename, int *handle, FILE **file,
-							unsigned int *path_id)
+static void COM_BuildFileIndex (void)
 {
 	searchpath_t	*search;
-	char		netpath[MAX_OSPATH];
-	pack_t		*pak;
-	int		i, findtime;
+	fileindex_t	*entry;
+	int		i, j, total;
+	unsigned int	bucket;
 
-	if (file && handle)
-		Sys_Error ("COM_FindFile: both handle and file set");
+	COM_FreeFileIndex ();
 
-	file_from_pak = 0;
+	total = 0;
+	for (search = com_searchpaths; search; search = search->next)
+	{
+		if (search->pack)
+			total += search->pack->numfiles;
+	}
 
-//
-// search through the path, one element at a time
-//
+	com_filehashsize = 64;
+	while (com_filehashsize < total * 2)
+		com_filehashsize <<= 1;
+
+	com_filehash = (int *) malloc (com_filehashsize * sizeof(int));
+	com_fileindex = (fileindex_t *) malloc ((total ? total : 1) * sizeof(fileindex_t));
+	if (!com_filehash || !com_fileindex)
+		Sys_Error ("COM_BuildFileIndex: out of memory for %i files", total);
+	for (i = 0; i < com_filehashsize; i++)
+		com_filehash[i] = -1;
+
+	// walk in priority order, so the first name inserted is the one
+	// the linear search would have found
 	for (search = com_searchpaths; search; search = search->next)
 	{
-		if (search->pack)	/* look through all the pak file elements */
-		{
-			pak = search->pack;
-			for (i = 0; i < pak->numfiles; i++)
-			{
-				if (strcmp(pak->files[i].name, filename) != 0)
-					continue;
-				// found it!
-				com_filesize = pak->files[i].filelen;
-				file_from_pak = 1;
-				if (path_id)
-					*path_id = search->path_id;
-				if (handle)
-				{
-					*handle = pak->handle;
-					Sys_FileSeek (pak->handle, pak->files[i].filepos);
-					return com_filesize;
-				}
-				else if (file)
-				{ /* open a new file on the pakfile */
-					*file = fopen (pak->filename, "rb");
-					if (*file)
-						fseek (*file, pak->files[i].filepos, SEEK_SET);
-					return com_filesize;
-				}
-				else /* for COM_FileExists() */
-				{
-					return com_filesize;
-				}
-			}
-		}
-		else	/* check a file in the directory tree */
+		if (!search->pack)
+			continue;
+		for (i = 0; i < search->pack->numfiles; i++)
 		{
-			if (!registered.value)
-			{ /* if not a registered version, don't ever go beyond base */
-				if ( strchr (filename, '/') || strchr (filename,'\\'))
-					continue;
-			}
-
-			q_snprintf (netpath, sizeof(netpath), "%s/%s",search->filename, filename);
-			findtime = Sys_FileTime (netpath);
-			if (findtime == -1)
-				continue;
+			packfile_t *pf = &search->pack->files[i];
 
-			if (path_id)
-				*path_id = search->path_id;
-			if (handle)
-			{
-				com_filesize = Sys_FileOpenRead (netpath, &i);
-				*handle = i;
-				return com_filesize;
-			}
-			else if (file)
-			{
-				*file = fopen (netpath, "rb");
-				com_filesize = (*file == NULL) ? -1 : COM_filelength (*file);
-				return com_filesize;
-			}
-			else
+			bucket = COM_HashString (pf->name) & (com_filehashsize - 1);
+			for (j = com_filehash[bucket]; j != -1; j = com_fileindex[j].next)
 			{
-				return 0; /* dummy valid value for COM_FileExists() */
+				if (!strcmp(com_fileindex[j].file->name, pf->name))
+					break;
 			}
+			if (j != -1)
+				continue;	// overridden by an earlier entry
+
+			entry = &com_fileindex[com_fileindexcount];
+			entry->search = search;
+			entry->file = pf;
+			entry->next = com_filehash[bucket];
+			com_filehash[bucket] = com_fileindexcount++;
 		}
 	}
-
-	if (strcmp(COM_FileGetExtension(filename), "pcx") != 0
-		&& strcmp(COM_FileGetExtension(filename), "tga") != 0
-		&& strcmp(COM_FileGetExtension(filename), "lit") != 0
-		&& strcmp(COM_FileGetExtension(filename), "ent") != 0)
-		Con_DPrintf ("FindFile: can't find %s\n", filename);
-	else	Con_DPrintf2("FindFile: can't find %s\n", filename);
-		// Log pcx, tga, lit, ent misses only if (developer.value >= 2)
-
-	if (handle)
-		*handle = -1;
-	if (file)
-		*file = NULL;
-	com_filesize = -1;
-	return com_filesize;
 }
 
-
 /*
-===========
-COM_FileExists
+============
+COM_FindIndexedFile
 
-Returns whether the file is found in the quake filesystem.
-===========
+Returns the highest priority pak entry for filename, or NULL.
+============
 */
-qboolean COM_FileExists (const char *filename, unsigned int *path_id)
+static fileindex_t *COM_FindIndexedFile (const char *filename)
 {
-	int ret = COM_FindFile (filename, NULL, NULL, path_id);
-	return (ret == -1) ? false : true;
+	int		i;
+
+	if (!com_filehash)
+		COM_BuildFileIndex ();
+
+	i = com_filehash[COM_HashString(filename) & (com_filehashsize - 1)];
+	for ( ; i != -1; i = com_fileindex[i].next)
+	{
+		if (!strcmp(com_fileindex[i].file->name, filename))
+			return &com_fileindex[i];
+	}
+	return NULL;
 }
 
 /*
-===========
-COM_OpenFile
+=============================================================================
 
-filename never has a leading slash, but may contain directory walks
-returns a handle and a length
-it may actually be inside a pak file
-===========
+ZIP ARCHIVES
+
+pk3/zip files become pack_t's too, so they share the file index.  The local
+header of an entry is only read the first time the entry is opened.  Stored
+entries are read just like pak entries; deflated ones (only with USE_ZLIB)
+are inflated into the destination buffer, a temporary file for COM_FOpenFile,
+or on the fly for FS_fopen handles.
+
+=============================================================================
 */
-int COM_OpenFile (const char *filename, int *handle, unsigned int *path_id)
-{
-	return COM_FindFile (filename, handle, NULL, path_id);
-}
+
+#define ZIP_SHORT(p)	((p)[0] | ((p)[1] << 8))
+#define ZIP_LONG(p)	((p)[0] | ((p)[1] << 8) | ((p)[2] << 16) | ((unsigned int)(p)[3] << 24))
+
+#define ZIP_LOCAL_SIG	0x04034b50
+#define ZIP_CENTRAL_SIG	0x02014b50
+#define ZIP_END_SIG	0x06054b50
+#define ZIP_LOCAL_SIZE	30
+#define ZIP_CENTRAL_SIZE	46
+#define ZIP_END_SIZE	22
 
 /*
-===========
-COM_FOpenFile
+============
+COM_ResolveZipFile
 
-If the requested file is inside a packfile, a new FILE * will be opened
-into the file.
-===========
+Reads the local header to find where the data of a zip entry starts.
+============
 */
-int COM_FOpenFile (const char *filename, FILE **file, unsigned int *path_id)
+static qboolean COM_ResolveZipFile (pack_t *pak, packfile_t *pf)
 {
-	return COM_FindFile (filename, NULL, file, path_id);
+	byte	header[ZIP_LOCAL_SIZE];
+	byte	*p;
+
+	if (pf->filepos >= 0)
+		return true;
+
+	if (pak->mapped && pf->zipheader <= pak->mapsize - ZIP_LOCAL_SIZE)
+		p = pak->mapped + pf->zipheader;
+	else
+	{
+		Sys_FileSeek (pak->handle, pf->zipheader);
+		if (Sys_FileRead (pak->handle, header, ZIP_LOCAL_SIZE) != ZIP_LOCAL_SIZE)
+			return false;
+		p = header;
+	}
+	if (ZIP_LONG(p) != ZIP_LOCAL_SIG)
+		return false;
+
+	pf->filepos = pf->zipheader + ZIP_LOCAL_SIZE + ZIP_SHORT(p + 26) + ZIP_SHORT(p + 28);
+	return true;
 }
 
+#ifdef USE_ZLIB
 /*
 ============
-COM_CloseFile
+COM_InflateFile
 
-If it is a pak file handle, don't really close it
+Inflates a whole deflated zip entry into out, which holds filelen bytes.
 ============
 */
-void COM_CloseFile (int h)
+static qboolean COM_InflateFile (pack_t *pak, packfile_t *pf, byte *out)
 {
-	searchpath_t	*s;
+	z_stream	strm;
+	byte		*in;
+	qboolean	copied;
+	int		ret;
 
-	for (s = com_searchpaths; s; s = s->next)
-		if (s->pack && s->pack->handle == h)
-			return;
+	copied = !(pak->mapped && pf->deflatedlen <= pak->mapsize - pf->filepos);
+	if (!copied)
+		in = pak->mapped + pf->filepos;
+	else
+	{
+		in = (byte *) malloc (pf->deflatedlen);
+		if (!in)
+			return false;
+		Sys_FileSeek (pak->handle, pf->filepos);
+		if (Sys_FileRead (pak->handle, in, pf->deflatedlen) != pf->deflatedlen)
+		{
+			free (in);
+			return false;
+		}
+	}
 
-	Sys_FileClose (h);
-}
+	memset (&strm, 0, sizeof(strm));
+	ret = inflateInit2 (&strm, -MAX_WBITS);	// raw deflate, no zlib header
+	if (ret == Z_OK)
+	{
+		strm.next_in = in;
+		strm.avail_in = pf->deflatedlen;
+		strm.next_out = out;
+		strm.avail_out = pf->filelen;
+		ret = inflate (&strm, Z_FINISH);
+		inflateEnd (&strm);
+	}
 
+	if (copied)
+		free (in);
+	return (ret == Z_STREAM_END && strm.total_out == (uLong)pf->filelen);
+}
 
 /*
 ============
-COM_LoadFile
+COM_InflateToTempFile
 
-Filename are reletive to the quake directory.
-Allways appends a 0 byte.
+For COM_FOpenFile callers, which want a stdio FILE of the contents.
 ============
 */
-#define	LOADFILE_ZONE		0
-#define	LOADFILE_HUNK		1
-#define	LOADFILE_TEMPHUNK	2
-#define	LOADFILE_CACHE		3
-#define	LOADFILE_STACK		4
+static FILE *COM_InflateToTempFile (pack_t *pak, packfile_t *pf)
+{
+	FILE	*f;
+	byte	*buf;
+
+	buf = (byte *) malloc (pf->filelen + 1);
+	if (!buf)
+		return NULL;
+	f = NULL;
+	if (COM_InflateFile (pak, pf, buf))
+	{
+		f = tmpfile ();
+		if (f)
+		{
+			fwrite (buf, 1, pf->filelen, f);
+			rewind (f);
+		}
+	}
+	free (buf);
+	return f;
+}
+#endif	/* USE_ZLIB */
+
+/*
+=============================================================================
+
+FILE ACCESS TRACE
+
+"fs_trace <name.csv|name.json>" writes a record for every file the engine
+asks for to a file in the game directory, until "fs_trace" is given again
+without a name.  A record has the path, the pak or directory it came from
+(empty if it wasn't found), the loader that asked for it (set with
+COM_TraceLoader, empty for anything else), the access: the kind of call
+that asked for it, or for COM_LoadFile the memory it was loaded to, then
+the size, the bytes read and the time taken.  Streams opened with FS_fopen()
+are written when they're closed.  "fs_tracetop" lists the files that took
+longest so far, and the totals for each loader.
+
+=============================================================================
+*/
+
+typedef struct
+{
+	char		path[MAX_QPATH];
+	int		count;
+	double		bytes;
+	double		time;
+	const char	*loader;	// the first one to ask for it
+	int		next;		// hash chain
+} tracefile_t;
+
+typedef struct
+{
+	char		path[MAX_QPATH];
+	char		source[MAX_OSPATH];
+	const char	*loader;	// when it was opened
+	long		bytes;
+	double		time;
+} tracestream_t;
+
+typedef struct
+{
+	const char	*loader;
+	int		count;
+	double		bytes;
+	double		time;
+} traceloader_t;
+
+#define	TRACEHASH_SIZE	1024
+#define	MAX_TRACELOADERS	32
+
+static FILE		*com_tracefile;
+static qboolean		com_tracejson;
+static int		com_tracerecords;
+static tracefile_t	*com_tracefiles;
+static int		com_tracefilecount, com_tracefilemax;
+static int		com_tracehash[TRACEHASH_SIZE];
+static traceloader_t	com_traceloaders[MAX_TRACELOADERS];
+static int		com_traceloadercount;
+static const char	*com_traceloader = "";
+
+/*
+============
+COM_TraceLoader
+
+Tags the file calls that follow with the loader making them, until it's
+called again with NULL.  loader must be a string constant.
+============
+*/
+void COM_TraceLoader (const char *loader)
+{
+	com_traceloader = loader ? loader : "";
+}
+
+/*
+============
+COM_TraceSource
+
+Where the last COM_FindFile found its file.
+============
+*/
+static const char *COM_TraceSource (int size)
+{
+	if (size == -1)
+		return "";
+	if (file_from_pak)
+		return com_foundpack->filename;
+	return com_founddir ? com_founddir->filename : "";
+}
+
+static void COM_TraceString (const char *str)
+{
+	fputc ('"', com_tracefile);
+	for ( ; *str; str++)
+	{
+		if (*str == '"')
+			fputs (com_tracejson ? "\\\"" : "\"\"", com_tracefile);
+		else if (*str == '\\' && com_tracejson)
+			fputs ("\\\\", com_tracefile);
+		else
+			fputc (*str, com_tracefile);
+	}
+	fputc ('"', com_tracefile);
+}
+
+/*
+============
+COM_TraceFile
+============
+*/
+static void COM_TraceFile (const char *path, const char *source, const char *loader,
+				const char *access, int size, long bytes, double time)
+{
+	tracefile_t	*tf;
+	traceloader_t	*tl;
+	unsigned int	bucket;
+	int		i;
+
+	if (com_tracejson)
+	{
+		fputs (com_tracerecords ? ",\n{\"path\":" : "\n{\"path\":", com_tracefile);
+		COM_TraceString (path);
+		fputs (",\"source\":", com_tracefile);
+		COM_TraceString (source);
+		fputs (",\"loader\":", com_tracefile);
+		COM_TraceString (loader);
+		fputs (",\"access\":", com_tracefile);
+		COM_TraceString (access);
+		fprintf (com_tracefile, ",\"size\":%i,\"bytes\":%ld,\"ms\":%.3f}", size, bytes, time * 1000.0);
+	}
+	else
+	{
+		COM_TraceString (path);
+		fputc (',', com_tracefile);
+		COM_TraceString (source);
+		fputc (',', com_tracefile);
+		COM_TraceString (loader);
+		fputc (',', com_tracefile);
+		COM_TraceString (access);
+		fprintf (com_tracefile, ",%i,%ld,%.3f\n", size, bytes, time * 1000.0);
+	}
+	com_tracerecords++;
+
+	for (i = 0, tl = com_traceloaders; i < com_traceloadercount; i++, tl++)
+	{
+		if (!strcmp(tl->loader, loader))
+			break;
+	}
+	if (i < MAX_TRACELOADERS)
+	{
+		if (i == com_traceloadercount)
+		{
+			memset (tl, 0, sizeof(traceloader_t));
+			tl->loader = loader;
+			com_traceloadercount++;
+		}
+		tl->count++;
+		tl->bytes += bytes;
+		tl->time += time;
+	}
+
+	bucket = COM_HashString (path) & (TRACEHASH_SIZE - 1);
+	for (i = com_tracehash[bucket]; i != -1; i = com_tracefiles[i].next)
+	{
+		if (!strcmp(com_tracefiles[i].path, path))
+			break;
+	}
+	if (i == -1)
+	{
+		if (com_tracefilecount == com_tracefilemax)
+		{
+			tf = (tracefile_t *) realloc (com_tracefiles, (com_tracefilemax + 256) * sizeof(tracefile_t));
+			if (!tf)
+				return;
+			com_tracefiles = tf;
+			com_tracefilemax += 256;
+		}
+		i = com_tracefilecount++;
+		tf = &com_tracefiles[i];
+		memset (tf, 0, sizeof(tracefile_t));
+		q_strlcpy (tf->path, path, sizeof(tf->path));
+		tf->loader = loader;
+		tf->next = com_tracehash[bucket];
+		com_tracehash[bucket] = i;
+	}
+	tf = &com_tracefiles[i];
+	tf->count++;
+	tf->bytes += bytes;
+	tf->time += time;
+}
+
+/*
+============
+COM_StopTrace
+============
+*/
+static void COM_StopTrace (void)
+{
+	if (!com_tracefile)
+		return;
+	if (com_tracejson)
+		fputs ("\n]\n", com_tracefile);
+	fclose (com_tracefile);
+	com_tracefile = NULL;
+	Con_Printf ("fs_trace: %i records written\n", com_tracerecords);
+}
+
+/*
+============
+COM_Trace_f
+============
+*/
+static void COM_Trace_f (void)
+{
+	char	name[MAX_OSPATH];
+	int	i;
+
+	if (Cmd_Argc() < 2)
+	{
+		if (com_tracefile)
+			COM_StopTrace ();
+		else
+			Con_Printf ("usage: fs_trace <name.csv|name.json> to start, fs_trace to stop\n");
+		return;
+	}
+
+	COM_StopTrace ();
+
+	q_snprintf (name, sizeof(name), "%s/%s", com_gamedir, Cmd_Argv(1));
+	if (!*COM_FileGetExtension(name))
+		COM_AddExtension (name, ".csv", sizeof(name));
+	COM_CreatePath (name);
+	com_tracefile = fopen (name, "w");
+	if (!com_tracefile)
+	{
+		Con_Printf ("ERROR: couldn't open file %s.\n", name);
+		return;
+	}
+	com_tracejson = !q_strcasecmp (COM_FileGetExtension(name), "json");
+	if (com_tracejson)
+		fputs ("[", com_tracefile);
+	else
+		fputs ("path,source,loader,access,size,bytes,ms\n", com_tracefile);
+
+	com_tracerecords = 0;
+	com_tracefilecount = 0;
+	com_traceloadercount = 0;
+	for (i = 0; i < TRACEHASH_SIZE; i++)
+		com_tracehash[i] = -1;
+	Con_Printf ("tracing file access to %s\n", name);
+}
+
+static int COM_CompareTraceTime (const void *a, const void *b)
+{
+	double	ta = com_tracefiles[*(const int *)a].time;
+	double	tb = com_tracefiles[*(const int *)b].time;
+
+	return (ta < tb) - (ta > tb);
+}
+
+/*
+============
+COM_TraceTop_f
+============
+*/
+static void COM_TraceTop_f (void)
+{
+	tracefile_t	*tf;
+	traceloader_t	*tl;
+	int		*order;
+	int		i, count;
+	double		total;
+
+	if (!com_tracefilecount)
+	{
+		Con_Printf ("no files traced, see fs_trace\n");
+		return;
+	}
+
+	count = (Cmd_Argc() > 1) ? Q_atoi (Cmd_Argv(1)) : 20;
+	count = CLAMP (1, count, com_tracefilecount);
+
+	order = (int *) malloc (com_tracefilecount * sizeof(int));
+	if (!order)
+		return;
+	total = 0;
+	for (i = 0; i < com_tracefilecount; i++)
+	{
+		order[i] = i;
+		total += com_tracefiles[i].time;
+	}
+	qsort (order, com_tracefilecount, sizeof(int), COM_CompareTraceTime);
+
+	Con_Printf ("     ms    KB  reqs  loader    path\n");
+	for (i = 0; i < count; i++)
+	{
+		tf = &com_tracefiles[order[i]];
+		Con_Printf ("%7.2f %5.0f %5i  %-8s  %s\n", tf->time * 1000.0, tf->bytes / 1024.0, tf->count,
+				*tf->loader ? tf->loader : "-", tf->path);
+	}
+	Con_Printf ("%i files, %.2f ms total\n", com_tracefilecount, total * 1000.0);
+	free (order);
+
+	Con_Printf ("\n     ms    KB  reqs  loader\n");
+	for (i = 0, tl = com_traceloaders; i < com_traceloadercount; i++, tl++)
+		Con_Printf ("%7.2f %5.0f %5i  %s\n", tl->time * 1000.0, tl->bytes / 1024.0, tl->count, *tl->loader ? tl->loader : "-");
+}
+
+/*
+=============================================================================
+
+PREFETCH
+
+As soon as the precache lists of a map are known, the files that aren't
+loaded yet are queued here and read by a worker thread, while the main
+thread is still busy parsing the ones before them.  COM_LoadFile takes the
+finished buffer instead of reading the file itself.  Each file is located
+when it is queued, so the search path rules are those of a direct load.
+Entries of mapped paks are only touched to get them into the page cache,
+deflated zip entries are left to the loader.
+
+=============================================================================
+*/
+
+#define	MAX_PREFETCH_BYTES	(64 * 1024 * 1024)	/* buffered at once */
+
+typedef enum {pf_queued, pf_loading, pf_ready, pf_failed} pfstate_t;
+
+typedef struct prefetch_s
+{
+	struct prefetch_s	*next;
+	char		name[MAX_QPATH];
+	unsigned int	hash;
+	unsigned int	path_id;
+	int		from_pak;
+	const byte	*mapped;	// in a mapped pak: only touch it
+	char		ospath[MAX_OSPATH];	// otherwise read from here
+	int		offset;
+	int		length;		// -1 if not known yet (loose files)
+	byte		*data;		// malloc'd, once ready
+	pfstate_t	state;
+} prefetch_t;
+
+static cvar_t	fs_prefetch = {"fs_prefetch", "1", CVAR_NONE};
+static cvar_t	fs_readahead = {"fs_readahead", "32", CVAR_NONE};	// KB per FS_fopen handle
+
+static prefetch_t	*com_prefetch;		// in queue order
+static void		*com_prefetchthread, *com_prefetchlock, *com_prefetchcond;
+static qboolean		com_prefetchfailed;	// couldn't start the thread
+static qboolean		com_prefetchquit;	// tells the thread to return
+static int		com_prefetchbytes;	// held in buffers
+static int		com_prefetchhits, com_prefetchmisses;
+static unsigned int	com_prefetchkb;		// read ahead so far
+static volatile int	com_prefetchsink;	// keeps the page touching alive
+
+/*
+============
+COM_PrefetchThread
+
+Only touches the jobs and the counters with the lock held.
+============
+*/
+static int COM_PrefetchThread (void *unused)
+{
+	prefetch_t	*job;
+	FILE		*f;
+	byte		*data;
+	int		i, sum, length;
+	qboolean	ok;
+
+	Sys_LockMutex (com_prefetchlock);
+	while (!com_prefetchquit)
+	{
+		for (job = com_prefetch; job; job = job->next)
+		{
+			if (job->state == pf_queued)
+				break;
+		}
+		if (!job)
+		{
+			Sys_CondWait (com_prefetchcond, com_prefetchlock);
+			continue;
+		}
+		job->state = pf_loading;
+		length = job->length;
+		Sys_UnlockMutex (com_prefetchlock);
+
+		ok = false;
+		data = NULL;
+		if (job->mapped)
+		{
+			for (i = 0, sum = 0; i < length; i += 4096)
+				sum += job->mapped[i];
+			com_prefetchsink += sum;
+			ok = true;
+		}
+		else if ((f = fopen (job->ospath, "rb")) != NULL)
+		{
+			if (length == -1 && fseek (f, 0, SEEK_END) == 0)
+				length = (int) ftell (f);
+			Sys_LockMutex (com_prefetchlock);
+			if (length >= 0 && com_prefetchbytes + length <= MAX_PREFETCH_BYTES)
+				com_prefetchbytes += length;
+			else	length = -1;	// leave it to the loader
+			Sys_UnlockMutex (com_prefetchlock);
+
+			if (length >= 0 && (data = (byte *) malloc (length + 1)) != NULL)
+			{
+				if (fseek (f, job->offset, SEEK_SET) == 0 &&
+				    fread (data, 1, length, f) == (size_t) length)
+					ok = true;
+				else
+				{
+					free (data);
+					data = NULL;
+				}
+			}
+			if (!ok && length >= 0)
+			{
+				Sys_LockMutex (com_prefetchlock);
+				com_prefetchbytes -= length;
+				Sys_UnlockMutex (com_prefetchlock);
+			}
+			fclose (f);
+		}
+
+		Sys_LockMutex (com_prefetchlock);
+		job->data = data;
+		job->length = length;
+		job->state = ok ? pf_ready : pf_failed;
+		if (ok)
+			com_prefetchkb += (length + 1023) / 1024;
+		Sys_CondBroadcast (com_prefetchcond);
+	}
+	Sys_UnlockMutex (com_prefetchlock);
+
+	return 0;
+}
+
+/*
+============
+COM_PrefetchInit
+============
+*/
+static qboolean COM_PrefetchInit (void)
+{
+	if (com_prefetchthread)
+		return true;
+	if (com_prefetchfailed)
+		return false;
+
+	com_prefetchlock = Sys_CreateMutex ();
+	com_prefetchcond = Sys_CreateCond ();
+	if (com_prefetchlock && com_prefetchcond)
+		com_prefetchthread = Sys_CreateThread (COM_PrefetchThread, NULL);
+	if (!com_prefetchthread)
+	{
+		Con_DPrintf ("Couldn't start the prefetch thread\n");
+		if (com_prefetchcond)
+			Sys_DestroyCond (com_prefetchcond);
+		if (com_prefetchlock)
+			Sys_DestroyMutex (com_prefetchlock);
+		com_prefetchcond = com_prefetchlock = NULL;
+		com_prefetchfailed = true;
+		return false;
+	}
+	return true;
+}
+
+/*
+============
+COM_Prefetch
+
+Queues a file for reading in the background, if it exists.
+============
+*/
+void COM_Prefetch (const char *filename)
+{
+	prefetch_t	*job, **link;
+	unsigned int	hash, path_id;
+	int		length;
+
+	if (!fs_prefetch.value || !COM_PrefetchInit ())
+		return;
+
+	hash = COM_HashString (filename);
+	for (link = &com_prefetch; *link; link = &(*link)->next)
+	{	/* only this thread changes the list itself */
+		if ((*link)->hash == hash && !strcmp((*link)->name, filename))
+			return;
+	}
+
+	length = COM_FindFile (filename, NULL, NULL, &path_id);
+	if (length == -1)
+		return;
+
+	job = (prefetch_t *) calloc (1, sizeof(prefetch_t));
+	if (!job)
+		return;
+	q_strlcpy (job->name, filename, sizeof(job->name));
+	job->hash = hash;
+	job->path_id = path_id;
+	job->from_pak = file_from_pak;
+	if (file_from_pak)
+	{
+		if (com_foundfile->deflatedlen)
+		{
+			free (job);
+			return;
+		}
+		if (com_foundpack->mapped && com_foundfile->filepos + length <= com_foundpack->mapsize)
+			job->mapped = com_foundpack->mapped + com_foundfile->filepos;
+		else	q_strlcpy (job->ospath, com_foundpack->filename, sizeof(job->ospath));
+		job->offset = com_foundfile->filepos;
+		job->length = length;
+	}
+	else
+	{
+		q_snprintf (job->ospath, sizeof(job->ospath), "%s/%s", com_founddir->filename, filename);
+		job->length = -1;
+	}
+	job->state = pf_queued;
+
+	Sys_LockMutex (com_prefetchlock);
+	*link = job;
+	Sys_CondBroadcast (com_prefetchcond);
+	Sys_UnlockMutex (com_prefetchlock);
+}
+
+/*
+============
+COM_PrefetchTake
+
+Returns the prefetched contents of path, or NULL if the caller has to read
+it.  Waits if the worker is busy with it.  The buffer must be free()d.
+============
+*/
+static byte *COM_PrefetchTake (const char *path, int *len, unsigned int *path_id)
+{
+	prefetch_t	*job, **link;
+	unsigned int	hash;
+	byte		*data;
+
+	if (!com_prefetch)
+		return NULL;
+
+	hash = COM_HashString (path);
+	Sys_LockMutex (com_prefetchlock);
+	for (link = &com_prefetch; (job = *link) != NULL; link = &job->next)
+	{
+		if (job->hash == hash && !strcmp(job->name, path))
+			break;
+	}
+	if (!job)
+	{
+		Sys_UnlockMutex (com_prefetchlock);
+		return NULL;
+	}
+
+	while (job->state == pf_loading)
+		Sys_CondWait (com_prefetchcond, com_prefetchlock);
+	*link = job->next;
+
+	data = NULL;
+	if (job->state == pf_queued)
+		com_prefetchmisses++;
+	else if (job->state == pf_ready)
+	{
+		com_prefetchhits++;
+		if (job->data)
+		{
+			data = job->data;
+			com_prefetchbytes -= job->length;
+			*len = com_filesize = job->length;
+			file_from_pak = job->from_pak;
+			if (path_id)
+				*path_id = job->path_id;
+		}
+	}
+	Sys_UnlockMutex (com_prefetchlock);
+
+	free (job);
+	return data;
+}
+
+/*
+============
+COM_PrefetchClear
+
+Drops everything that wasn't used.  Must be called before any pack_t goes
+away, a job may point into its mapping.
+============
+*/
+void COM_PrefetchClear (void)
+{
+	prefetch_t	*job;
+
+	if (!com_prefetch)
+		return;
+
+	Sys_LockMutex (com_prefetchlock);
+	for (job = com_prefetch; job; job = job->next)
+	{
+		if (job->state == pf_queued)
+			job->state = pf_failed;	// keep the worker off it
+	}
+	for (job = com_prefetch; job; job = job->next)
+	{
+		while (job->state == pf_loading)
+			Sys_CondWait (com_prefetchcond, com_prefetchlock);
+	}
+	while (com_prefetch)
+	{
+		job = com_prefetch;
+		com_prefetch = job->next;
+		free (job->data);
+		free (job);
+	}
+	com_prefetchbytes = 0;
+	Sys_UnlockMutex (com_prefetchlock);
+}
+
+/*
+============
+COM_PrefetchStop
+
+Drops the queue and joins the thread, before the search paths go away.
+The next COM_Prefetch starts it again.
+============
+*/
+static void COM_PrefetchStop (void)
+{
+	if (!com_prefetchthread)
+		return;
+
+	COM_PrefetchClear ();
+	Sys_LockMutex (com_prefetchlock);
+	com_prefetchquit = true;
+	Sys_CondBroadcast (com_prefetchcond);
+	Sys_UnlockMutex (com_prefetchlock);
+	Sys_WaitThread (com_prefetchthread);
+
+	Sys_DestroyCond (com_prefetchcond);
+	Sys_DestroyMutex (com_prefetchlock);
+	com_prefetchthread = com_prefetchlock = com_prefetchcond = NULL;
+	com_prefetchquit = false;
+}
+
+/*
+============
+COM_Path_f
+============
+*/
+static void COM_Path_f (void)
+{
+	searchpath_t	*s;
+
+	Con_Printf ("Current search path:\n");
+	for (s = com_searchpaths; s; s = s->next)
+	{
+		if (s->pack)
+		{
+			Con_Printf ("%s (%i files)\n", s->pack->filename, s->pack->numfiles);
+		}
+		else
+			Con_Printf ("%s\n", s->filename);
+	}
+	Con_Printf ("%i missing files cached, %i lookups skipped\n", com_misscount, com_missavoided);
+	com_missavoided = 0;
+	Con_Printf ("prefetch: %i hits, %i misses, %u KB read ahead\n", com_prefetchhits, com_prefetchmisses, com_prefetchkb);
+}
+
+/*
+============
+COM_WriteFile
+
+The filename will be prefixed by the current game directory
+============
+*/
+void COM_WriteFile (const char *filename, const void *data, int len)
+{
+	int		handle;
+	char	name[MAX_OSPATH];
+
+	Sys_mkdir (com_gamedir); //johnfitz -- if we've switched to a nonexistant gamedir, create it now so we don't crash
+
+	q_snprintf (name, sizeof(name), "%s/%s", com_gamedir, filename);
+
+	handle = Sys_FileOpenWrite (name);
+	if (handle == -1)
+	{
+		Sys_Printf ("COM_WriteFile: failed on %s\n", name);
+		return;
+	}
+
+	Sys_Printf ("COM_WriteFile: %s\n", name);
+	Sys_FileWrite (handle, data, len);
+	Sys_FileClose (handle);
+	COM_FlushMissCache ();
+}
+
+/*
+============
+COM_CreatePath
+============
+*/
+void COM_CreatePath (char *path)
+{
+	char	*ofs;
+
+	for (ofs = path + 1; *ofs; ofs++)
+	{
+		if (*ofs == '/')
+		{	// create the directory
+			*ofs = 0;
+			Sys_mkdir (path);
+			*ofs = '/';
+		}
+	}
+}
+
+/*
+================
+COM_filelength
+================
+*/
+long COM_filelength (FILE *f)
+{
+	long		pos, end;
+
+	pos = ftell (f);
+	fseek (f, 0, SEEK_END);
+	end = ftell (f);
+	fseek (f, pos, SEEK_SET);
+
+	return end;
+}
+
+/*
+===========
+COM_FindFile
+
+Finds the file in the search path.
+Sets com_filesize and one of handle or file
+If neither of file or handle is set, this
+can be used for detecting a file's presence.
+===========
+*/
+static int COM_FindFile (const char *filename, int *handle, FILE **file,
+							unsigned int *path_id)
+{
+	searchpath_t	*search;
+	char		netpath[MAX_OSPATH];
+	pack_t		*pak;
+	packfile_t	*pf;
+	fileindex_t	*index;
+	int		i, findtime;
+	unsigned int	hash;
+	qboolean	fullsearch = false;
+
+	if (file && handle)
+		Sys_Error ("COM_FindFile: both handle and file set");
+
+	file_from_pak = 0;
+
+	index = COM_FindIndexedFile (filename);
+	hash = COM_HashString (filename);
+
+//
+// search through the path, one element at a time
+//
+	for (search = com_searchpaths; search; search = search->next)
+	{
+		if (search->pack)	/* the index knows which pak has it, if any */
+		{
+			pak = search->pack;
+			if (index && index->search == search)
+				pf = index->file;
+			else if (fullsearch)
+			{ /* the indexed entry was unusable, the index knows nothing of the others */
+				for (i = 0, pf = NULL; i < pak->numfiles; i++)
+				{
+					if (!strcmp(pak->files[i].name, filename))
+					{
+						pf = &pak->files[i];
+						break;
+					}
+				}
+				if (!pf)
+					continue;
+			}
+			else	continue;
+			// found it!
+			if (!COM_ResolveZipFile (pak, pf))
+			{
+				Con_Printf ("%s: bad local header for %s\n", pak->filename, filename);
+				fullsearch = true;
+				continue;
+			}
+			com_filesize = pf->filelen;
+			file_from_pak = 1;
+			if (!pf->touched)
+				pf->touched = ++com_touchcount;
+			com_foundpack = pak;
+			com_foundfile = pf;
+			if (path_id)
+				*path_id = search->path_id;
+			if (handle)
+			{ /* COM_LoadFile inflates deflated entries itself */
+				*handle = pak->handle;
+				Sys_FileSeek (pak->handle, pf->filepos);
+				return com_filesize;
+			}
+			else if (file)
+			{ /* open a new file on the pakfile */
+#ifdef USE_ZLIB
+				if (pf->deflatedlen)
+				{
+					*file = COM_InflateToTempFile (pak, pf);
+					return com_filesize;
+				}
+#endif
+				*file = fopen (pak->filename, "rb");
+				if (*file)
+					fseek (*file, pf->filepos, SEEK_SET);
+				return com_filesize;
+			}
+			else /* for COM_FileExists() */
+			{
+				return com_filesize;
+			}
+		}
+		else	/* check a file in the directory tree */
+		{
+			if (!registered.value)
+			{ /* if not a registered version, don't ever go beyond base */
+				if ( strchr (filename, '/') || strchr (filename,'\\'))
+					continue;
+			}
+
+			if (COM_IsKnownMissing (search, filename, hash))
+				continue;
+			q_snprintf (netpath, sizeof(netpath), "%s/%s",search->filename, filename);
+			findtime = Sys_FileTime (netpath);
+			if (findtime == -1)
+			{
+				COM_AddKnownMissing (search, filename, hash);
+				continue;
+			}
+
+			com_founddir = search;
+			if (path_id)
+				*path_id = search->path_id;
+			if (handle)
+			{
+				com_filesize = Sys_FileOpenRead (netpath, &i);
+				*handle = i;
+				return com_filesize;
+			}
+			else if (file)
+			{
+				*file = fopen (netpath, "rb");
+				com_filesize = (*file == NULL) ? -1 : COM_filelength (*file);
+				return com_filesize;
+			}
+			else
+			{
+				return 0; /* dummy valid value for COM_FileExists() */
+			}
+		}
+	}
+
+	if (strcmp(COM_FileGetExtension(filename), "pcx") != 0
+		&& strcmp(COM_FileGetExtension(filename), "tga") != 0
+		&& strcmp(COM_FileGetExtension(filename), "lit") != 0
+		&& strcmp(COM_FileGetExtension(filename), "ent") != 0)
+		Con_DPrintf ("FindFile: can't find %s\n", filename);
+	else	Con_DPrintf2("FindFile: can't find %s\n", filename);
+		// Log pcx, tga, lit, ent misses only if (developer.value >= 2)
+
+	if (handle)
+		*handle = -1;
+	if (file)
+		*file = NULL;
+	com_filesize = -1;
+	return com_filesize;
+}
+
+
+/*
+===========
+COM_FileExists
+
+Returns whether the file is found in the quake filesystem.
+===========
+*/
+qboolean COM_FileExists (const char *filename, unsigned int *path_id)
+{
+	double	start = com_tracefile ? Sys_PreciseTime () : 0;
+	int ret = COM_FindFile (filename, NULL, NULL, path_id);
+
+	if (com_tracefile)
+		COM_TraceFile (filename, COM_TraceSource(ret), com_traceloader, "exists", ret, 0, Sys_PreciseTime () - start);
+	return (ret == -1) ? false : true;
+}
+
+/*
+===========
+COM_OpenFile
+
+filename never has a leading slash, but may contain directory walks
+returns a handle and a length
+it may actually be inside a pak file
+===========
+*/
+int COM_OpenFile (const char *filename, int *handle, unsigned int *path_id)
+{
+	double	start = com_tracefile ? Sys_PreciseTime () : 0;
+	int ret = COM_FindFile (filename, handle, NULL, path_id);
+
+	if (com_tracefile)
+		COM_TraceFile (filename, COM_TraceSource(ret), com_traceloader, "open", ret, 0, Sys_PreciseTime () - start);
+	return ret;
+}
+
+/*
+===========
+COM_FOpenFile
+
+If the requested file is inside a packfile, a new FILE * will be opened
+into the file.
+===========
+*/
+int COM_FOpenFile (const char *filename, FILE **file, unsigned int *path_id)
+{
+	double	start = com_tracefile ? Sys_PreciseTime () : 0;
+	int ret = COM_FindFile (filename, NULL, file, path_id);
+
+	if (com_tracefile)
+		COM_TraceFile (filename, COM_TraceSource(ret), com_traceloader, "fopen", ret, 0, Sys_PreciseTime () - start);
+	return ret;
+}
+
+/*
+============
+COM_CloseFile
+
+If it is a pak file handle, don't really close it
+============
+*/
+void COM_CloseFile (int h)
+{
+	searchpath_t	*s;
+
+	for (s = com_searchpaths; s; s = s->next)
+		if (s->pack && s->pack->handle == h)
+			return;
+
+	Sys_FileClose (h);
+}
+
+
+/*
+============
+COM_LoadFile
+
+Filename are reletive to the quake directory.
+Allways appends a 0 byte.
+============
+*/
+#define	LOADFILE_ZONE		0
+#define	LOADFILE_HUNK		1
+#define	LOADFILE_TEMPHUNK	2
+#define	LOADFILE_CACHE		3
+#define	LOADFILE_STACK		4
 #define	LOADFILE_MALLOC		5
 
+static const char *loadfile_names[] = {"zone", "hunk", "temphunk", "cache", "stack", "malloc"};
+
 static byte	*loadbuf;
 static cache_user_t *loadcache;
 static int	loadsize;
@@ -1785,16 +2894,34 @@ static int	loadsize;
 byte *COM_LoadFile (const char *path, int usehunk, unsigned int *path_id)
 {
 	int		h;
-	byte	*buf;
+	byte	*buf, *prefetched;
 	char	base[32];
 	int		len;
+	double	start;
+	const char	*source;
 
 	buf = NULL;	// quiet compiler warning
+	h = -1;
+	start = com_tracefile ? Sys_PreciseTime () : 0;
+	if (usehunk < LOADFILE_ZONE || usehunk > LOADFILE_MALLOC)
+		Sys_Error ("COM_LoadFile: bad usehunk");
 
-// look for it in the filesystem or pack files
-	len = COM_OpenFile (path, &h, path_id);
-	if (h == -1)
-		return NULL;
+// look for it in the filesystem or pack files, unless the prefetch
+// thread already read it
+	prefetched = COM_PrefetchTake (path, &len, path_id);
+	if (prefetched)
+		source = "prefetch";
+	else
+	{
+		len = COM_FindFile (path, &h, NULL, path_id);
+		source = COM_TraceSource (len);
+		if (h == -1)
+		{
+			if (com_tracefile)
+				COM_TraceFile (path, source, com_traceloader, loadfile_names[usehunk], -1, 0, Sys_PreciseTime () - start);
+			return NULL;
+		}
+	}
 
 // extract the filename base name for hunk tag
 	COM_FileBase (path, base, sizeof(base));
@@ -1831,9 +2958,27 @@ byte *COM_LoadFile (const char *path, int usehunk, unsigned int *path_id)
 
 	((byte *)buf)[len] = 0;
 
-	Sys_FileRead (h, buf, len);
-	COM_CloseFile (h);
+	if (prefetched)
+	{
+		memcpy (buf, prefetched, len);
+		free (prefetched);
+	}
+	else
+	{
+#ifdef USE_ZLIB
+		if (file_from_pak && com_foundfile->deflatedlen)
+		{
+			if (!COM_InflateFile (com_foundpack, com_foundfile, buf))
+				Sys_Error ("COM_LoadFile: %s is corrupt in %s", path, com_foundpack->filename);
+		}
+		else
+#endif
+		Sys_FileRead (h, buf, len);
+		COM_CloseFile (h);
+	}
 
+	if (com_tracefile)
+		COM_TraceFile (path, source, com_traceloader, loadfile_names[usehunk], len, len, Sys_PreciseTime () - start);
 	return buf;
 }
 
@@ -1905,113 +3050,701 @@ byte *COM_LoadMallocFile_TextMode_OSPath (const char *path, long *len_out)
 		free (data);
 		return NULL;
 	}
-	data[actuallen] = '\0';
-	
-	if (len_out != NULL)
-		*len_out = actuallen;
-	return data;
+	data[actuallen] = '\0';
+	
+	if (len_out != NULL)
+		*len_out = actuallen;
+	return data;
+}
+
+const byte *COM_MapFile (const char *path, int *len, unsigned int *path_id)
+{
+	byte	*buf;
+	int	size;
+	double	start = com_tracefile ? Sys_PreciseTime () : 0;
+
+	size = COM_FindFile (path, NULL, NULL, path_id);
+	if (size == -1)
+	{
+		if (com_tracefile)
+			COM_TraceFile (path, "", com_traceloader, "map", -1, 0, Sys_PreciseTime () - start);
+		return NULL;
+	}
+
+	// hand out the mapping only if the entry is sane and aligned, the
+	// loaders access the data through int and float pointers
+	if (file_from_pak && com_foundpack->mapped && !com_foundfile->deflatedlen &&
+	    com_foundfile->filepos >= 0 && !(com_foundfile->filepos & 3) &&
+	    size <= com_foundpack->mapsize - com_foundfile->filepos)
+	{
+		free (COM_PrefetchTake (path, len, NULL));	/* only touched, but count it */
+		*len = size;
+		if (com_tracefile)
+			COM_TraceFile (path, com_foundpack->filename, com_traceloader, "map", size, 0, Sys_PreciseTime () - start);
+		return com_foundpack->mapped + com_foundfile->filepos;
+	}
+
+	buf = COM_LoadTempFile (path, path_id);
+	if (buf)
+		*len = com_filesize;
+	return buf;
+}
+
+const char *COM_ParseIntNewline(const char *buffer, int *value)
+{
+	int consumed = 0;
+	sscanf (buffer, "%i\n%n", value, &consumed);
+	return buffer + consumed;
+}
+
+const char *COM_ParseFloatNewline(const char *buffer, float *value)
+{
+	int consumed = 0;
+	sscanf (buffer, "%f\n%n", value, &consumed);
+	return buffer + consumed;
+}
+
+const char *COM_ParseStringNewline(const char *buffer)
+{
+	int consumed = 0;
+	com_token[0] = '\0';
+	sscanf (buffer, "%1023s\n%n", com_token, &consumed);
+	return buffer + consumed;
+}
+
+/*
+=================
+COM_OpenPackFile
+
+The first step of loading a pak, on the main thread: opens it if it's
+there.  Loading a pak is split up so that the directories of all paks in
+a game directory can be read in parallel by COM_ReadPackDirectories, and
+COM_FinishPackFile then adds them in a fixed order.
+=================
+*/
+typedef struct
+{
+	char		filename[MAX_OSPATH];
+	int		handle, size;
+	qboolean	qspak;		// quakespasm.pak, doesn't count as a modification
+	packfile_t	*files;		// malloc'd by the directory reader
+	int		numfiles;
+	qboolean	modified;	// not an original id1 pak
+	char		error[MAX_OSPATH + 64];	// for Sys_Error, on the main thread
+} packload_t;
+
+static qboolean COM_OpenPackFile (packload_t *pl)
+{
+	pl->size = Sys_FileOpenRead (pl->filename, &pl->handle);
+	pl->qspak = false;
+	pl->files = NULL;
+	pl->numfiles = 0;
+	pl->modified = false;
+	pl->error[0] = 0;
+	return (pl->size == -1) ? false : true;
+}
+
+/*
+=================
+COM_ReadPackDirectory -- johnfitz -- modified based on topaz's tutorial
+
+Loads the header and directory.  May run on any thread, so errors are
+left in pl->error and nothing but malloc is used for memory.
+=================
+*/
+static void COM_ReadPackDirectory (packload_t *pl)
+{
+	dpackheader_t	header;
+	int		i;
+	dpackfile_t	*info;
+	unsigned short	crc;
+
+	if (Sys_FileRead (pl->handle, (void *)&header, sizeof(header)) != (int) sizeof(header) ||
+	    header.id[0] != 'P' || header.id[1] != 'A' || header.id[2] != 'C' || header.id[3] != 'K')
+	{
+		q_snprintf (pl->error, sizeof(pl->error), "%s is not a packfile", pl->filename);
+		return;
+	}
+
+	header.dirofs = LittleLong (header.dirofs);
+	header.dirlen = LittleLong (header.dirlen);
+
+	pl->numfiles = header.dirlen / sizeof(dpackfile_t);
+
+	if (header.dirlen < 0 || header.dirofs < 0)
+	{
+		q_snprintf (pl->error, sizeof(pl->error), "Invalid packfile %s (dirlen: %i, dirofs: %i)",
+					pl->filename, header.dirlen, header.dirofs);
+		return;
+	}
+	if (!pl->numfiles)
+		return;
+	if (pl->numfiles > MAX_FILES_IN_PACK)
+	{
+		q_snprintf (pl->error, sizeof(pl->error), "%s has %i files", pl->filename, pl->numfiles);
+		return;
+	}
+
+	if (pl->numfiles != PAK0_COUNT)
+		pl->modified = true;	// not the original file
+
+	info = (dpackfile_t *) malloc (header.dirlen);
+	pl->files = (packfile_t *) calloc (pl->numfiles, sizeof(packfile_t));
+	if (!info || !pl->files)
+	{
+		free (info);
+		q_snprintf (pl->error, sizeof(pl->error), "Not enough memory for %s", pl->filename);
+		return;
+	}
+
+	Sys_FileSeek (pl->handle, header.dirofs);
+	Sys_FileRead (pl->handle, (void *)info, header.dirlen);
+
+	// crc the directory to check for modifications
+	crc = CRC_Block ((byte *)info, header.dirlen);
+	if (crc != PAK0_CRC_V106 && crc != PAK0_CRC_V101 && crc != PAK0_CRC_V100)
+		pl->modified = true;
+
+	// parse the directory
+	for (i = 0; i < pl->numfiles; i++)
+	{
+		q_strlcpy (pl->files[i].name, info[i].name, sizeof(pl->files[i].name));
+		pl->files[i].filepos = LittleLong(info[i].filepos);
+		pl->files[i].filelen = LittleLong(info[i].filelen);
+	}
+	free (info);
+}
+
+/*
+=================
+COM_ReadPackDirectories
+
+Runs COM_ReadPackDirectory on all paks, spread over a few threads.
+=================
+*/
+#define	MAX_PACKTHREADS		4
+
+typedef struct
+{
+	packload_t	*paks;
+	int		numpaks;
+	int		next;		// next pak to read
+	void		*lock;
+} packqueue_t;
+
+static int COM_PackDirectoryThread (void *data)
+{
+	packqueue_t	*q = (packqueue_t *) data;
+	int		i;
+
+	for (;;)
+	{
+		Sys_LockMutex (q->lock);
+		i = q->next++;
+		Sys_UnlockMutex (q->lock);
+		if (i >= q->numpaks)
+			return 0;
+		COM_ReadPackDirectory (&q->paks[i]);
+	}
+}
+
+static void COM_ReadPackDirectories (packload_t *paks, int numpaks)
+{
+	packqueue_t	q;
+	void		*threads[MAX_PACKTHREADS];
+	int		i, numthreads;
+
+	q.paks = paks;
+	q.numpaks = numpaks;
+	q.next = 0;
+	q.lock = (numpaks > 1) ? Sys_CreateMutex () : NULL;
+
+	numthreads = 0;
+	if (q.lock)
+	{
+		while (numthreads < MAX_PACKTHREADS && numthreads < numpaks - 1)
+		{
+			threads[numthreads] = Sys_CreateThread (COM_PackDirectoryThread, &q);
+			if (!threads[numthreads])
+				break;
+			numthreads++;
+		}
+	}
+
+	if (q.lock)
+		COM_PackDirectoryThread (&q);	// this thread helps out
+	else
+	{
+		for (i = 0; i < numpaks; i++)
+			COM_ReadPackDirectory (&paks[i]);
+	}
+
+	for (i = 0; i < numthreads; i++)
+		Sys_WaitThread (threads[i]);
+	if (q.lock)
+		Sys_DestroyMutex (q.lock);
+}
+
+/*
+=================
+COM_FinishPackFile
+
+The last step, on the main thread again.  Returns NULL for an empty pak.
+=================
+*/
+static pack_t *COM_FinishPackFile (packload_t *pl)
+{
+	pack_t		*pack;
+
+	if (pl->error[0])
+		Sys_Error ("%s", pl->error);
+	if (!pl->numfiles)
+	{
+		Sys_Printf ("WARNING: %s has no files, ignored\n", pl->filename);
+		Sys_FileClose (pl->handle);
+		return NULL;
+	}
+
+	pack = (pack_t *) Z_Malloc (sizeof (pack_t));
+	q_strlcpy (pack->filename, pl->filename, sizeof(pack->filename));
+	pack->handle = pl->handle;
+	pack->numfiles = pl->numfiles;
+	pack->files = (packfile_t *) Z_Malloc(pl->numfiles * sizeof(packfile_t));
+	memcpy (pack->files, pl->files, pl->numfiles * sizeof(packfile_t));
+	free (pl->files);
+	pl->files = NULL;
+	if (!com_nopakmap)
+		pack->mapped = (byte *) Sys_FileMap (pack->handle, pl->size);
+	if (pack->mapped)
+		pack->mapsize = pl->size;
+
+	//Sys_Printf ("Added packfile %s (%i files)\n", pl->filename, pl->numfiles);
+	return pack;
+}
+
+/*
+=================
+COM_LoadZipFile
+
+Takes an explicit path to a pk3/zip archive and loads its central directory.
+Directories, encrypted entries, names too long for a packfile_t and methods
+other than store (and deflate, with USE_ZLIB) are skipped.
+=================
+*/
+static pack_t *COM_LoadZipFile (const char *zipfile)
+{
+	byte		*buf, *p, *end, *next;
+	int		ziphandle, zipsize;
+	int		i, len, numentries, cdofs, cdlen;
+	int		numfiles, skipped, namelen, method;
+	packfile_t	*newfiles, *pf;
+	pack_t		*pack;
+
+	zipsize = Sys_FileOpenRead (zipfile, &ziphandle);
+	if (zipsize == -1)
+		return NULL;
+
+	// the end of central directory record is last, but may be
+	// followed by a comment of up to 64k
+	len = q_min(zipsize, ZIP_END_SIZE + 0xffff);
+	buf = (byte *) malloc (len);
+	if (!buf)
+		Sys_Error ("COM_LoadZipFile: out of memory for %s", zipfile);
+	Sys_FileSeek (ziphandle, zipsize - len);
+	p = NULL;
+	if (len >= ZIP_END_SIZE && Sys_FileRead (ziphandle, buf, len) == len)
+	{
+		for (p = buf + len - ZIP_END_SIZE; p >= buf; p--)
+		{
+			if (ZIP_LONG(p) == ZIP_END_SIG)
+				break;
+		}
+	}
+	if (!p || p < buf)
+	{
+		Sys_Printf ("WARNING: %s is not a zip file, ignored\n", zipfile);
+		free (buf);
+		Sys_FileClose (ziphandle);
+		return NULL;
+	}
+	numentries = ZIP_SHORT(p + 10);
+	cdlen = (int) ZIP_LONG(p + 12);
+	cdofs = (int) ZIP_LONG(p + 16);
+	free (buf);
+
+	// zip64 archives have all ones in here
+	if (!numentries || cdlen <= 0 || cdofs < 0 || cdofs > zipsize - cdlen)
+	{
+		Sys_Printf ("WARNING: %s has no usable central directory, ignored\n", zipfile);
+		Sys_FileClose (ziphandle);
+		return NULL;
+	}
+
+	buf = (byte *) malloc (cdlen);
+	if (!buf)
+		Sys_Error ("COM_LoadZipFile: out of memory for %s", zipfile);
+	Sys_FileSeek (ziphandle, cdofs);
+	if (Sys_FileRead (ziphandle, buf, cdlen) != cdlen)
+		Sys_Error ("Error reading central directory of %s", zipfile);
+
+	newfiles = (packfile_t *) Z_Malloc (numentries * sizeof(packfile_t));
+	numfiles = skipped = 0;
+	end = buf + cdlen;
+	for (i = 0, p = buf; i < numentries; i++, p = next)
+	{
+		if (end - p < ZIP_CENTRAL_SIZE || ZIP_LONG(p) != ZIP_CENTRAL_SIG)
+			break;
+		namelen = ZIP_SHORT(p + 28);
+		next = p + ZIP_CENTRAL_SIZE + namelen + ZIP_SHORT(p + 30) + ZIP_SHORT(p + 32);
+		if (next > end)
+			break;
+
+		if (!namelen || p[ZIP_CENTRAL_SIZE + namelen - 1] == '/')
+			continue;	// directory
+		method = ZIP_SHORT(p + 10);
+		if (namelen >= MAX_QPATH || (ZIP_SHORT(p + 8) & 1) ||
+#ifdef USE_ZLIB
+		    (method != 0 && method != Z_DEFLATED) ||
+#else
+		    method != 0 ||
+#endif
+		    (int) ZIP_LONG(p + 24) < 0 || (int) ZIP_LONG(p + 42) < 0)
+		{
+			skipped++;
+			continue;
+		}
+
+		pf = &newfiles[numfiles++];
+		memcpy (pf->name, p + ZIP_CENTRAL_SIZE, namelen);
+		pf->name[namelen] = 0;
+		pf->filepos = -1;
+		pf->filelen = (int) ZIP_LONG(p + 24);
+		pf->deflatedlen = method ? (int) ZIP_LONG(p + 20) : 0;
+		pf->zipheader = (int) ZIP_LONG(p + 42);
+	}
+	free (buf);
+
+	if (i < numentries)
+		Sys_Printf ("WARNING: %s has a truncated central directory\n", zipfile);
+	if (skipped)
+		Sys_Printf ("WARNING: %s: %i unsupported entries skipped\n", zipfile, skipped);
+	if (!numfiles)
+	{
+		Sys_Printf ("WARNING: %s has no files, ignored\n", zipfile);
+		Z_Free (newfiles);
+		Sys_FileClose (ziphandle);
+		return NULL;
+	}
+
+	com_modified = true;	// not the original file
+
+	pack = (pack_t *) Z_Malloc (sizeof (pack_t));
+	q_strlcpy (pack->filename, zipfile, sizeof(pack->filename));
+	pack->handle = ziphandle;
+	pack->numfiles = numfiles;
+	pack->files = newfiles;
+	pack->zip = true;
+	if (!com_nopakmap)
+		pack->mapped = (byte *) Sys_FileMap (ziphandle, zipsize);
+	if (pack->mapped)
+		pack->mapsize = zipsize;
+
+	return pack;
+}
+
+static int COM_CompareNames (const void *a, const void *b)
+{
+	return q_strcasecmp (*(const char **)a, *(const char **)b);
+}
+
+/*
+=================
+COM_AddZipFiles
+
+Adds all pk3 archives of com_gamedir to the search path.  They are added in
+alphabetical order, so later ones override earlier ones.
+=================
+*/
+static void COM_AddZipFiles (unsigned int path_id)
+{
+#ifdef _WIN32
+	WIN32_FIND_DATA	fdat;
+	HANDLE		fhnd;
+#else
+	DIR		*dir_p;
+	struct dirent	*dir_t;
+#endif
+	char		filestring[MAX_OSPATH];
+	char		**names;
+	int		i, numnames, maxnames;
+	searchpath_t	*search;
+	pack_t		*pak;
+
+	names = NULL;
+	numnames = maxnames = 0;
+
+#ifdef _WIN32
+	q_snprintf (filestring, sizeof(filestring), "%s/*.pk3", com_gamedir);
+	fhnd = FindFirstFile(filestring, &fdat);
+	if (fhnd == INVALID_HANDLE_VALUE)
+		return;
+	do
+	{
+		const char *name = fdat.cFileName;
+#else
+	dir_p = opendir(com_gamedir);
+	if (dir_p == NULL)
+		return;
+	while ((dir_t = readdir(dir_p)) != NULL)
+	{
+		const char *name = dir_t->d_name;
+		if (q_strcasecmp(COM_FileGetExtension(name), "pk3") != 0)
+			continue;
+#endif
+		if (numnames == maxnames)
+		{
+			maxnames = maxnames ? maxnames * 2 : 16;
+			names = (char **) realloc (names, maxnames * sizeof(char *));
+			if (!names)
+				Sys_Error ("COM_AddZipFiles: out of memory");
+		}
+		names[numnames] = (char *) malloc (strlen(name) + 1);
+		if (!names[numnames])
+			Sys_Error ("COM_AddZipFiles: out of memory");
+		strcpy (names[numnames++], name);
+#ifdef _WIN32
+	} while (FindNextFile(fhnd, &fdat));
+	FindClose(fhnd);
+#else
+	}
+	closedir(dir_p);
+#endif
+
+	qsort (names, numnames, sizeof(char *), COM_CompareNames);
+
+	for (i = 0; i < numnames; i++)
+	{
+		q_snprintf (filestring, sizeof(filestring), "%s/%s", com_gamedir, names[i]);
+		pak = COM_LoadZipFile (filestring);
+		if (pak)
+		{
+			search = (searchpath_t *) Z_Malloc(sizeof(searchpath_t));
+			search->path_id = path_id;
+			search->pack = pak;
+			search->next = com_searchpaths;
+			com_searchpaths = search;
+		}
+		free (names[i]);
+	}
+	free (names);
 }
 
-const char *COM_ParseIntNewline(const char *buffer, int *value)
-{
-	int consumed = 0;
-	sscanf (buffer, "%i\n%n", value, &consumed);
-	return buffer + consumed;
-}
+/*
+=============================================================================
 
-const char *COM_ParseFloatNewline(const char *buffer, float *value)
-{
-	int consumed = 0;
-	sscanf (buffer, "%f\n%n", value, &consumed);
-	return buffer + consumed;
-}
+PAK REORDERING
 
-const char *COM_ParseStringNewline(const char *buffer)
+Every pak entry remembers when it was first used.  After loading the maps
+of interest, "pak_reorder <pak> <newpak>" writes a copy of the pak with the
+used entries first, in the order they were used, followed by the rest in
+their original order, so that a map load reads the pak front to back.  The
+entries are 4-byte aligned so COM_MapFile can hand them out directly.  The
+format is unchanged, any engine reads the result.  "pak_touchreset" forgets
+the recorded order.
+
+=============================================================================
+*/
+
+static pack_t		*com_reorderpack;	// for COM_CompareTouched
+
+static int COM_CompareTouched (const void *a, const void *b)
 {
-	int consumed = 0;
-	com_token[0] = '\0';
-	sscanf (buffer, "%1023s\n%n", com_token, &consumed);
-	return buffer + consumed;
+	const packfile_t	*fa = &com_reorderpack->files[*(const int *)a];
+	const packfile_t	*fb = &com_reorderpack->files[*(const int *)b];
+
+	if (fa->touched && fb->touched)
+		return fa->touched - fb->touched;
+	if (fa->touched || fb->touched)
+		return fa->touched ? -1 : 1;
+	return *(const int *)a - *(const int *)b;	// keep the original order
 }
 
 /*
-=================
-COM_LoadPackFile -- johnfitz -- modified based on topaz's tutorial
-
-Takes an explicit (not game tree related) path to a pak file.
+============
+COM_WritePackEntry
 
-Loads the header and directory, adding the files at the beginning
-of the list so they override previous pack files.
-=================
+Copies one entry of pak to f.
+============
 */
-static pack_t *COM_LoadPackFile (const char *packfile)
+static qboolean COM_WritePackEntry (FILE *f, pack_t *pak, packfile_t *pf)
 {
-	dpackheader_t	header;
-	int		i;
-	packfile_t	*newfiles;
-	int		numpackfiles;
-	pack_t		*pack;
-	int		packhandle;
-	dpackfile_t	info[MAX_FILES_IN_PACK];
-	unsigned short	crc;
-
-	if (Sys_FileOpenRead (packfile, &packhandle) == -1)
-		return NULL;
+	byte	buf[32768];
+	int	pos, n;
 
-	Sys_FileRead (packhandle, (void *)&header, sizeof(header));
-	if (header.id[0] != 'P' || header.id[1] != 'A' || header.id[2] != 'C' || header.id[3] != 'K')
-		Sys_Error ("%s is not a packfile", packfile);
+	if (pak->mapped && pf->filepos + pf->filelen <= pak->mapsize)
+		return fwrite (pak->mapped + pf->filepos, 1, pf->filelen, f) == (size_t) pf->filelen;
 
-	header.dirofs = LittleLong (header.dirofs);
-	header.dirlen = LittleLong (header.dirlen);
+	Sys_FileSeek (pak->handle, pf->filepos);
+	for (pos = 0; pos < pf->filelen; pos += n)
+	{
+		n = q_min(pf->filelen - pos, (int) sizeof(buf));
+		if (Sys_FileRead (pak->handle, buf, n) != n)
+			return false;
+		if (fwrite (buf, 1, n, f) != (size_t) n)
+			return false;
+	}
+	return true;
+}
 
-	numpackfiles = header.dirlen / sizeof(dpackfile_t);
+/*
+============
+COM_PakReorder_f
+============
+*/
+static void COM_PakReorder_f (void)
+{
+	searchpath_t	*search;
+	pack_t		*pak;
+	packfile_t	*pf;
+	dpackheader_t	header;
+	dpackfile_t	*info;
+	int		*order;
+	int		i, ofs, touched;
+	char		name[MAX_OSPATH];
+	FILE		*f;
+	static const byte	zeros[4] = {0, 0, 0, 0};
+
+	if (Cmd_Argc() != 3)
+	{
+		Con_Printf ("usage: pak_reorder <pak> <newpak>\n");
+		return;
+	}
 
-	if (header.dirlen < 0 || header.dirofs < 0)
+	pak = NULL;
+	for (search = com_searchpaths; search; search = search->next)
 	{
-		Sys_Error ("Invalid packfile %s (dirlen: %i, dirofs: %i)",
-					packfile, header.dirlen, header.dirofs);
+		if (!search->pack || search->pack->zip)
+			continue;
+		if (!q_strcasecmp(search->pack->filename, Cmd_Argv(1)) ||
+		    !q_strcasecmp(COM_SkipPath(search->pack->filename), Cmd_Argv(1)))
+		{
+			pak = search->pack;
+			break;
+		}
 	}
-	if (!numpackfiles)
+	if (!pak)
 	{
-		Sys_Printf ("WARNING: %s has no files, ignored\n", packfile);
-		Sys_FileClose (packhandle);
-		return NULL;
+		Con_Printf ("%s is not a pak in the search path\n", Cmd_Argv(1));
+		return;
 	}
-	if (numpackfiles > MAX_FILES_IN_PACK)
-		Sys_Error ("%s has %i files", packfile, numpackfiles);
 
-	if (numpackfiles != PAK0_COUNT)
-		com_modified = true;	// not the original file
+	q_snprintf (name, sizeof(name), "%s/%s", com_gamedir, Cmd_Argv(2));
+	COM_AddExtension (name, ".pak", sizeof(name));
+	for (search = com_searchpaths; search; search = search->next)
+	{
+		if (search->pack && !q_strcasecmp(search->pack->filename, name))
+		{
+			Con_Printf ("%s is in use\n", name);
+			return;
+		}
+	}
 
-	newfiles = (packfile_t *) Z_Malloc(numpackfiles * sizeof(packfile_t));
+	order = (int *) malloc (pak->numfiles * sizeof(int));
+	info = (dpackfile_t *) calloc (pak->numfiles, sizeof(dpackfile_t));
+	if (!order || !info)
+	{
+		free (order);
+		free (info);
+		Con_Printf ("pak_reorder: out of memory\n");
+		return;
+	}
+	touched = 0;
+	for (i = 0; i < pak->numfiles; i++)
+	{
+		order[i] = i;
+		if (pak->files[i].touched)
+			touched++;
+	}
+	com_reorderpack = pak;
+	qsort (order, pak->numfiles, sizeof(int), COM_CompareTouched);
 
-	Sys_FileSeek (packhandle, header.dirofs);
-	Sys_FileRead (packhandle, (void *)info, header.dirlen);
+	COM_CreatePath (name);
+	f = fopen (name, "wb");
+	if (!f)
+	{
+		free (order);
+		free (info);
+		Con_Printf ("ERROR: couldn't open file %s.\n", name);
+		return;
+	}
 
-	// crc the directory to check for modifications
-	CRC_Init (&crc);
-	for (i = 0; i < header.dirlen; i++)
-		CRC_ProcessByte (&crc, ((byte *)info)[i]);
-	if (crc != PAK0_CRC_V106 && crc != PAK0_CRC_V101 && crc != PAK0_CRC_V100)
-		com_modified = true;
+	// the header is rewritten once the directory offset is known
+	memset (&header, 0, sizeof(header));
+	fwrite (&header, 1, sizeof(header), f);
+	ofs = sizeof(header);
+	for (i = 0; i < pak->numfiles; i++)
+	{
+		pf = &pak->files[order[i]];
+		if (!COM_WritePackEntry (f, pak, pf))
+			break;
+		q_strlcpy (info[i].name, pf->name, sizeof(info[i].name));
+		info[i].filepos = LittleLong (ofs);
+		info[i].filelen = LittleLong (pf->filelen);
+		ofs += pf->filelen;
+		if (ofs & 3)
+		{
+			fwrite (zeros, 1, 4 - (ofs & 3), f);
+			ofs += 4 - (ofs & 3);
+		}
+	}
 
-	// parse the directory
-	for (i = 0; i < numpackfiles; i++)
+	if (i == pak->numfiles)
+	{
+		header.id[0] = 'P';
+		header.id[1] = 'A';
+		header.id[2] = 'C';
+		header.id[3] = 'K';
+		header.dirofs = LittleLong (ofs);
+		header.dirlen = LittleLong (pak->numfiles * (int) sizeof(dpackfile_t));
+		fwrite (info, sizeof(dpackfile_t), pak->numfiles, f);
+		fseek (f, 0, SEEK_SET);
+		fwrite (&header, 1, sizeof(header), f);
+	}
+	if (ferror (f))
+		i = -1;
+	if (fclose (f) != 0 || i != pak->numfiles)
+	{
+		Con_Printf ("ERROR: couldn't write %s.\n", name);
+		remove (name);
+	}
+	else
 	{
-		q_strlcpy (newfiles[i].name, info[i].name, sizeof(newfiles[i].name));
-		newfiles[i].filepos = LittleLong(info[i].filepos);
-		newfiles[i].filelen = LittleLong(info[i].filelen);
+		Con_Printf ("Wrote %s: %i files, %i in first use order\n", name, pak->numfiles, touched);
+		COM_FlushMissCache ();
 	}
 
-	pack = (pack_t *) Z_Malloc (sizeof (pack_t));
-	q_strlcpy (pack->filename, packfile, sizeof(pack->filename));
-	pack->handle = packhandle;
-	pack->numfiles = numpackfiles;
-	pack->files = newfiles;
+	free (order);
+	free (info);
+}
 
-	//Sys_Printf ("Added packfile %s (%i files)\n", packfile, numpackfiles);
-	return pack;
+/*
+============
+COM_PakTouchReset_f
+============
+*/
+static void COM_PakTouchReset_f (void)
+{
+	searchpath_t	*search;
+	int		i;
+
+	for (search = com_searchpaths; search; search = search->next)
+	{
+		if (!search->pack)
+			continue;
+		for (i = 0; i < search->pack->numfiles; i++)
+			search->pack->files[i].touched = 0;
+	}
+	com_touchcount = 0;
 }
 
 /*
@@ -2021,11 +3754,12 @@ COM_AddGameDirectory -- johnfitz -- modified based on topaz's tutorial
 */
 static void COM_AddGameDirectory (const char *base, const char *dir)
 {
-	int i;
+	int i, numpaks, maxpaks;
 	unsigned int path_id;
 	searchpath_t *search;
-	pack_t *pak, *qspak;
-	char pakfile[MAX_OSPATH];
+	pack_t *pak;
+	packload_t *paks;
+	qboolean found, stop;
 	qboolean been_here = false;
 
 	q_strlcpy (com_gamedir, va("%s/%s", base, dir), sizeof(com_gamedir));
@@ -2044,35 +3778,65 @@ _add_path:
 	com_searchpaths = search;
 
 	// add any pak files in the format pak0.pak pak1.pak, ...
+	// they are opened in order here, their directories are read in
+	// parallel, and then they're added in the order they were found.
+	numpaks = maxpaks = 0;
+	paks = NULL;
 	for (i = 0; ; i++)
 	{
-		q_snprintf (pakfile, sizeof(pakfile), "%s/pak%i.pak", com_gamedir, i);
-		pak = COM_LoadPackFile (pakfile);
-		if (i != 0 || path_id != 1 || fitzmode)
-			qspak = NULL;
-		else {
-			qboolean old = com_modified;
+		if (numpaks + 2 > maxpaks)
+		{
+			maxpaks += 16;
+			paks = (packload_t *) realloc (paks, maxpaks * sizeof(packload_t));
+			if (!paks)
+				Sys_Error ("COM_AddGameDirectory: out of memory");
+		}
+		q_snprintf (paks[numpaks].filename, sizeof(paks[numpaks].filename), "%s/pak%i.pak", com_gamedir, i);
+		found = COM_OpenPackFile (&paks[numpaks]);
+		if (found)
+			numpaks++;
+		if (i == 0 && path_id == 1 && !fitzmode)
+		{
 			if (been_here) base = host_parms->userdir;
-			q_snprintf (pakfile, sizeof(pakfile), "%s/quakespasm.pak", base);
-			qspak = COM_LoadPackFile (pakfile);
-			com_modified = old;
+			q_snprintf (paks[numpaks].filename, sizeof(paks[numpaks].filename), "%s/quakespasm.pak", base);
+			if (COM_OpenPackFile (&paks[numpaks]))
+			{
+				paks[numpaks].qspak = true;
+				numpaks++;
+			}
 		}
-		if (pak) {
-			search = (searchpath_t *) Z_Malloc(sizeof(searchpath_t));
-			search->path_id = path_id;
-			search->pack = pak;
-			search->next = com_searchpaths;
-			com_searchpaths = search;
+		if (!found) break;
+	}
+
+	COM_ReadPackDirectories (paks, numpaks);
+
+	stop = false;
+	for (i = 0; i < numpaks; i++)
+	{
+		if (stop && !paks[i].qspak)
+		{	// an empty pak ends the list, like a missing one
+			Sys_FileClose (paks[i].handle);
+			free (paks[i].files);
+			continue;
 		}
-		if (qspak) {
-			search = (searchpath_t *) Z_Malloc(sizeof(searchpath_t));
-			search->path_id = path_id;
-			search->pack = qspak;
-			search->next = com_searchpaths;
-			com_searchpaths = search;
+		pak = COM_FinishPackFile (&paks[i]);
+		if (!pak)
+		{
+			stop = true;
+			continue;
 		}
-		if (!pak) break;
+		if (paks[i].modified && !paks[i].qspak)
+			com_modified = true;	// not the original file
+		search = (searchpath_t *) Z_Malloc(sizeof(searchpath_t));
+		search->path_id = path_id;
+		search->pack = pak;
+		search->next = com_searchpaths;
+		com_searchpaths = search;
 	}
+	free (paks);
+
+	// and any pk3 archives on top
+	COM_AddZipFiles (path_id);
 
 	if (!been_here && host_parms->userdir != host_parms->basedir)
 	{
@@ -2081,6 +3845,8 @@ _add_path:
 		Sys_mkdir(com_gamedir);
 		goto _add_path;
 	}
+
+	COM_BuildFileIndex ();
 }
 
 //==============================================================================
@@ -2149,10 +3915,15 @@ static void COM_Game_f (void)
 		Host_WriteConfiguration ();
 
 		//Kill the extra game if it is loaded
+		COM_PrefetchStop ();
+		COM_FreeFileIndex ();
+		com_missavoided = 0;
 		while (com_searchpaths != com_base_searchpaths)
 		{
 			if (com_searchpaths->pack)
 			{
+				if (com_searchpaths->pack->mapped)
+					Sys_FileUnmap (com_searchpaths->pack->mapped, com_searchpaths->pack->mapsize);
 				Sys_FileClose (com_searchpaths->pack->handle);
 				Z_Free (com_searchpaths->pack->files);
 				Z_Free (com_searchpaths->pack);
@@ -2196,6 +3967,7 @@ static void COM_Game_f (void)
 					(host_parms->userdir != host_parms->basedir)?
 						   host_parms->userdir : com_basedir,
 					GAMENAME);
+			COM_BuildFileIndex ();
 		}
 
 		//clear out and reload appropriate data
@@ -2233,6 +4005,13 @@ void COM_InitFilesystem (void) //johnfitz -- modified based on topaz's tutorial
 	Cvar_RegisterVariable (&cmdline);
 	Cmd_AddCommand ("path", COM_Path_f);
 	Cmd_AddCommand ("game", COM_Game_f); //johnfitz
+	Cvar_RegisterVariable (&fs_prefetch);
+	Cvar_RegisterVariable (&fs_readahead);
+	Cmd_AddCommand ("fs_rescan", COM_Rescan_f);
+	Cmd_AddCommand ("fs_trace", COM_Trace_f);
+	Cmd_AddCommand ("fs_tracetop", COM_TraceTop_f);
+	Cmd_AddCommand ("pak_reorder", COM_PakReorder_f);
+	Cmd_AddCommand ("pak_touchreset", COM_PakTouchReset_f);
 
 	i = COM_CheckParm ("-basedir");
 	if (i && i < com_argc-1)
@@ -2245,6 +4024,8 @@ void COM_InitFilesystem (void) //johnfitz -- modified based on topaz's tutorial
 	if ((com_basedir[j-1] == '\\') || (com_basedir[j-1] == '/'))
 		com_basedir[j-1] = 0;
 
+	com_nopakmap = (COM_CheckParm ("-nopakmap") != 0);
+
 	// start up with GAMENAME by default (id1)
 	COM_AddGameDirectory (com_basedir, GAMENAME);
 
@@ -2291,18 +4072,285 @@ void COM_InitFilesystem (void) //johnfitz -- modified based on topaz's tutorial
 	COM_CheckRegistered ();
 }
 
+/*
+=================
+COM_ShutdownFilesystem
+=================
+*/
+void COM_ShutdownFilesystem (void)
+{
+	COM_PrefetchStop ();
+	COM_StopTrace ();
+}
+
 
 /* The following FS_*() stdio replacements are necessary if one is
  * to perform non-sequential reads on files reopened on pak files
  * because we need the bookkeeping about file start/end positions.
  * Allocating and filling in the fshandle_t structure is the users'
- * responsibility when the file is initially opened. */
+ * responsibility when the file is initially opened, or FS_fopen()
+ * does it for them.
+ *
+ * Handles from FS_fopen() also get a read-ahead buffer of fs_readahead
+ * KB, since the codecs do lots of small reads and seeks.  The buffer is
+ * indexed by file offset, so it stays valid when a codec moves start
+ * around, and seeks only move pos: the file is read again when pos
+ * leaves the buffer. */
+
+#ifdef USE_ZLIB
+/* a deflated zip entry is inflated on the fly.  seeking forward skips
+ * data, seeking backward restarts from the beginning of the entry. */
+typedef struct
+{
+	z_stream	strm;
+	long		datastart;	/* compressed data offset in the archive */
+	long		datalen;	/* compressed size */
+	long		inpos;		/* compressed bytes fed to strm so far */
+	long		outpos;		/* uncompressed offset strm is at */
+	qboolean	error;
+	byte		in[16384];
+} fszip_t;
+
+static void FS_ZipRestart (fshandle_t *fh)
+{
+	fszip_t *z = (fszip_t *) fh->zip;
+
+	inflateReset (&z->strm);
+	z->strm.avail_in = 0;
+	z->inpos = 0;
+	z->outpos = 0;
+	fseek (fh->file, z->datastart, SEEK_SET);
+}
+
+static long FS_ZipRead (fshandle_t *fh, void *ptr, long len)
+{
+	fszip_t *z = (fszip_t *) fh->zip;
+	long n;
+	int ret;
+
+	z->strm.next_out = (Bytef *) ptr;
+	z->strm.avail_out = len;
+	while (z->strm.avail_out)
+	{
+		if (!z->strm.avail_in)
+		{	/* inflate may still hold output when the input is used up */
+			n = q_min((long)sizeof(z->in), z->datalen - z->inpos);
+			if (n > 0)
+				n = (long) fread (z->in, 1, n, fh->file);
+			if (n > 0)
+			{
+				z->inpos += n;
+				z->strm.next_in = z->in;
+				z->strm.avail_in = n;
+			}
+		}
+		ret = inflate (&z->strm, Z_NO_FLUSH);
+		if (ret == Z_STREAM_END || ret == Z_BUF_ERROR)	/* done, or no progress possible */
+			break;
+		if (ret != Z_OK)
+		{
+			z->error = true;
+			break;
+		}
+	}
+	n = len - z->strm.avail_out;
+	z->outpos += n;
+	return n;
+}
+
+static int FS_ZipSeek (fshandle_t *fh, long offset)
+{
+	fszip_t *z = (fszip_t *) fh->zip;
+	byte skip[4096];
+
+	if (offset < z->outpos)
+		FS_ZipRestart (fh);
+	while (z->outpos < offset)
+	{
+		if (FS_ZipRead (fh, skip, q_min((long)sizeof(skip), offset - z->outpos)) <= 0)
+			return -1;
+	}
+	return 0;
+}
+#endif	/* USE_ZLIB */
+
+/* handles whose FILE position doesn't follow pos */
+#ifdef USE_ZLIB
+#define FS_LAZYSEEK(fh)	((fh)->buf || (fh)->zip)
+#else
+#define FS_LAZYSEEK(fh)	((fh)->buf != NULL)
+#endif
+
+/* reads from file offset ofs into ptr, for buffered and zip handles */
+static long FS_ReadAt (fshandle_t *fh, long ofs, void *ptr, long len)
+{
+	long n;
+
+#ifdef USE_ZLIB
+	if (fh->zip)
+	{
+		if (FS_ZipSeek (fh, ofs) < 0)
+			return 0;
+		return FS_ZipRead (fh, ptr, len);
+	}
+#endif
+	if (ofs != fh->filepos)
+	{
+		if (fseek (fh->file, ofs, SEEK_SET) < 0)
+		{
+			fh->filepos = -1;
+			return 0;
+		}
+	}
+	n = (long) fread (ptr, 1, len, fh->file);
+	fh->filepos = ofs + n;
+	return n;
+}
+
+static long FS_ReadBuffered (fshandle_t *fh, byte *ptr, long len)
+{
+	long done, ofs, n;
+
+	for (done = 0; done < len; done += n)
+	{
+		ofs = fh->start + fh->pos + done;
+		if (ofs >= fh->bufofs && ofs < fh->bufofs + fh->buflen)
+		{
+			n = q_min(len - done, fh->bufofs + fh->buflen - ofs);
+			memcpy (ptr + done, fh->buf + (ofs - fh->bufofs), n);
+			continue;
+		}
+		if (len - done >= fh->bufsize)
+		{	/* no point in going through the buffer */
+			done += FS_ReadAt (fh, ofs, ptr + done, len - done);
+			break;
+		}
+		n = q_min(fh->bufsize, fh->start + fh->length - ofs);
+		fh->bufofs = ofs;
+		fh->buflen = FS_ReadAt (fh, ofs, fh->buf, n);
+		if (fh->buflen <= 0)
+		{
+			fh->buflen = 0;
+			break;
+		}
+		n = 0;
+	}
+	return done;
+}
+
+static void FS_InitBuffer (fshandle_t *fh)
+{
+	fh->bufsize = (long) fs_readahead.value * 1024;
+	if (fh->bufsize <= 0)
+		return;
+	fh->buf = (byte *) malloc (fh->bufsize);
+	if (!fh->buf)
+		fh->bufsize = 0;
+	fh->bufofs = fh->buflen = 0;
+	fh->filepos = ftell (fh->file);
+}
+
+static long FS_OpenHandle(const char *filename, fshandle_t *fh, unsigned int *path_id)
+{
+	FILE *f;
+	long length;
+#ifdef USE_ZLIB
+	char netpath[MAX_OSPATH];
+#endif
+
+	memset (fh, 0, sizeof(fshandle_t));
+
+#ifdef USE_ZLIB
+	/* one lookup, then the file is opened here: deflated entries are
+	   inflated as they're read rather than to a temporary file */
+	length = COM_FindFile (filename, NULL, NULL, path_id);
+	if (length == -1)
+		return -1;
+	if (file_from_pak && com_foundfile->deflatedlen)
+	{
+		fszip_t *z;
+
+		f = fopen (com_foundpack->filename, "rb");
+		if (!f)
+			return -1;
+		z = (fszip_t *) Z_Malloc (sizeof(fszip_t));
+		if (inflateInit2 (&z->strm, -MAX_WBITS) != Z_OK)
+		{
+			Z_Free (z);
+			fclose (f);
+			return -1;
+		}
+		z->datastart = com_foundfile->filepos;
+		z->datalen = com_foundfile->deflatedlen;
+		fseek (f, z->datastart, SEEK_SET);
+		fh->file = f;
+		fh->zip = z;
+		fh->pak = true;
+		fh->length = com_foundfile->filelen;
+		FS_InitBuffer (fh);
+		return fh->length;
+	}
+	if (file_from_pak)
+	{
+		f = fopen (com_foundpack->filename, "rb");
+		if (f)
+			fseek (f, com_foundfile->filepos, SEEK_SET);
+	}
+	else
+	{
+		q_snprintf (netpath, sizeof(netpath), "%s/%s", com_founddir->filename, filename);
+		f = fopen (netpath, "rb");
+		length = com_filesize = (f == NULL) ? -1 : COM_filelength (f);
+	}
+#else
+	length = COM_FindFile (filename, NULL, &f, path_id);
+#endif
+	if (length == -1 || !f)
+		return -1;
+	fh->file = f;
+	fh->pak = file_from_pak;
+	fh->start = ftell (f);
+	fh->length = length;
+	FS_InitBuffer (fh);
+	return length;
+}
+
+static void FS_TraceOpen (fshandle_t *fh, const char *filename, long length, double start)
+{
+	tracestream_t *ts;
+
+	if (length == -1) {
+		COM_TraceFile (filename, "", com_traceloader, "stream", -1, 0, Sys_PreciseTime() - start);
+		return;
+	}
+	ts = (tracestream_t *) malloc (sizeof(tracestream_t));
+	if (!ts)
+		return;
+	q_strlcpy (ts->path, filename, sizeof(ts->path));
+	q_strlcpy (ts->source, COM_TraceSource(length), sizeof(ts->source));
+	ts->loader = com_traceloader;
+	ts->bytes = 0;
+	ts->time = Sys_PreciseTime() - start;
+	fh->trace = ts;
+}
+
+long FS_fopen(const char *filename, fshandle_t *fh, unsigned int *path_id)
+{
+	double start = com_tracefile ? Sys_PreciseTime() : 0;
+	long length;
+
+	length = FS_OpenHandle (filename, fh, path_id);
+	if (com_tracefile)
+		FS_TraceOpen (fh, filename, length, start);
+	return length;
+}
 
 size_t FS_fread(void *ptr, size_t size, size_t nmemb, fshandle_t *fh)
 {
 	long byte_size;
 	long bytes_read;
 	size_t nmemb_read;
+	double start = 0;
 
 	if (!fh) {
 		errno = EBADF;
@@ -2320,8 +4368,23 @@ size_t FS_fread(void *ptr, size_t size, size_t nmemb, fshandle_t *fh)
 	byte_size = nmemb * size;
 	if (byte_size > fh->length - fh->pos)	/* just read to end */
 		byte_size = fh->length - fh->pos;
-	bytes_read = fread(ptr, 1, byte_size, fh->file);
+	if (fh->trace)
+		start = Sys_PreciseTime();
+	if (byte_size <= 0)
+		bytes_read = 0;
+	else if (fh->buf)
+		bytes_read = FS_ReadBuffered(fh, (byte *) ptr, byte_size);
+#ifdef USE_ZLIB
+	else if (fh->zip)
+		bytes_read = FS_ReadAt(fh, fh->start + fh->pos, ptr, byte_size);
+#endif
+	else
+		bytes_read = fread(ptr, 1, byte_size, fh->file);
 	fh->pos += bytes_read;
+	if (fh->trace) {
+		((tracestream_t *)fh->trace)->bytes += bytes_read;
+		((tracestream_t *)fh->trace)->time += Sys_PreciseTime() - start;
+	}
 
 	/* fread() must return the number of elements read,
 	 * not the total number of bytes. */
@@ -2370,6 +4433,11 @@ int FS_fseek(fshandle_t *fh, long offset, int whence)
 	if (offset > fh->length)	/* just seek to end */
 		offset = fh->length;
 
+	if (FS_LAZYSEEK(fh))
+	{	/* done by the next FS_fread */
+		fh->pos = offset;
+		return 0;
+	}
 	ret = fseek(fh->file, fh->start + offset, SEEK_SET);
 	if (ret < 0)
 		return ret;
@@ -2384,6 +4452,22 @@ int FS_fclose(fshandle_t *fh)
 		errno = EBADF;
 		return -1;
 	}
+#ifdef USE_ZLIB
+	if (fh->zip) {
+		inflateEnd(&((fszip_t *)fh->zip)->strm);
+		Z_Free(fh->zip);
+		fh->zip = NULL;
+	}
+#endif
+	free(fh->buf);
+	fh->buf = NULL;
+	if (fh->trace) {
+		tracestream_t *ts = (tracestream_t *) fh->trace;
+		if (com_tracefile)
+			COM_TraceFile (ts->path, ts->source, ts->loader, "stream", fh->length, ts->bytes, ts->time);
+		free(ts);
+		fh->trace = NULL;
+	}
 	return fclose(fh->file);
 }
 
@@ -2400,8 +4484,10 @@ void FS_rewind(fshandle_t *fh)
 {
 	if (!fh) return;
 	clearerr(fh->file);
-	fseek(fh->file, fh->start, SEEK_SET);
 	fh->pos = 0;
+	if (FS_LAZYSEEK(fh))
+		return;
+	fseek(fh->file, fh->start, SEEK_SET);
 }
 
 int FS_feof(fshandle_t *fh)
@@ -2421,6 +4507,10 @@ int FS_ferror(fshandle_t *fh)
 		errno = EBADF;
 		return -1;
 	}
+#ifdef USE_ZLIB
+	if (fh->zip && ((fszip_t *)fh->zip)->error)
+		return -1;
+#endif
 	return ferror(fh->file);
 }
 
@@ -2432,6 +4522,17 @@ int FS_fgetc(fshandle_t *fh)
 	}
 	if (fh->pos >= fh->length)
 		return EOF;
+	if (FS_LAZYSEEK(fh)) {
+		long ofs = fh->start + fh->pos;
+		byte c;
+		if (ofs >= fh->bufofs && ofs < fh->bufofs + fh->buflen) {
+			fh->pos += 1;
+			return fh->buf[ofs - fh->bufofs];
+		}
+		if (FS_fread(&c, 1, 1, fh) != 1)
+			return EOF;
+		return c;
+	}
 	fh->pos += 1;
 	return fgetc(fh->file);
 }
@@ -2446,6 +4547,18 @@ char *FS_fgets(char *s, int size, fshandle_t *fh)
 	if (size > (fh->length - fh->pos) + 1)
 		size = (fh->length - fh->pos) + 1;
 
+	if (FS_LAZYSEEK(fh)) {
+		int i, c;
+		for (i = 0; i < size - 1; ) {
+			if ((c = FS_fgetc(fh)) == EOF)
+				break;
+			s[i++] = c;
+			if (c == '\n')
+				break;
+		}
+		s[i] = '\0';
+		return (i > 0) ? s : NULL;
+	}
 	ret = fgets(s, size, fh->file);
 	fh->pos = ftell(fh->file) - fh->start;
 
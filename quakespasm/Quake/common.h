@@ -175,6 +175,7 @@ int COM_CheckParm (const char *parm);
 void COM_Init (void);
 void COM_InitArgv (int argc, char **argv);
 void COM_InitFilesystem (void);
+void COM_ShutdownFilesystem (void);
 
 const char *COM_SkipPath (const char *pathname);
 void COM_StripExtension (const char *in, char *out, size_t outsize);
@@ -187,6 +188,8 @@ const char *COM_FileGetExtension (const char *in); /* doesn't return NULL */
 void COM_ExtractExtension (const char *in, char *out, size_t outsize);
 void COM_CreatePath (char *path);
 
+unsigned int COM_HashString (const char *str);
+
 char *va (const char *format, ...) FUNC_PRINTF(1,2);
 // does a varargs printf into a temp buffer
 
@@ -197,7 +200,10 @@ char *va (const char *format, ...) FUNC_PRINTF(1,2);
 typedef struct
 {
 	char	name[MAX_QPATH];
-	int		filepos, filelen;
+	int		filepos, filelen;	// zip: filepos is -1 until the local header is read
+	int		deflatedlen;	// zip: compressed size of deflated entries, else 0
+	int		zipheader;	// zip: offset of the local header
+	int		touched;	// order of first use, 0 if not used yet
 } packfile_t;
 
 typedef struct pack_s
@@ -206,6 +212,9 @@ typedef struct pack_s
 	int		handle;
 	int		numfiles;
 	packfile_t	*files;
+	byte	*mapped;	// whole pak mapped read-only, or NULL
+	int		mapsize;
+	qboolean	zip;	// pk3/zip archive instead of an id pak
 } pack_t;
 
 typedef struct searchpath_s
@@ -232,6 +241,10 @@ void COM_WriteFile (const char *filename, const void *data, int len);
 int COM_OpenFile (const char *filename, int *handle, unsigned int *path_id);
 int COM_FOpenFile (const char *filename, FILE **file, unsigned int *path_id);
 qboolean COM_FileExists (const char *filename, unsigned int *path_id);
+void COM_FlushMissCache (void);	// after creating files outside COM_WriteFile
+void COM_Prefetch (const char *filename);	// start reading it in the background
+void COM_PrefetchClear (void);	// drop unused prefetched files
+void COM_TraceLoader (const char *loader);	// fs_trace tag for the next calls, NULL clears it
 void COM_CloseFile (int h);
 
 // these procedures open a file using COM_FindFile and loads it into a proper
@@ -254,6 +267,12 @@ void COM_LoadCacheFile (const char *path, struct cache_user_s *cu,
 byte *COM_LoadMallocFile (const char *path, unsigned int *path_id);
 	// allocates the buffer on the system mem (malloc).
 
+// Returns a read-only view of the file and sets len, or NULL if not found.
+// Points straight into the pak if it is memory mapped, valid until the game
+// directory changes, otherwise the file is loaded on the temp hunk.  The data
+// must never be written to and isn't guaranteed to be '\0'-terminated.
+const byte *COM_MapFile (const char *path, int *len, unsigned int *path_id);
+
 // Opens the given path directly, ignoring search paths.
 // Returns NULL on failure, or else a '\0'-terminated malloc'ed buffer.
 // Loads in "t" mode so CRLF to LF translation is performed on Windows.
@@ -285,8 +304,19 @@ typedef struct _fshandle_t
 	long start;	/* file or data start position */
 	long length;	/* file or data size */
 	long pos;	/* current position relative to start */
+	void *zip;	/* inflate state of a deflated zip entry, start is
+			 * then relative to the uncompressed data. */
+	byte *buf;	/* read-ahead buffer, only set up by FS_fopen() */
+	long bufsize;
+	long bufofs;	/* file offset of buf[0], like start */
+	long buflen;	/* valid bytes in buf */
+	long filepos;	/* where the FILE is, for buffered handles */
+	void *trace;	/* fs_trace bookkeeping, FS_fopen() handles only */
 } fshandle_t;
 
+/* Opens the file in the quake filesystem and fills in fh, the one way
+ * to read deflated zip entries.  Returns the length or -1 if not found. */
+long FS_fopen(const char *filename, fshandle_t *fh, unsigned int *path_id);
 size_t FS_fread(void *ptr, size_t size, size_t nmemb, fshandle_t *fh);
 int FS_fseek(fshandle_t *fh, long offset, int whence);
 long FS_ftell(fshandle_t *fh);
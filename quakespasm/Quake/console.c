@@ -31,6 +31,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include <unistd.h>
 #endif
 #include "quakedef.h"
+#include "q_ctype.h"
 
 int 		con_linewidth;
 
@@ -457,17 +458,92 @@ static void Con_Print (const char *txt)
 static char	logfilename[MAX_OSPATH];	// current logfile name
 static int	log_fd = -1;			// log file descriptor
 
+// the log is written by a thread of its own, which Con_DebugLog feeds
+// through a ring buffer.  head is only moved by Con_DebugLog, tail only by
+// the writer, so neither needs a lock.  head == tail means it's empty.
+#define	LOG_BUFSIZE	(1<<20)		// must be a power of two
+#define	LOG_SLEEP	10		// msecs the writer idles for when there's nothing to do
+
+static char		*log_buf;
+static volatile int	log_head, log_tail, log_quit;
+static void		*log_thread;
+
+/*
+================
+LOG_WriterThread
+================
+*/
+static int LOG_WriterThread (void *unused)
+{
+	int	head, tail, quit;
+
+	tail = log_tail;
+	for (;;)
+	{
+	// check quit first: once it's set, the head we read after it is final
+		quit = Sys_AtomicLoad (&log_quit);
+		head = Sys_AtomicLoad (&log_head);
+		if (head == tail)
+		{
+			if (quit)
+				break;
+			Sys_Sleep (LOG_SLEEP);
+			continue;
+		}
+
+	// write everything that's there in one go, or two when it wraps
+		if (head < tail)
+		{
+			write (log_fd, log_buf + tail, LOG_BUFSIZE - tail);
+			tail = 0;
+		}
+		write (log_fd, log_buf + tail, head - tail);
+		tail = head;
+		Sys_AtomicStore (&log_tail, tail);
+	}
+
+	return 0;
+}
+
 /*
 ================
 Con_DebugLog
+
+Only ever called from the main thread.  Waits for the writer if the
+buffer is full, so nothing gets lost.
 ================
 */
 void Con_DebugLog(const char *msg)
 {
+	int	len, head, room;
+
 	if (log_fd == -1)
 		return;
 
-	write(log_fd, msg, strlen(msg));
+	len = strlen (msg);
+	if (!log_thread)
+	{
+		write (log_fd, msg, len);
+		return;
+	}
+
+	head = log_head;
+	while (len > 0)
+	{
+		room = (Sys_AtomicLoad (&log_tail) - head - 1) & (LOG_BUFSIZE - 1);
+		if (!room)
+		{
+			Sys_Sleep (1);
+			continue;
+		}
+		room = q_min (room, LOG_BUFSIZE - head);
+		room = q_min (room, len);
+		memcpy (log_buf + head, msg, room);
+		msg += room;
+		len -= room;
+		head = (head + room) & (LOG_BUFSIZE - 1);
+		Sys_AtomicStore (&log_head, head);
+	}
 }
 
 
@@ -706,120 +782,163 @@ void Con_LogCenterPrint (const char *str)
 //johnfitz -- tab completion stuff
 //unique defs
 char key_tabpartial[MAXCMDLINE];
-typedef struct tab_s
-{
-	const char	*name;
-	const char	*type;
-	struct tab_s	*next;
-	struct tab_s	*prev;
-} tab_t;
-tab_t	*tablist;
+
+tabindex_t	con_tabnames;
 
 //defs from elsewhere
 extern qboolean	keydown[256];
-typedef struct cmd_function_s
-{
-	struct cmd_function_s	*next;
-	const char		*name;
-	xcommand_t		function;
-} cmd_function_t;
-extern	cmd_function_t	*cmd_functions;
-#define	MAX_ALIAS_NAME	32
-typedef struct cmdalias_s
-{
-	struct cmdalias_s	*next;
-	char	name[MAX_ALIAS_NAME];
-	char	*value;
-} cmdalias_t;
-extern	cmdalias_t	*cmd_alias;
 
 /*
 ============
-AddToTabList -- johnfitz
+TabIndex_Bound
 
-tablist is a doubly-linked loop, alphabetized by name
+Binary search for the first name that doesn't sort before the first len
+chars of partial, or with upper set, the first one that sorts after them
 ============
 */
-
-// bash_partial is the string that can be expanded,
-// aka Linux Bash shell. -- S.A.
-static char	bash_partial[80];
-static qboolean	bash_singlematch;
-
-void AddToTabList (const char *name, const char *type)
+static int TabIndex_Bound (const tabindex_t *index, const char *partial, size_t len, qboolean upper)
 {
-	tab_t	*t,*insert;
-	char	*i_bash;
-	const char *i_name;
+	int	lo, hi, mid, cmp;
 
-	if (!*bash_partial)
+	lo = 0;
+	hi = index->numnames;
+	while (lo < hi)
 	{
-		strncpy (bash_partial, name, 79);
-		bash_partial[79] = '\0';
+		mid = (lo + hi) / 2;
+		cmp = q_strncasecmp (index->names[mid].name, partial, len);
+		if (cmp < 0 || (upper && !cmp))
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
-	else
+
+	return lo;
+}
+
+/*
+============
+TabIndex_Add
+
+Returns false if the name is already there with the same type.
+File names (NULL type) only count as duplicates when the case matches too.
+============
+*/
+qboolean TabIndex_Add (tabindex_t *index, const char *name, const char *type)
+{
+	tabname_t	*t;
+	int		pos, i;
+
+	pos = TabIndex_Bound (index, name, strlen(name) + 1, true);
+	for (i = pos - 1; i >= 0 && !q_strcasecmp (index->names[i].name, name); i--)
 	{
-		bash_singlematch = 0;
-		// find max common between bash_partial and name
-		i_bash = bash_partial;
-		i_name = name;
-		while (*i_bash && (*i_bash == *i_name))
+		if (!type)
 		{
-			i_bash++;
-			i_name++;
+			if (!index->names[i].type && !strcmp (index->names[i].name, name))
+				return false;
 		}
-		*i_bash = 0;
+		else if (index->names[i].type && !strcmp (index->names[i].type, type))
+			return false;
 	}
 
-	t = (tab_t *) Hunk_Alloc(sizeof(tab_t));
+	if (index->numnames == index->maxnames)
+	{
+		index->maxnames = q_max (index->maxnames * 2, 256);
+		index->names = (tabname_t *) realloc (index->names, index->maxnames * sizeof(tabname_t));
+		if (!index->names)
+			Sys_Error ("TabIndex_Add: failed on %i names", index->maxnames);
+	}
+
+	t = index->names + pos;
+	memmove (t + 1, t, (index->numnames - pos) * sizeof(tabname_t));
 	t->name = name;
 	t->type = type;
+	index->numnames++;
+	return true;
+}
 
-	if (!tablist) //create list
-	{
-		tablist = t;
-		t->next = t;
-		t->prev = t;
-	}
-	else if (strcmp(name, tablist->name) < 0) //insert at front
-	{
-		t->next = tablist;
-		t->prev = tablist->prev;
-		t->next->prev = t;
-		t->prev->next = t;
-		tablist = t;
-	}
-	else //insert later
+/*
+============
+TabIndex_Remove -- name must be the pointer that was added
+============
+*/
+void TabIndex_Remove (tabindex_t *index, const char *name)
+{
+	int	pos;
+
+	for (pos = TabIndex_Bound (index, name, strlen(name) + 1, false); pos < index->numnames; pos++)
 	{
-		insert = tablist;
-		do
+		if (index->names[pos].name == name)
 		{
-			if (strcmp(name, insert->name) < 0)
-				break;
-			insert = insert->next;
-		} while (insert != tablist);
+			index->numnames--;
+			memmove (index->names + pos, index->names + pos + 1, (index->numnames - pos) * sizeof(tabname_t));
+			return;
+		}
+	}
+}
+
+/*
+============
+TabIndex_Clear
+============
+*/
+void TabIndex_Clear (tabindex_t *index)
+{
+	index->numnames = 0;
+}
+
+/*
+============
+TabIndex_Find
+
+Returns the number of names that start with partial, and where they begin
+============
+*/
+int TabIndex_Find (const tabindex_t *index, const char *partial, int *first)
+{
+	size_t	len;
+
+	len = strlen (partial);
+	*first = TabIndex_Bound (index, partial, len, false);
+	return TabIndex_Bound (index, partial, len, true) - *first;
+}
 
-		t->next = insert;
-		t->prev = insert->prev;
-		t->next->prev = t;
-		t->prev->next = t;
+/*
+============
+Con_CommonPrefix
+
+Cuts s down to what it has in common with name.  The names that match are
+sorted, so what the first and last have in common is shared by them all.
+============
+*/
+static void Con_CommonPrefix (char *s, const char *name)
+{
+	while (*s && q_tolower(*s) == q_tolower(*name))
+	{
+		s++;
+		name++;
 	}
+	*s = 0;
 }
 
+// bash_partial is the string that can be expanded,
+// aka Linux Bash shell. -- S.A.
+static char	bash_partial[80];
+static qboolean	bash_singlematch;
+
 typedef struct arg_completion_type_s
 {
 	const char		*command;
-	filelist_item_t	**filelist;
+	tabindex_t		*filelist;
 } arg_completion_type_t;
 
 static const arg_completion_type_t arg_completion_types[] =
 {
-	{ "map ", &extralevels },
-	{ "changelevel ", &extralevels },
-	{ "game ", &modlist },
-	{ "record ", &demolist },
-	{ "playdemo ", &demolist },
-	{ "timedemo ", &demolist }
+	{ "map ", &extralevels_index },
+	{ "changelevel ", &extralevels_index },
+	{ "game ", &modlist_index },
+	{ "record ", &demolist_index },
+	{ "playdemo ", &demolist_index },
+	{ "timedemo ", &demolist_index }
 };
 
 static const int num_arg_completion_types =
@@ -830,89 +949,30 @@ static const int num_arg_completion_types =
 FindCompletion -- stevenaaus
 ============
 */
-const char *FindCompletion (const char *partial, filelist_item_t *filelist, int *nummatches_out)
+const char *FindCompletion (const char *partial, const tabindex_t *filelist, int *nummatches_out)
 {
 	static char matched[32];
-	char *i_matched, *i_name;
-	filelist_item_t	*file;
-	int   init, match, plen;
-
-	memset(matched, 0, sizeof(matched));
-	plen = strlen(partial);
-	match = 0;
-
-	for (file = filelist, init = 0; file; file = file->next)
-	{
-		if (!strncmp(file->name, partial, plen))
-		{
-			if (init == 0)
-			{
-				init = 1;
-				strncpy (matched, file->name, sizeof(matched)-1);
-				matched[sizeof(matched)-1] = '\0';
-			}
-			else
-			{ // find max common
-				i_matched = matched;
-				i_name = file->name;
-				while (*i_matched && (*i_matched == *i_name))
-				{
-					i_matched++;
-					i_name++;
-				}
-				*i_matched = 0;
-			}
-			match++;
-		}
-	}
+	int	first, match, i;
 
+	matched[0] = 0;
+	match = TabIndex_Find (filelist, partial, &first);
 	*nummatches_out = match;
+	if (!match)
+		return matched;
+
+	q_strlcpy (matched, filelist->names[first].name, sizeof(matched));
 
 	if (match > 1)
 	{
-		for (file = filelist; file; file = file->next)
-		{
-			if (!strncmp(file->name, partial, plen))
-				Con_SafePrintf ("   %s\n", file->name);
-		}
+		Con_CommonPrefix (matched, filelist->names[first + match - 1].name);
+		for (i = first; i < first + match; i++)
+			Con_SafePrintf ("   %s\n", filelist->names[i].name);
 		Con_SafePrintf ("\n");
 	}
 
 	return matched;
 }
 
-/*
-============
-BuildTabList -- johnfitz
-============
-*/
-void BuildTabList (const char *partial)
-{
-	cmdalias_t		*alias;
-	cvar_t			*cvar;
-	cmd_function_t		*cmd;
-	int		len;
-
-	tablist = NULL;
-	len = strlen(partial);
-
-	bash_partial[0] = 0;
-	bash_singlematch = 1;
-
-	cvar = Cvar_FindVarAfter ("", CVAR_NONE);
-	for ( ; cvar ; cvar=cvar->next)
-		if (!Q_strncmp (partial, cvar->name, len))
-			AddToTabList (cvar->name, "cvar");
-
-	for (cmd=cmd_functions ; cmd ; cmd=cmd->next)
-		if (!Q_strncmp (partial,cmd->name, len))
-			AddToTabList (cmd->name, "command");
-
-	for (alias=cmd_alias ; alias ; alias=alias->next)
-		if (!Q_strncmp (partial, alias->name, len))
-			AddToTabList (alias->name, "alias");
-}
-
 /*
 ============
 Con_TabComplete -- johnfitz
@@ -923,8 +983,9 @@ void Con_TabComplete (void)
 	char	partial[MAXCMDLINE];
 	const char	*match;
 	static char	*c;
-	tab_t		*t;
-	int		mark, i, j;
+	tabname_t	*names;
+	int		i, j, first, count;
+	qboolean	firsttime;
 
 // if editline is empty, return
 	if (key_lines[edit_line][1] == 0)
@@ -955,7 +1016,7 @@ void Con_TabComplete (void)
 		if (!strncmp (key_lines[edit_line] + 1, command_name, strlen(command_name)))
 		{
 			int nummatches = 0;
-			const char *matched_map = FindCompletion(partial, *arg_completion.filelist, &nummatches);
+			const char *matched_map = FindCompletion(partial, arg_completion.filelist, &nummatches);
 			if (!*matched_map)
 				return;
 			q_strlcpy (partial, matched_map, MAXCMDLINE);
@@ -986,53 +1047,40 @@ void Con_TabComplete (void)
 		partial[i-1] = 0;
 
 // find a match
-	mark = Hunk_LowMark();
-	if (!key_tabpartial[0]) //first time through
-	{
+	firsttime = !key_tabpartial[0];
+	if (firsttime)
 		q_strlcpy (key_tabpartial, partial, MAXCMDLINE);
-		BuildTabList (key_tabpartial);
-
-		if (!tablist)
-			return;
+	count = TabIndex_Find (&con_tabnames, key_tabpartial, &first);
+	if (!count)
+		return;
+	names = con_tabnames.names + first;
+	bash_singlematch = (count == 1);
 
+	if (firsttime)
+	{
 		// print list if length > 1
-		if (tablist->next != tablist)
+		if (count > 1)
 		{
-			t = tablist;
 			Con_SafePrintf("\n");
-			do
-			{
-				Con_SafePrintf("   %s (%s)\n", t->name, t->type);
-				t = t->next;
-			} while (t != tablist);
+			for (i = 0; i < count; i++)
+				Con_SafePrintf("   %s (%s)\n", names[i].name, names[i].type);
 			Con_SafePrintf("\n");
 		}
 
-	//	match = tablist->name;
 	// First time, just show maximum matching chars -- S.A.
+		q_strlcpy (bash_partial, names[0].name, sizeof(bash_partial));
+		Con_CommonPrefix (bash_partial, names[count - 1].name);
 		match = bash_partial;
 	}
 	else
 	{
-		BuildTabList (key_tabpartial);
-
-		if (!tablist)
-			return;
-
-		//find current match -- can't save a pointer because the list will be rebuilt each time
-		t = tablist;
-		match = keydown[K_SHIFT] ? t->prev->name : t->name;
-		do
-		{
-			if (!Q_strcmp(t->name, partial))
-			{
-				match = keydown[K_SHIFT] ? t->prev->name : t->next->name;
-				break;
-			}
-			t = t->next;
-		} while (t != tablist);
+		//find current match, and step to the next or previous one
+		i = TabIndex_Bound (&con_tabnames, partial, strlen(partial) + 1, false) - first;
+		if (i >= count || q_strcasecmp (names[i].name, partial))
+			match = keydown[K_SHIFT] ? names[count - 1].name : names[0].name;
+		else
+			match = keydown[K_SHIFT] ? names[(i + count - 1) % count].name : names[(i + 1) % count].name;
 	}
-	Hunk_FreeToLowMark(mark); //it's okay to free it here because match is a pointer to persistent data
 
 // insert new match into edit line
 	q_strlcpy (partial, match, MAXCMDLINE); //first copy match string
@@ -1096,8 +1144,7 @@ void Con_DrawNotify (void)
 
 		clearnotify = 0;
 
-		for (x = 0; x < con_linewidth; x++)
-			Draw_Character ((x+1)<<3, v, text[x]);
+		Draw_BatchLine (i % con_totallines, 8, v, text, con_linewidth);
 
 		v += 8;
 
@@ -1126,16 +1173,18 @@ void Con_DrawNotify (void)
 
 		while (*text)
 		{
-			Draw_Character (x<<3, v, *text);
+			Draw_BatchCharacter (x<<3, v, *text);
 			x++;
 			text++;
 		}
 
-		Draw_Character (x<<3, v, 10 + ((int)(realtime*con_cursorspeed)&1));
+		Draw_BatchCharacter (x<<3, v, 10 + ((int)(realtime*con_cursorspeed)&1));
 		v += 8;
 
 		scr_tileclear_updates = 0; //johnfitz
 	}
+
+	Draw_FlushBatch ();
 }
 
 /*
@@ -1162,7 +1211,8 @@ void Con_DrawInput (void)
 
 // draw input string
 	for (i = 0; key_lines[edit_line][i+ofs] && i < con_linewidth; i++)
-		Draw_Character ((i+1)<<3, vid.conheight - 16, key_lines[edit_line][i+ofs]);
+		Draw_BatchCharacter ((i+1)<<3, vid.conheight - 16, key_lines[edit_line][i+ofs]);
+	Draw_FlushBatch ();	// before the cursor goes on top
 
 // johnfitz -- new cursor handling
 	if (!((int)((realtime-key_blinktime)*con_cursorspeed) & 1))
@@ -1208,8 +1258,7 @@ void Con_DrawConsole (int lines, qboolean drawinput)
 			j = 0;
 		text = con_text + (j % con_totallines)*con_linewidth;
 
-		for (x = 0; x < con_linewidth; x++)
-			Draw_Character ( (x + 1)<<3, y, text[x]);
+		Draw_BatchLine (j % con_totallines, 8, y, text, con_linewidth);
 	}
 
 // draw scrollback arrows
@@ -1217,7 +1266,7 @@ void Con_DrawConsole (int lines, qboolean drawinput)
 	{
 		y += 8; // blank line
 		for (x = 0; x < con_linewidth; x += 4)
-			Draw_Character ((x + 1)<<3, y, '^');
+			Draw_BatchCharacter ((x + 1)<<3, y, '^');
 		y += 8;
 	}
 
@@ -1229,7 +1278,8 @@ void Con_DrawConsole (int lines, qboolean drawinput)
 	y += 8;
 	q_snprintf (ver, sizeof(ver), "QuakeSpasm " QUAKESPASM_VER_STRING);
 	for (x = 0; x < (int)strlen(ver); x++)
-		Draw_Character ((con_linewidth - strlen(ver) + x + 2)<<3, y, ver[x] /*+ 128*/);
+		Draw_BatchCharacter ((con_linewidth - strlen(ver) + x + 2)<<3, y, ver[x] /*+ 128*/);
+	Draw_FlushBatch ();
 }
 
 
@@ -1293,15 +1343,43 @@ void LOG_Init (quakeparms_t *parms)
 		return;
 	}
 
+	log_buf = (char *) malloc (LOG_BUFSIZE);
+	if (log_buf)
+	{
+		log_head = log_tail = log_quit = 0;
+		log_thread = Sys_CreateThread (LOG_WriterThread, NULL);
+		if (!log_thread)	// write it synchronously then
+		{
+			free (log_buf);
+			log_buf = NULL;
+		}
+	}
+
 	con_debuglog = true;
 	Con_DebugLog (va("LOG started on: %s \n", session));
 
 }
 
+/*
+================
+LOG_Close
+
+Writes out whatever is still queued before closing the file.  Safe to
+call more than once.
+================
+*/
 void LOG_Close (void)
 {
 	if (log_fd == -1)
 		return;
+	if (log_thread)
+	{
+		Sys_AtomicStore (&log_quit, 1);
+		Sys_WaitThread (log_thread);
+		log_thread = NULL;
+		free (log_buf);
+		log_buf = NULL;
+	}
 	close (log_fd);
 	log_fd = -1;
 }
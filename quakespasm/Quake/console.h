@@ -55,6 +55,29 @@ void Con_Show (void);
 void Con_Hide (void);
 
 const char *Con_Quakebar (int len);
+
+//
+// tab completion
+//
+typedef struct
+{
+	const char	*name;		// points at the owner's copy
+	const char	*type;		// "command", "cvar", "alias", or NULL for files
+} tabname_t;
+
+typedef struct
+{
+	tabname_t	*names;		// sorted with q_strcasecmp, for binary searches
+	int		numnames, maxnames;
+} tabindex_t;
+
+extern tabindex_t	con_tabnames;	// commands, cvars and aliases
+
+qboolean TabIndex_Add (tabindex_t *index, const char *name, const char *type);
+void TabIndex_Remove (tabindex_t *index, const char *name);
+void TabIndex_Clear (tabindex_t *index);
+int TabIndex_Find (const tabindex_t *index, const char *partial, int *first);
+
 void Con_TabComplete (void);
 void Con_LogCenterPrint (const char *str);
 
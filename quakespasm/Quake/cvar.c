@@ -247,15 +247,10 @@ Cvar_FindVar
 */
 cvar_t *Cvar_FindVar (const char *var_name)
 {
-	cvar_t	*var;
+	cmdname_t	*node;
 
-	for (var = cvar_vars ; var ; var = var->next)
-	{
-		if (!Q_strcmp(var_name, var->name))
-			return var;
-	}
-
-	return NULL;
+	node = Cmd_FindName (var_name, cmdname_cvar);
+	return node ? (cvar_t *) node->data : NULL;
 }
 
 cvar_t *Cvar_FindVarAfter (const char *prev_name, unsigned int with_flags)
@@ -571,6 +566,8 @@ void Cvar_RegisterVariable (cvar_t *variable)
 	}
 	//johnfitz
 	variable->flags |= CVAR_REGISTERED;
+	Cmd_AddName ((cmdname_t *) Z_Malloc (sizeof(cmdname_t)), variable->name, cmdname_cvar, variable);
+	TabIndex_Add (&con_tabnames, variable->name, "cvar");
 
 // copy the value off, because future sets will Z_Free it
 	q_strlcpy (value, variable->string, sizeof(value));
@@ -610,12 +607,8 @@ Cvar_Command
 Handles variable inspection and changing from the console
 ============
 */
-qboolean	Cvar_Command (void)
+qboolean	Cvar_Command (cvar_t *v)
 {
-	cvar_t			*v;
-
-// check variables
-	v = Cvar_FindVar (Cmd_Argv(0));
 	if (!v)
 		return false;
 
@@ -626,7 +619,7 @@ qboolean	Cvar_Command (void)
 		return true;
 	}
 
-	Cvar_Set (v->name, Cmd_Argv(1));
+	Cvar_SetQuick (v, Cmd_Argv(1));
 	return true;
 }
 
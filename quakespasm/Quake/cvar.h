@@ -117,10 +117,10 @@ float	Cvar_VariableValue (const char *var_name);
 const char *Cvar_VariableString (const char *var_name);
 // returns an empty string if not defined
 
-qboolean Cvar_Command (void);
-// called by Cmd_ExecuteString when Cmd_Argv(0) doesn't match a known
-// command.  Returns true if the command was a variable reference that
-// was handled. (print or change)
+qboolean Cvar_Command (cvar_t *v);
+// called by Cmd_ExecuteString with the variable its name lookup found
+// for Cmd_Argv(0).  Returns true if the command was a variable reference
+// that was handled. (print or change)
 
 void	Cvar_WriteVariables (FILE *f);
 // Writes lines containing "set variable value" for all variables
@@ -38,6 +38,9 @@ void Draw_TileClear (int x, int y, int w, int h);
 void Draw_Fill (int x, int y, int w, int h, int c, float alpha); //johnfitz -- added alpha
 void Draw_FadeScreen (void);
 void Draw_String (int x, int y, const char *str);
+void Draw_BatchCharacter (int x, int y, int num);
+void Draw_BatchLine (int line, int x, int y, const char *text, int len);	// cached until the text changes
+void Draw_FlushBatch (void);
 qpic_t *Draw_PicFromWad (const char *name);
 qpic_t *Draw_CachePic (const char *path);
 void Draw_NewGame (void);
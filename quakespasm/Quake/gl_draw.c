@@ -497,6 +497,174 @@ void Draw_String (int x, int y, const char *str)
 	glEnd ();
 }
 
+//==============================================================================
+//
+//  CHARACTER BATCHES
+//
+//  Text that's drawn a lot, like the console, goes into one vertex array
+//  that Draw_FlushBatch draws with a single call.  Whole lines are cached
+//  with their vertices worked out, and only rebuilt when their text changes.
+//
+//==============================================================================
+
+#define	MAX_CACHEDLINES	512	// more than the rows on any console
+
+typedef struct
+{
+	char	*text;
+	int	len;
+	float	*verts;		// relative to the start of the line
+	int	numchars, maxchars;
+} cachedline_t;
+
+static cachedline_t	draw_lines[MAX_CACHEDLINES];
+
+static float	*draw_batch;
+static int	draw_batchchars, draw_batchmax;
+
+/*
+================
+Draw_CharacterVerts -- x, y, s, t for each corner of one character, in the
+order GL_QUADS wants them
+================
+*/
+static float *Draw_CharacterVerts (float *v, int x, int y, int num)
+{
+	float	s, t;
+
+	s = (num & 15) * 0.0625;
+	t = (num >> 4) * 0.0625;
+
+	v[0] = x;	v[1] = y;	v[2] = s;		v[3] = t;
+	v[4] = x + 8;	v[5] = y;	v[6] = s + 0.0625;	v[7] = t;
+	v[8] = x + 8;	v[9] = y + 8;	v[10] = s + 0.0625;	v[11] = t + 0.0625;
+	v[12] = x;	v[13] = y + 8;	v[14] = s;		v[15] = t + 0.0625;
+	return v + 16;
+}
+
+/*
+================
+Draw_BatchSpace -- returns room for numchars more characters
+================
+*/
+static float *Draw_BatchSpace (int numchars)
+{
+	if (draw_batchchars + numchars > draw_batchmax)
+	{
+		draw_batchmax = q_max (draw_batchmax * 2, draw_batchchars + numchars);
+		draw_batchmax = q_max (draw_batchmax, 4096);
+		draw_batch = (float *) realloc (draw_batch, draw_batchmax * 16 * sizeof(float));
+		if (!draw_batch)
+			Sys_Error ("Draw_BatchSpace: failed on %i characters", draw_batchmax);
+	}
+
+	return draw_batch + draw_batchchars * 16;
+}
+
+/*
+================
+Draw_BatchCharacter
+================
+*/
+void Draw_BatchCharacter (int x, int y, int num)
+{
+	if (y <= -8)
+		return;			// totally off screen
+
+	num &= 255;
+
+	if (num == 32)
+		return; //don't waste verts on spaces
+
+	Draw_CharacterVerts (Draw_BatchSpace (1), x, y, num);
+	draw_batchchars++;
+}
+
+/*
+================
+Draw_BatchLine
+
+Adds len characters of text, which is line number line of whatever it
+comes from.  The line number only picks the cache slot.
+================
+*/
+void Draw_BatchLine (int line, int x, int y, const char *text, int len)
+{
+	cachedline_t	*cl;
+	float		*v, *out;
+	int		i;
+
+	if (y <= -8)
+		return;			// totally off screen
+
+	cl = &draw_lines[line & (MAX_CACHEDLINES - 1)];
+	if (cl->len != len || memcmp (cl->text, text, len))
+	{
+		if (cl->len != len)
+		{
+			free (cl->text);
+			cl->text = (char *) malloc (len);
+			if (!cl->text)
+				Sys_Error ("Draw_BatchLine: failed on %i characters", len);
+			cl->len = len;
+		}
+		memcpy (cl->text, text, len);
+
+		for (i = cl->numchars = 0; i < len; i++)
+		{
+			if ((byte)text[i] != 32)
+				cl->numchars++;
+		}
+		if (cl->numchars > cl->maxchars)
+		{
+			cl->maxchars = cl->numchars;
+			free (cl->verts);
+			cl->verts = (float *) malloc (cl->maxchars * 16 * sizeof(float));
+			if (!cl->verts)
+				Sys_Error ("Draw_BatchLine: failed on %i characters", len);
+		}
+		for (i = 0, v = cl->verts; i < len; i++)
+		{
+			if ((byte)text[i] != 32)
+				v = Draw_CharacterVerts (v, i << 3, 0, (byte)text[i]);
+		}
+	}
+
+	out = Draw_BatchSpace (cl->numchars);
+	for (i = 0, v = cl->verts; i < cl->numchars * 4; i++, v += 4, out += 4)
+	{
+		out[0] = v[0] + x;
+		out[1] = v[1] + y;
+		out[2] = v[2];
+		out[3] = v[3];
+	}
+	draw_batchchars += cl->numchars;
+}
+
+/*
+================
+Draw_FlushBatch
+================
+*/
+void Draw_FlushBatch (void)
+{
+	if (!draw_batchchars)
+		return;
+
+	GL_Bind (char_texture);
+	GL_BindBuffer (GL_ARRAY_BUFFER, 0);	// the arrays are in client memory
+
+	glEnableClientState (GL_VERTEX_ARRAY);
+	glEnableClientState (GL_TEXTURE_COORD_ARRAY);
+	glVertexPointer (2, GL_FLOAT, 4 * sizeof(float), draw_batch);
+	glTexCoordPointer (2, GL_FLOAT, 4 * sizeof(float), draw_batch + 2);
+	glDrawArrays (GL_QUADS, 0, draw_batchchars * 4);
+	glDisableClientState (GL_TEXTURE_COORD_ARRAY);
+	glDisableClientState (GL_VERTEX_ARRAY);
+
+	draw_batchchars = 0;
+}
+
 /*
 =============
 Draw_Pic -- johnfitz -- modified
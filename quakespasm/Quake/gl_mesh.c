@@ -549,6 +549,9 @@ static void GLMesh_LoadVertexBuffer (qmodel_t *m, const aliashdr_t *hdr)
 	GL_GenBuffersFunc (1, &m->meshvbo);
 	GL_BindBufferFunc (GL_ARRAY_BUFFER, m->meshvbo);
 	GL_BufferDataFunc (GL_ARRAY_BUFFER, totalvbosize, vbodata, GL_STATIC_DRAW);
+	gl_vbo_bytes -= m->vbobytes;
+	m->vbobytes = totalvbosize + hdr->numindexes * sizeof (unsigned short);
+	gl_vbo_bytes += m->vbobytes;
 
 	free (vbodata);
 
@@ -608,6 +611,9 @@ void GLMesh_DeleteVertexBuffers (void)
 
 		GL_DeleteBuffersFunc (1, &m->meshindexesvbo);
 		m->meshindexesvbo = 0;
+
+		gl_vbo_bytes -= m->vbobytes;
+		m->vbobytes = 0;
 	}
 	
 	GL_ClearBufferBindings ();
@@ -290,9 +290,11 @@ void Mod_TouchModel (const char *name)
 
 	if (!mod->needload)
 	{
-		if (mod->type == mod_alias)
-			Cache_Check (&mod->cache);
+		if (mod->type == mod_alias && !Cache_Check (&mod->cache))
+			COM_Prefetch (name);
 	}
+	else if (name[0] != '*')
+		COM_Prefetch (name);
 }
 
 /*
@@ -304,9 +306,8 @@ Loads a model into the cache
 */
 qmodel_t *Mod_LoadModel (qmodel_t *mod, qboolean crash)
 {
-	byte	*buf;
-	byte	stackbuf[1024];		// avoid dirtying the cache heap
-	int	mod_type;
+	const byte	*buf;
+	int	mod_type, len;
 
 	if (!mod->needload)
 	{
@@ -329,8 +330,11 @@ qmodel_t *Mod_LoadModel (qmodel_t *mod, qboolean crash)
 
 //
 // load the file
+// the loaders only read from buf, so it may point straight into a mapped pak
 //
-	buf = COM_LoadStackFile (mod->name, stackbuf, sizeof(stackbuf), & mod->path_id);
+	COM_TraceLoader ("model");
+	buf = COM_MapFile (mod->name, &len, & mod->path_id);
+	COM_TraceLoader (NULL);
 	if (!buf)
 	{
 		if (crash)
@@ -356,15 +360,15 @@ qmodel_t *Mod_LoadModel (qmodel_t *mod, qboolean crash)
 	switch (mod_type)
 	{
 	case IDPOLYHEADER:
-		Mod_LoadAliasModel (mod, buf);
+		Mod_LoadAliasModel (mod, (void *)buf);
 		break;
 
 	case IDSPRITEHEADER:
-		Mod_LoadSpriteModel (mod, buf);
+		Mod_LoadSpriteModel (mod, (void *)buf);
 		break;
 
 	default:
-		Mod_LoadBrushModel (mod, buf);
+		Mod_LoadBrushModel (mod, (void *)buf);
 		break;
 	}
 
@@ -427,7 +431,7 @@ void Mod_LoadTextures (lump_t *l)
 	dmiptexlump_t	*m;
 //johnfitz -- more variables
 	char		texturename[64];
-	int			nummiptex;
+	int			nummiptex, dataofs, mtwidth, mtheight;
 	src_offset_t		offset;
 	int			mark, fwidth, fheight;
 	char		filename[MAX_OSPATH], filename2[MAX_OSPATH], mapname[MAX_OSPATH];
@@ -445,8 +449,7 @@ void Mod_LoadTextures (lump_t *l)
 	else
 	{
 		m = (dmiptexlump_t *)(mod_base + l->fileofs);
-		m->nummiptex = LittleLong (m->nummiptex);
-		nummiptex = m->nummiptex;
+		nummiptex = LittleLong (m->nummiptex);
 	}
 	//johnfitz
 
@@ -455,26 +458,25 @@ void Mod_LoadTextures (lump_t *l)
 
 	for (i=0 ; i<nummiptex ; i++)
 	{
-		m->dataofs[i] = LittleLong(m->dataofs[i]);
-		if (m->dataofs[i] == -1)
+		// mod_base may be a read-only mapping, so swap into locals / tx
+		dataofs = LittleLong (m->dataofs[i]);
+		if (dataofs == -1)
 			continue;
-		mt = (miptex_t *)((byte *)m + m->dataofs[i]);
-		mt->width = LittleLong (mt->width);
-		mt->height = LittleLong (mt->height);
-		for (j=0 ; j<MIPLEVELS ; j++)
-			mt->offsets[j] = LittleLong (mt->offsets[j]);
+		mt = (miptex_t *)((byte *)m + dataofs);
+		mtwidth = LittleLong (mt->width);
+		mtheight = LittleLong (mt->height);
 
-		if ( (mt->width & 15) || (mt->height & 15) )
+		if ( (mtwidth & 15) || (mtheight & 15) )
 			Sys_Error ("Texture %s is not 16 aligned", mt->name);
-		pixels = mt->width*mt->height/64*85;
+		pixels = mtwidth*mtheight/64*85;
 		tx = (texture_t *) Hunk_AllocName (sizeof(texture_t) +pixels, loadname );
 		loadmodel->textures[i] = tx;
 
 		memcpy (tx->name, mt->name, sizeof(tx->name));
-		tx->width = mt->width;
-		tx->height = mt->height;
+		tx->width = mtwidth;
+		tx->height = mtheight;
 		for (j=0 ; j<MIPLEVELS ; j++)
-			tx->offsets[j] = mt->offsets[j] + sizeof(texture_t) - sizeof(miptex_t);
+			tx->offsets[j] = LittleLong (mt->offsets[j]) + sizeof(texture_t) - sizeof(miptex_t);
 		// the pixels immediately follow the structures
 
 		// ericw -- check for pixels extending past the end of the lump.
@@ -715,7 +717,9 @@ void Mod_LoadLighting (lump_t *l)
 	COM_StripExtension(litfilename, litfilename, sizeof(litfilename));
 	q_strlcat(litfilename, ".lit", sizeof(litfilename));
 	mark = Hunk_LowMark();
+	COM_TraceLoader ("lit");
 	data = (byte*) COM_LoadHunkFile (litfilename, &path_id);
+	COM_TraceLoader (NULL);
 	if (data)
 	{
 		// use lit file only from the same gamedir as the map
@@ -802,7 +806,9 @@ void Mod_LoadEntities (lump_t *l)
 	q_strlcat(entfilename, ".ent", sizeof(entfilename));
 	Con_DPrintf2("trying to load %s\n", entfilename);
 	mark = Hunk_LowMark();
+	COM_TraceLoader ("entities");
 	ents = (char *) COM_LoadHunkFile (entfilename, &path_id);
+	COM_TraceLoader (NULL);
 	if (ents)
 	{
 		// use ent file only from the same gamedir as the map
@@ -1991,7 +1997,7 @@ void Mod_LoadBrushModel (qmodel_t *mod, void *buffer)
 {
 	int			i, j;
 	int			bsp2;
-	dheader_t	*header;
+	dheader_t	*header, swapped;
 	dmodel_t 	*bm;
 	float		radius; //johnfitz
 
@@ -2017,11 +2023,12 @@ void Mod_LoadBrushModel (qmodel_t *mod, void *buffer)
 		break;
 	}
 
-// swap all the lumps
+// swap all the lumps, into a copy since buffer may be a read-only mapping
 	mod_base = (byte *)header;
 
 	for (i = 0; i < (int) sizeof(dheader_t) / 4; i++)
-		((int *)header)[i] = LittleLong ( ((int *)header)[i]);
+		((int *)&swapped)[i] = LittleLong ( ((int *)header)[i]);
+	header = &swapped;
 
 // load into heap
 
@@ -2294,15 +2301,13 @@ void *Mod_LoadAllSkins (int numskins, daliasskintype_t *pskintype)
 {
 	int			i, j, k, size, groupskins;
 	char			name[MAX_QPATH];
-	byte			*skin, *texels;
+	byte			*data, *texels;
 	daliasskingroup_t	*pinskingroup;
 	daliasskininterval_t	*pinskinintervals;
 	char			fbr_mask_name[MAX_QPATH]; //johnfitz -- added for fullbright support
 	src_offset_t		offset; //johnfitz
 	unsigned int		texflags = TEXPREF_PAD;
 
-	skin = (byte *)(pskintype + 1);
-
 	if (numskins < 1 || numskins > MAX_SKINS)
 		Sys_Error ("Mod_LoadAliasModel: Invalid # of skins: %d\n", numskins);
 
@@ -2315,28 +2320,36 @@ void *Mod_LoadAllSkins (int numskins, daliasskintype_t *pskintype)
 	{
 		if (pskintype->type == ALIAS_SKIN_SINGLE)
 		{
-			Mod_FloodFillSkin( skin, pheader->skinwidth, pheader->skinheight );
-
 			// save 8 bit texels for the player model to remap
 			texels = (byte *) Hunk_AllocName(size, loadname);
 			pheader->texels[i] = texels - (byte *)pheader;
 			memcpy (texels, (byte *)(pskintype + 1), size);
 
+			// the model file may be a read-only mapping, so the flood
+			// fill (which only ever touched the first skin) works on
+			// the texels copy, and that copy is what gets uploaded
+			data = (byte *)(pskintype + 1);
+			if (i == 0)
+			{
+				Mod_FloodFillSkin( texels, pheader->skinwidth, pheader->skinheight );
+				data = texels;
+			}
+
 			//johnfitz -- rewritten
 			q_snprintf (name, sizeof(name), "%s:frame%i", loadmodel->name, i);
 			offset = (src_offset_t)(pskintype+1) - (src_offset_t)mod_base;
-			if (Mod_CheckFullbrights ((byte *)(pskintype+1), size))
+			if (Mod_CheckFullbrights (data, size))
 			{
 				pheader->gltextures[i][0] = TexMgr_LoadImage (loadmodel, name, pheader->skinwidth, pheader->skinheight,
-					SRC_INDEXED, (byte *)(pskintype+1), loadmodel->name, offset, texflags | TEXPREF_NOBRIGHT);
+					SRC_INDEXED, data, loadmodel->name, offset, texflags | TEXPREF_NOBRIGHT);
 				q_snprintf (fbr_mask_name, sizeof(fbr_mask_name), "%s:frame%i_glow", loadmodel->name, i);
 				pheader->fbtextures[i][0] = TexMgr_LoadImage (loadmodel, fbr_mask_name, pheader->skinwidth, pheader->skinheight,
-					SRC_INDEXED, (byte *)(pskintype+1), loadmodel->name, offset, texflags | TEXPREF_FULLBRIGHT);
+					SRC_INDEXED, data, loadmodel->name, offset, texflags | TEXPREF_FULLBRIGHT);
 			}
 			else
 			{
 				pheader->gltextures[i][0] = TexMgr_LoadImage (loadmodel, name, pheader->skinwidth, pheader->skinheight,
-					SRC_INDEXED, (byte *)(pskintype+1), loadmodel->name, offset, texflags);
+					SRC_INDEXED, data, loadmodel->name, offset, texflags);
 				pheader->fbtextures[i][0] = NULL;
 			}
 
@@ -2358,28 +2371,33 @@ void *Mod_LoadAllSkins (int numskins, daliasskintype_t *pskintype)
 
 			for (j=0 ; j<groupskins ; j++)
 			{
-				Mod_FloodFillSkin( skin, pheader->skinwidth, pheader->skinheight );
+				data = (byte *)(pskintype);
 				if (j == 0) {
 					texels = (byte *) Hunk_AllocName(size, loadname);
 					pheader->texels[i] = texels - (byte *)pheader;
 					memcpy (texels, (byte *)(pskintype), size);
+					if (i == 0)
+					{
+						Mod_FloodFillSkin( texels, pheader->skinwidth, pheader->skinheight );
+						data = texels;
+					}
 				}
 
 				//johnfitz -- rewritten
 				q_snprintf (name, sizeof(name), "%s:frame%i_%i", loadmodel->name, i,j);
 				offset = (src_offset_t)(pskintype) - (src_offset_t)mod_base; //johnfitz
-				if (Mod_CheckFullbrights ((byte *)(pskintype), size))
+				if (Mod_CheckFullbrights (data, size))
 				{
 					pheader->gltextures[i][j&3] = TexMgr_LoadImage (loadmodel, name, pheader->skinwidth, pheader->skinheight,
-						SRC_INDEXED, (byte *)(pskintype), loadmodel->name, offset, texflags | TEXPREF_NOBRIGHT);
+						SRC_INDEXED, data, loadmodel->name, offset, texflags | TEXPREF_NOBRIGHT);
 					q_snprintf (fbr_mask_name, sizeof(fbr_mask_name), "%s:frame%i_%i_glow", loadmodel->name, i,j);
 					pheader->fbtextures[i][j&3] = TexMgr_LoadImage (loadmodel, fbr_mask_name, pheader->skinwidth, pheader->skinheight,
-						SRC_INDEXED, (byte *)(pskintype), loadmodel->name, offset, texflags | TEXPREF_FULLBRIGHT);
+						SRC_INDEXED, data, loadmodel->name, offset, texflags | TEXPREF_FULLBRIGHT);
 				}
 				else
 				{
 					pheader->gltextures[i][j&3] = TexMgr_LoadImage (loadmodel, name, pheader->skinwidth, pheader->skinheight,
-						SRC_INDEXED, (byte *)(pskintype), loadmodel->name, offset, texflags);
+						SRC_INDEXED, data, loadmodel->name, offset, texflags);
 					pheader->fbtextures[i][j&3] = NULL;
 				}
 				//johnfitz
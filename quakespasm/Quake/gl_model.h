@@ -493,6 +493,7 @@ typedef struct qmodel_s
 	int			vboindexofs;    // offset in vbo of the hdr->numindexes unsigned shorts
 	int			vboxyzofs;      // offset in vbo of hdr->numposes*hdr->numverts_vbo meshxyz_t
 	int			vbostofs;       // offset in vbo of hdr->numverts_vbo meshst_t
+	int			vbobytes;	// size of both buffers, for memstats
 
 //
 // additional model data
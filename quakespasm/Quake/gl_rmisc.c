@@ -167,6 +167,17 @@ float GL_WaterAlphaForSurface (msurface_t *fa)
 }
 
 
+/*
+===============
+R_MemoryStats -- for memstats
+===============
+*/
+static void R_MemoryStats (memstats_t *stats)
+{
+	stats->texture_bytes = TexMgr_TextureBytes (&stats->textures);
+	stats->vbo_bytes = gl_vbo_bytes;
+}
+
 /*
 ===============
 R_Init
@@ -246,6 +257,8 @@ void R_Init (void)
 
 	Sky_Init (); //johnfitz
 	Fog_Init (); //johnfitz
+
+	Memory_SetRendererStats (R_MemoryStats);
 }
 
 /*
@@ -409,6 +422,8 @@ void R_NewMap (void)
 	R_ParseWorldspawn (); //ericw -- wateralpha, lavaalpha, telealpha, slimealpha in worldspawn
 
 	load_subdivide_size = gl_subdivide_size.value; //johnfitz -- is this the right place to set this?
+
+	TexMgr_SaveTextureCache ();
 }
 
 /*
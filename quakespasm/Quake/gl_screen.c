@@ -87,6 +87,7 @@ cvar_t		scr_crosshairscale = {"scr_crosshairscale", "1", CVAR_ARCHIVE};
 cvar_t		scr_showfps = {"scr_showfps", "0", CVAR_NONE};
 cvar_t		scr_clock = {"scr_clock", "0", CVAR_NONE};
 //johnfitz
+cvar_t		scr_memstats = {"scr_memstats", "0", CVAR_NONE};
 
 cvar_t		scr_viewsize = {"viewsize","100", CVAR_ARCHIVE};
 cvar_t		scr_fov = {"fov","90",CVAR_NONE};	// 10 - 170
@@ -408,6 +409,7 @@ void SCR_Init (void)
 	Cvar_RegisterVariable (&scr_showfps);
 	Cvar_RegisterVariable (&scr_clock);
 	//johnfitz
+	Cvar_RegisterVariable (&scr_memstats);
 	Cvar_SetCallback (&scr_fov, SCR_Callback_refdef);
 	Cvar_SetCallback (&scr_fov_adapt, SCR_Callback_refdef);
 	Cvar_SetCallback (&scr_viewsize, SCR_Callback_refdef);
@@ -551,6 +553,53 @@ void SCR_DrawDevStats (void)
 	Draw_String (x, (y++)*8-x, str);
 }
 
+/*
+==============
+SCR_DrawMemStats -- above devstats, in megabytes
+==============
+*/
+void SCR_DrawMemStats (void)
+{
+	memstats_t	st;
+	char	str[40];
+	int		y = 25-9-8; //8=number of lines to print
+	int		x = 0; //margin
+	float	mb = 1.0f / (1024 * 1024);
+
+	if (!scr_memstats.value)
+		return;
+
+	Memory_GetStats (&st);
+
+	GL_SetCanvas (CANVAS_BOTTOMLEFT);
+
+	Draw_Fill (x, y*8, 23*8, 8*8, 0, 0.5); //dark rectangle
+
+	sprintf (str, "memstats |  Curr   Peak");
+	Draw_String (x, (y++)*8-x, str);
+
+	sprintf (str, "---------+-------------");
+	Draw_String (x, (y++)*8-x, str);
+
+	sprintf (str, "Hunk     |%6.1f %6.1f", (st.hunk_low + st.hunk_high) * mb, st.hunk_peak * mb);
+	Draw_String (x, (y++)*8-x, str);
+
+	sprintf (str, "Zone     |%6.2f %6.2f", st.zone_used * mb, st.zone_peak * mb);
+	Draw_String (x, (y++)*8-x, str);
+
+	sprintf (str, "Cache    |%6.1f %6.1f", st.cache_used * mb, st.cache_peak * mb);
+	Draw_String (x, (y++)*8-x, str);
+
+	sprintf (str, "Evictions|%6i %6i", st.cache_frameevictions, st.cache_evictions);
+	Draw_String (x, (y++)*8-x, str);
+
+	sprintf (str, "Textures |%6.1f", st.texture_bytes * mb);
+	Draw_String (x, (y++)*8-x, str);
+
+	sprintf (str, "VBO      |%6.1f", st.vbo_bytes * mb);
+	Draw_String (x, (y++)*8-x, str);
+}
+
 /*
 ==============
 SCR_DrawRam
@@ -1118,6 +1167,7 @@ void SCR_UpdateScreen (void)
 		SCR_CheckDrawCenterString ();
 		Sbar_Draw ();
 		SCR_DrawDevStats (); //johnfitz
+		SCR_DrawMemStats ();
 		SCR_DrawFPS (); //johnfitz
 		SCR_DrawClock (); //johnfitz
 		SCR_DrawConsole ();
@@ -47,6 +47,488 @@ unsigned int d_8to24table_conchars[256];
 unsigned int d_8to24table_shirt[256];
 unsigned int d_8to24table_pants[256];
 
+/*
+================================================================================
+
+	TEXTURE CACHE
+
+	the final mip chains of processed textures are kept on disk in
+	<userdir>/texcache, named by a hash of the source pixels and of every
+	setting that changes the processing, so a texture that was seen before
+	is uploaded without any cpu work.  gl_texturemode and anisotropy only
+	change filter state, so they aren't part of the key.  texcache/index
+	keeps the size and last use of each entry, for evicting the least
+	recently used ones when the cache grows past gl_texcache_size.
+
+================================================================================
+*/
+
+static cvar_t	gl_texcache = {"gl_texcache", "0", CVAR_ARCHIVE};
+static cvar_t	gl_texcache_size = {"gl_texcache_size", "256", CVAR_ARCHIVE}; // megabytes
+
+#define	TEXCACHE_IDENT		(('C'<<24)+('X'<<16)+('T'<<8)+'Q')
+#define	TEXCACHE_VERSION	1
+#define	TEXCACHE_HASHSIZE	1024	// must be a power of two
+#define	TEXCACHE_MINPIXELS	1024	// smaller textures aren't worth a file
+
+typedef struct
+{
+	int		ident, version;
+	unsigned int	key[2];
+	int		format, source_width, source_height;	// to catch hash collisions
+	int		width, height;		// of the first level
+	unsigned int	flags;			// TEXPREF_ALPHA may have been dropped
+	int		numlevels, size;
+} texcachehdr_t;
+
+typedef struct
+{
+	unsigned int	key[2];
+	int		size;
+	int		lastuse;
+	int		next;			// hash chain
+} texcacheentry_t;
+
+static texcacheentry_t	*texcache_entries;
+static int		texcache_numentries, texcache_maxentries;
+static int		texcache_hash[TEXCACHE_HASHSIZE];
+static int		texcache_clock;
+static uint64_t		texcache_bytes;
+static qboolean		texcache_loaded, texcache_dirty;
+static int		texcache_hits, texcache_misses, texcache_stores, texcache_evictions;
+
+// mip chain recorded by TexMgr_LoadImage32 on a cache miss
+static qboolean		texcache_recording;
+static byte		*texcache_rec;
+static int		texcache_reclen, texcache_recsize, texcache_reclevels;
+
+/*
+================
+TexMgr_CacheHash -- 64 bit FNV-1a
+================
+*/
+static uint64_t TexMgr_CacheHash (uint64_t hash, const byte *data, int size)
+{
+	const uint64_t prime = ((uint64_t)1 << 40) + 0x1b3;
+
+	while (size--)
+	{
+		hash ^= *data++;
+		hash *= prime;
+	}
+	return hash;
+}
+
+/*
+================
+TexMgr_CacheKey
+================
+*/
+static void TexMgr_CacheKey (gltexture_t *glt, byte *data, unsigned int key[2])
+{
+	extern cvar_t gl_fullbrights;
+	int		params[10];
+	int		size;
+	uint64_t	hash;
+
+	switch (glt->source_format)
+	{
+	case SRC_RGBA:
+		size = glt->width * glt->height * 4;
+		break;
+	default:
+		size = glt->width * glt->height;
+		break;
+	}
+
+	memset (params, 0, sizeof(params));
+	params[0] = glt->source_format;
+	params[1] = glt->width;
+	params[2] = glt->height;
+	params[3] = glt->flags & ~(TEXPREF_PERSIST | TEXPREF_OVERWRITE);
+	params[4] = (glt->flags & TEXPREF_NOPICMIP) ? 0 : q_max((int)gl_picmip.value, 0);
+	params[5] = (int)gl_max_size.value;
+	params[6] = gl_hardware_maxsize;
+	params[7] = gl_texture_NPOT;
+	params[8] = gl_fullbrights.value ? 1 : 0;
+	params[9] = strstr(glt->name, "shot1sid") ? 1 : 0;	// see TexMgr_LoadImage8
+
+	hash = ((uint64_t)0xcbf29ce4 << 32) | 0x84222325;
+	hash = TexMgr_CacheHash (hash, data, size);
+	hash = TexMgr_CacheHash (hash, (byte *)params, sizeof(params));
+	hash = TexMgr_CacheHash (hash, (byte *)d_8to24table, sizeof(d_8to24table)); // the other palettes derive from it
+
+	key[0] = (unsigned int)(hash >> 32);
+	key[1] = (unsigned int)hash;
+}
+
+/*
+================
+TexMgr_CacheChainSize -- bytes in the mip chain TexMgr_LoadImage32 uploads
+================
+*/
+static int TexMgr_CacheChainSize (int width, int height, unsigned flags, int *numlevels)
+{
+	int size;
+
+	size = width * height * 4;
+	*numlevels = 1;
+	if (flags & TEXPREF_MIPMAP)
+	{
+		while (width > 1 || height > 1)
+		{
+			if (width > 1)
+				width >>= 1;
+			if (height > 1)
+				height >>= 1;
+			size += width * height * 4;
+			(*numlevels)++;
+		}
+	}
+	return size;
+}
+
+/*
+================
+TexMgr_CacheFileName
+================
+*/
+static const char *TexMgr_CacheFileName (const unsigned int key[2])
+{
+	static char name[MAX_OSPATH];
+
+	if (key)
+		q_snprintf (name, sizeof(name), "%s/texcache/%08x%08x.tex", host_parms->userdir, key[0], key[1]);
+	else
+		q_snprintf (name, sizeof(name), "%s/texcache/index", host_parms->userdir);
+	return name;
+}
+
+/*
+================
+TexMgr_CacheFind
+================
+*/
+static texcacheentry_t *TexMgr_CacheFind (const unsigned int key[2])
+{
+	int i;
+
+	for (i = texcache_hash[key[1] & (TEXCACHE_HASHSIZE - 1)]; i != -1; i = texcache_entries[i].next)
+	{
+		if (texcache_entries[i].key[0] == key[0] && texcache_entries[i].key[1] == key[1])
+			return &texcache_entries[i];
+	}
+	return NULL;
+}
+
+/*
+================
+TexMgr_CacheRehash
+================
+*/
+static void TexMgr_CacheRehash (void)
+{
+	int i, bucket;
+
+	for (i = 0; i < TEXCACHE_HASHSIZE; i++)
+		texcache_hash[i] = -1;
+	texcache_bytes = 0;
+	for (i = 0; i < texcache_numentries; i++)
+	{
+		bucket = texcache_entries[i].key[1] & (TEXCACHE_HASHSIZE - 1);
+		texcache_entries[i].next = texcache_hash[bucket];
+		texcache_hash[bucket] = i;
+		texcache_bytes += texcache_entries[i].size;
+	}
+}
+
+/*
+================
+TexMgr_CacheAdd
+================
+*/
+static texcacheentry_t *TexMgr_CacheAdd (const unsigned int key[2], int size)
+{
+	texcacheentry_t *e;
+	int bucket;
+
+	e = TexMgr_CacheFind (key);
+	if (e)
+	{
+		texcache_bytes += size - e->size;
+		e->size = size;
+		return e;
+	}
+
+	if (texcache_numentries == texcache_maxentries)
+	{
+		texcache_maxentries += 1024;
+		texcache_entries = (texcacheentry_t *) Z_Realloc (texcache_entries, texcache_maxentries * sizeof(texcacheentry_t));
+	}
+	e = &texcache_entries[texcache_numentries];
+	e->key[0] = key[0];
+	e->key[1] = key[1];
+	e->size = size;
+	bucket = key[1] & (TEXCACHE_HASHSIZE - 1);
+	e->next = texcache_hash[bucket];
+	texcache_hash[bucket] = texcache_numentries++;
+	texcache_bytes += size;
+	return e;
+}
+
+/*
+================
+TexMgr_CacheLoadIndex -- done the first time the cache is used
+================
+*/
+static void TexMgr_CacheLoadIndex (void)
+{
+	texcacheentry_t	entry;
+	FILE		*f;
+	int		header[3];
+
+	texcache_loaded = true;
+	texcache_numentries = 0;
+	texcache_clock = 0;
+	TexMgr_CacheRehash ();
+
+	Sys_mkdir (va("%s/texcache", host_parms->userdir));
+
+	f = fopen (TexMgr_CacheFileName(NULL), "rb");
+	if (!f)
+		return;
+	if (fread (header, sizeof(header), 1, f) == 1 &&
+	    header[0] == TEXCACHE_IDENT && header[1] == TEXCACHE_VERSION)
+	{
+		texcache_clock = header[2];
+		while (fread (&entry, sizeof(entry), 1, f) == 1)
+		{
+			if (entry.size > 0)
+				TexMgr_CacheAdd (entry.key, entry.size)->lastuse = entry.lastuse;
+		}
+	}
+	fclose (f);
+}
+
+/*
+================
+TexMgr_SaveTextureCache -- writes the index if it changed
+================
+*/
+void TexMgr_SaveTextureCache (void)
+{
+	FILE	*f;
+	int	header[3];
+
+	if (!texcache_loaded || !texcache_dirty)
+		return;
+
+	f = fopen (TexMgr_CacheFileName(NULL), "wb");
+	if (!f)
+	{
+		Con_DPrintf ("Couldn't write %s\n", TexMgr_CacheFileName(NULL));
+		return;
+	}
+	header[0] = TEXCACHE_IDENT;
+	header[1] = TEXCACHE_VERSION;
+	header[2] = texcache_clock;
+	fwrite (header, sizeof(header), 1, f);
+	fwrite (texcache_entries, sizeof(texcacheentry_t), texcache_numentries, f);
+	fclose (f);
+	texcache_dirty = false;
+}
+
+/*
+================
+TexMgr_CacheEvict -- drops least recently used entries until the cache is
+3/4 of gl_texcache_size, so this doesn't happen on every store
+================
+*/
+static int TexMgr_CacheCompareUse (const void *a, const void *b)
+{
+	return ((const texcacheentry_t *)a)->lastuse - ((const texcacheentry_t *)b)->lastuse;
+}
+
+static void TexMgr_CacheEvict (void)
+{
+	uint64_t	budget;
+	int		i, j;
+
+	budget = (uint64_t)(q_max(gl_texcache_size.value, 0) * 1024 * 1024);
+	if (texcache_bytes <= budget)
+		return;
+	budget = budget / 4 * 3;
+
+	qsort (texcache_entries, texcache_numentries, sizeof(texcacheentry_t), TexMgr_CacheCompareUse);
+	for (i = 0; i < texcache_numentries && texcache_bytes > budget; i++)
+	{
+		remove (TexMgr_CacheFileName(texcache_entries[i].key));
+		texcache_bytes -= texcache_entries[i].size;
+		texcache_evictions++;
+	}
+	for (j = 0; i < texcache_numentries; i++, j++)
+		texcache_entries[j] = texcache_entries[i];
+	texcache_numentries = j;
+
+	TexMgr_CacheRehash ();
+	texcache_dirty = true;
+}
+
+/*
+================
+TexMgr_CacheLoad -- uploads the cached mip chain, if there is one
+================
+*/
+static qboolean TexMgr_CacheLoad (gltexture_t *glt, const unsigned int key[2])
+{
+	texcachehdr_t	header;
+	texcacheentry_t	*e;
+	FILE		*f;
+	byte		*data;
+	int		internalformat, level, width, height, size, numlevels;
+
+	f = fopen (TexMgr_CacheFileName(key), "rb");
+	if (!f)
+		return false;
+	if (fread (&header, sizeof(header), 1, f) != 1 ||
+	    header.ident != TEXCACHE_IDENT || header.version != TEXCACHE_VERSION ||
+	    header.key[0] != key[0] || header.key[1] != key[1] ||
+	    header.format != glt->source_format ||
+	    header.source_width != (int)glt->source_width || header.source_height != (int)glt->source_height ||
+	    ((header.flags ^ glt->flags) & ~(TEXPREF_PERSIST | TEXPREF_OVERWRITE | TEXPREF_ALPHA)) ||
+	    (header.flags & ~glt->flags & TEXPREF_ALPHA) ||
+	    header.width < 1 || header.height < 1 ||
+	    header.size != TexMgr_CacheChainSize (header.width, header.height, header.flags, &numlevels) ||
+	    header.numlevels != numlevels)
+	{
+		fclose (f);
+		return false;
+	}
+
+	data = (byte *) Scratch_Alloc (header.size);
+	if (fread (data, 1, header.size, f) != (size_t)header.size)
+	{
+		fclose (f);
+		return false;
+	}
+	fclose (f);
+
+	glt->width = header.width;
+	glt->height = header.height;
+	glt->flags = (glt->flags & ~TEXPREF_ALPHA) | (header.flags & TEXPREF_ALPHA);	// the upload may have dropped it
+
+	GL_Bind (glt);
+	internalformat = (glt->flags & TEXPREF_ALPHA) ? gl_alpha_format : gl_solid_format;
+	width = header.width;
+	height = header.height;
+	for (level = 0; level < header.numlevels; level++)
+	{
+		glTexImage2D (GL_TEXTURE_2D, level, internalformat, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+		data += width * height * 4;
+		if (width > 1)
+			width >>= 1;
+		if (height > 1)
+			height >>= 1;
+	}
+
+	size = (int)sizeof(header) + header.size;
+	e = TexMgr_CacheAdd (key, size);	// could be missing from the index
+	e->lastuse = ++texcache_clock;
+	texcache_dirty = true;
+	return true;
+}
+
+/*
+================
+TexMgr_CacheRecord -- called by TexMgr_LoadImage32 for each level it uploads
+================
+*/
+static void TexMgr_CacheRecord (gltexture_t *glt, int level, int width, int height, unsigned *data)
+{
+	int size = width * height * 4;
+
+	if (level == 0)
+	{
+		texcache_recsize = TexMgr_CacheChainSize (width, height, glt->flags, &texcache_reclevels);
+		texcache_rec = (byte *) Scratch_Alloc (texcache_recsize);
+		texcache_reclen = 0;
+	}
+	if (!texcache_rec)
+		return;
+	if (texcache_reclen + size > texcache_recsize)
+	{
+		texcache_rec = NULL;	// not the chain we expected, don't store it
+		return;
+	}
+	memcpy (texcache_rec + texcache_reclen, data, size);
+	texcache_reclen += size;
+}
+
+/*
+================
+TexMgr_CacheStore -- writes the recorded mip chain
+================
+*/
+static void TexMgr_CacheStore (gltexture_t *glt, const unsigned int key[2])
+{
+	texcachehdr_t	header;
+	texcacheentry_t	*e;
+	FILE		*f;
+
+	if (!texcache_rec || texcache_reclen != texcache_recsize)
+		return;
+
+	header.ident = TEXCACHE_IDENT;
+	header.version = TEXCACHE_VERSION;
+	header.key[0] = key[0];
+	header.key[1] = key[1];
+	header.format = glt->source_format;
+	header.source_width = glt->source_width;
+	header.source_height = glt->source_height;
+	header.width = glt->width;
+	header.height = glt->height;
+	header.flags = glt->flags;
+	header.numlevels = texcache_reclevels;
+	header.size = texcache_recsize;
+
+	f = fopen (TexMgr_CacheFileName(key), "wb");
+	if (!f)
+		return;
+	if (fwrite (&header, sizeof(header), 1, f) != 1 ||
+	    fwrite (texcache_rec, 1, texcache_recsize, f) != (size_t)texcache_recsize)
+	{
+		fclose (f);
+		remove (TexMgr_CacheFileName(key));
+		return;
+	}
+	fclose (f);
+
+	e = TexMgr_CacheAdd (key, (int)sizeof(header) + texcache_recsize);
+	e->lastuse = ++texcache_clock;
+	texcache_dirty = true;
+	texcache_stores++;
+
+	TexMgr_CacheEvict ();
+}
+
+/*
+================
+TexMgr_CacheStats -- for imagelist
+================
+*/
+static void TexMgr_CacheStats (void)
+{
+	int lookups = texcache_hits + texcache_misses;
+
+	if (!texcache_loaded)
+		return;
+	Con_Printf ("texture cache: %i hits, %i misses (%i%% hit rate), %i stored, %i evicted\n",
+		    texcache_hits, texcache_misses, lookups ? texcache_hits * 100 / lookups : 0,
+		    texcache_stores, texcache_evictions);
+	Con_Printf ("texture cache: %i entries, %1.1f of %i megabytes\n", texcache_numentries,
+		    (double)texcache_bytes / 0x100000, (int)gl_texcache_size.value);
+}
+
 /*
 ================================================================================
 
@@ -218,6 +700,31 @@ static void TexMgr_Imagelist_f (void)
 
 	mb = texels * (Cvar_VariableValue("vid_bpp") / 8.0f) / 0x100000;
 	Con_Printf ("%i textures %i pixels %1.1f megabytes\n", numgltextures, (int)texels, mb);
+	TexMgr_CacheStats ();
+}
+
+/*
+===============
+TexMgr_TextureBytes -- video memory used by textures, roughly
+===============
+*/
+int TexMgr_TextureBytes (int *count)
+{
+	gltexture_t	*glt;
+	float		bytes = 0;
+
+	for (glt = active_gltextures; glt; glt = glt->next)
+	{
+		if (glt->source_format == SRC_LIGHTMAP)
+			bytes += glt->width * glt->height * lightmap_bytes;
+		else if (glt->flags & TEXPREF_MIPMAP)
+			bytes += glt->width * glt->height * 4.0f * 4.0f / 3.0f;
+		else
+			bytes += glt->width * glt->height * 4.0f;
+	}
+
+	*count = numgltextures;
+	return (int)bytes;
 }
 
 /*
@@ -464,7 +971,9 @@ void TexMgr_LoadPalette (void)
 	int i, mark;
 	FILE *f;
 
+	COM_TraceLoader ("texture");
 	COM_FOpenFile ("gfx/palette.lmp", &f, NULL);
+	COM_TraceLoader (NULL);
 	if (!f)
 		Sys_Error ("Couldn't load gfx/palette.lmp");
 
@@ -625,6 +1134,8 @@ void TexMgr_Init (void)
 	gl_texturemode.string = glmodes[glmode_idx].name;
 	Cvar_RegisterVariable (&gl_texturemode);
 	Cvar_SetCallback (&gl_texturemode, &TexMgr_TextureMode_f);
+	Cvar_RegisterVariable (&gl_texcache);
+	Cvar_RegisterVariable (&gl_texcache_size);
 	Cmd_AddCommand ("gl_describetexturemodes", &TexMgr_DescribeTextureModes_f);
 	Cmd_AddCommand ("imagelist", &TexMgr_Imagelist_f);
 	Cmd_AddCommand ("imagedump", &TexMgr_Imagedump_f);
@@ -762,7 +1273,7 @@ static unsigned *TexMgr_ResampleTexture (unsigned *in, int inwidth, int inheight
 
 	outwidth = TexMgr_Pad(inwidth);
 	outheight = TexMgr_Pad(inheight);
-	out = (unsigned *) Hunk_Alloc(outwidth*outheight*4);
+	out = (unsigned *) Scratch_Alloc(outwidth*outheight*4);
 
 	xfrac = ((inwidth-1) << 16) / (outwidth-1);
 	yfrac = ((inheight-1) << 16) / (outheight-1);
@@ -944,7 +1455,7 @@ static unsigned *TexMgr_8to32 (byte *in, int pixels, unsigned int *usepal)
 	int i;
 	unsigned *out, *data;
 
-	out = data = (unsigned *) Hunk_Alloc(pixels*4);
+	out = data = (unsigned *) Scratch_Alloc(pixels*4);
 
 	for (i = 0; i < pixels; i++)
 		*out++ = usepal[*in++];
@@ -967,7 +1478,7 @@ static byte *TexMgr_PadImageW (byte *in, int width, int height, byte padbyte)
 
 	outwidth = TexMgr_Pad(width);
 
-	out = data = (byte *) Hunk_Alloc(outwidth*height);
+	out = data = (byte *) Scratch_Alloc(outwidth*height);
 
 	for (i = 0; i < height; i++)
 	{
@@ -996,7 +1507,7 @@ static byte *TexMgr_PadImageH (byte *in, int width, int height, byte padbyte)
 	srcpix = width * height;
 	dstpix = width * TexMgr_Pad(height);
 
-	out = data = (byte *) Hunk_Alloc(dstpix);
+	out = data = (byte *) Scratch_Alloc(dstpix);
 
 	for (i = 0; i < srcpix; i++)
 		*out++ = *in++;
@@ -1046,6 +1557,8 @@ static void TexMgr_LoadImage32 (gltexture_t *glt, unsigned *data)
 	GL_Bind (glt);
 	internalformat = (glt->flags & TEXPREF_ALPHA) ? gl_alpha_format : gl_solid_format;
 	glTexImage2D (GL_TEXTURE_2D, 0, internalformat, glt->width, glt->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+	if (texcache_recording)
+		TexMgr_CacheRecord (glt, 0, glt->width, glt->height, data);
 
 	// upload mipmaps
 	if (glt->flags & TEXPREF_MIPMAP)
@@ -1066,6 +1579,8 @@ static void TexMgr_LoadImage32 (gltexture_t *glt, unsigned *data)
 				mipheight >>= 1;
 			}
 			glTexImage2D (GL_TEXTURE_2D, miplevel, internalformat, mipwidth, mipheight, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+			if (texcache_recording)
+				TexMgr_CacheRecord (glt, miplevel, mipwidth, mipheight, data);
 		}
 	}
 
@@ -1185,6 +1700,65 @@ static void TexMgr_LoadLightmap (gltexture_t *glt, byte *data)
 	TexMgr_SetFilterModes (glt);
 }
 
+/*
+================
+TexMgr_UploadImage -- goes through the texture cache when it's enabled
+
+all the conversion buffers come from the scratch arena
+================
+*/
+static void TexMgr_UploadImage (gltexture_t *glt, byte *data)
+{
+	unsigned int key[2];
+	qboolean cached;
+	int mark;
+
+	cached = gl_texcache.value && glt->source_format != SRC_LIGHTMAP &&
+		 !(glt->flags & TEXPREF_WARPIMAGE) &&
+		 (int)(glt->width * glt->height) >= TEXCACHE_MINPIXELS;
+	if (cached)
+	{
+		if (!texcache_loaded)
+			TexMgr_CacheLoadIndex ();
+		TexMgr_CacheKey (glt, data, key);
+		mark = Scratch_Mark ();
+		if (TexMgr_CacheLoad (glt, key))
+		{
+			Scratch_FreeToMark (mark);
+			texcache_hits++;
+			TexMgr_SetFilterModes (glt);
+			return;
+		}
+		Scratch_FreeToMark (mark);
+		texcache_misses++;
+		texcache_recording = true;
+		texcache_rec = NULL;
+	}
+
+	mark = Scratch_Mark ();
+
+	switch (glt->source_format)
+	{
+	case SRC_INDEXED:
+		TexMgr_LoadImage8 (glt, data);
+		break;
+	case SRC_LIGHTMAP:
+		TexMgr_LoadLightmap (glt, data);
+		break;
+	case SRC_RGBA:
+		TexMgr_LoadImage32 (glt, (unsigned *)data);
+		break;
+	}
+
+	if (cached)
+	{
+		texcache_recording = false;
+		TexMgr_CacheStore (glt, key);
+	}
+
+	Scratch_FreeToMark (mark);
+}
+
 /*
 ================
 TexMgr_LoadImage -- the one entry point for loading all textures
@@ -1195,7 +1769,6 @@ gltexture_t *TexMgr_LoadImage (qmodel_t *owner, const char *name, int width, int
 {
 	unsigned short crc;
 	gltexture_t *glt;
-	int mark;
 
 	if (isDedicated)
 		return NULL;
@@ -1239,22 +1812,7 @@ gltexture_t *TexMgr_LoadImage (qmodel_t *owner, const char *name, int width, int
 	glt->source_crc = crc;
 
 	//upload it
-	mark = Hunk_LowMark();
-
-	switch (glt->source_format)
-	{
-	case SRC_INDEXED:
-		TexMgr_LoadImage8 (glt, data);
-		break;
-	case SRC_LIGHTMAP:
-		TexMgr_LoadLightmap (glt, data);
-		break;
-	case SRC_RGBA:
-		TexMgr_LoadImage32 (glt, (unsigned *)data);
-		break;
-	}
-
-	Hunk_FreeToLowMark(mark);
+	TexMgr_UploadImage (glt, data);
 
 	return glt;
 }
@@ -1276,18 +1834,21 @@ void TexMgr_ReloadImage (gltexture_t *glt, int shirt, int pants)
 {
 	byte	translation[256];
 	byte	*src, *dst, *data = NULL, *translated;
-	int	mark, size, i;
+	int	mark, smark, size, i;
 //
 // get source data
 //
 	mark = Hunk_LowMark ();
+	smark = Scratch_Mark ();
 
 	if (glt->source_file[0] && glt->source_offset)
 	{
 		//lump inside file
 		long size;
 		FILE *f;
+		COM_TraceLoader ("texture");
 		COM_FOpenFile(glt->source_file, &f, NULL);
+		COM_TraceLoader (NULL);
 		if (!f)
 			goto invalid;
 		fseek (f, glt->source_offset, SEEK_CUR);
@@ -1363,7 +1924,7 @@ invalid:
 
 		//translate texture
 		size = glt->width * glt->height;
-		dst = translated = (byte *) Hunk_Alloc (size);
+		dst = translated = (byte *) Scratch_Alloc (size);
 		src = data;
 
 		for (i = 0; i < size; i++)
@@ -1374,19 +1935,9 @@ invalid:
 //
 // upload it
 //
-	switch (glt->source_format)
-	{
-	case SRC_INDEXED:
-		TexMgr_LoadImage8 (glt, data);
-		break;
-	case SRC_LIGHTMAP:
-		TexMgr_LoadLightmap (glt, data);
-		break;
-	case SRC_RGBA:
-		TexMgr_LoadImage32 (glt, (unsigned *)data);
-		break;
-	}
+	TexMgr_UploadImage (glt, data);
 
+	Scratch_FreeToMark (smark);
 	Hunk_FreeToLowMark(mark);
 }
 
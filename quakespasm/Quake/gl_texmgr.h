@@ -78,6 +78,7 @@ extern unsigned int d_8to24table_pants[256];
 // TEXTURE MANAGER
 
 float TexMgr_FrameUsage (void);
+int TexMgr_TextureBytes (int *count);
 gltexture_t *TexMgr_FindTexture (qmodel_t *owner, const char *name);
 gltexture_t *TexMgr_NewTexture (void);
 void TexMgr_FreeTexture (gltexture_t *kill);
@@ -93,6 +94,7 @@ gltexture_t *TexMgr_LoadImage (qmodel_t *owner, const char *name, int width, int
 void TexMgr_ReloadImage (gltexture_t *glt, int shirt, int pants);
 void TexMgr_ReloadImages (void);
 void TexMgr_ReloadNobrightImages (void);
+void TexMgr_SaveTextureCache (void);
 
 int TexMgr_Pad(int s);
 int TexMgr_SafeTextureSize (int s);
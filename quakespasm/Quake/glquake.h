@@ -292,6 +292,7 @@ extern overflowtimes_t dev_overflows; //this stores the last time overflow messa
 
 //johnfitz -- moved here from r_brush.c
 extern int gl_lightmap_format, lightmap_bytes;
+extern int gl_vbo_bytes;	// in all vertex buffers, for memstats
 #define MAX_LIGHTMAPS 512 //johnfitz -- was 64
 extern gltexture_t *lightmap_textures[MAX_LIGHTMAPS]; //johnfitz -- changed to an array
 
@@ -82,6 +82,7 @@ cvar_t	developer = {"developer","0",CVAR_NONE};
 cvar_t	temp1 = {"temp1","0",CVAR_NONE};
 
 cvar_t devstats = {"devstats","0",CVAR_NONE}; //johnfitz -- track developer statistics that vary every frame
+cvar_t memstats_dump = {"memstats_dump","0",CVAR_NONE}; // write memory stats to memstats.json at the end of every map
 
 devstats_t dev_stats, dev_peakstats;
 overflowtimes_t dev_overflows; //this stores the last time overflow messages were displayed, not the last time overflows occured
@@ -262,6 +263,7 @@ void Host_InitLocal (void)
 	Cvar_RegisterVariable (&max_edicts); //johnfitz
 	Cvar_SetCallback (&max_edicts, Max_Edicts_f);
 	Cvar_RegisterVariable (&devstats); //johnfitz
+	Cvar_RegisterVariable (&memstats_dump);
 
 	Cvar_RegisterVariable (&sys_ticrate);
 	Cvar_RegisterVariable (&sys_throttle);
@@ -310,6 +312,7 @@ void Host_WriteConfiguration (void)
 			Con_Printf ("Couldn't write config.cfg.\n");
 			return;
 		}
+		COM_FlushMissCache ();
 
 		//VID_SyncCvars (); //johnfitz -- write actual current mode to config file, in case cvars were messed with
 
@@ -538,11 +541,15 @@ not reinitialize anything.
 */
 void Host_ClearMemory (void)
 {
+	if (memstats_dump.value && (sv.name[0] || cl.mapname[0]))
+		Memory_DumpStats (sv.name[0] ? sv.name : cl.mapname);
+
 	Con_DPrintf ("Clearing memory\n");
 	D_FlushCaches ();
 	Mod_ClearAll ();
 /* host_hunklevel MUST be set at this point */
 	Hunk_FreeToLowMark (host_hunklevel);
+	Hunk_Trim ();
 	cls.signon = 0;
 	free(sv.edicts); // ericw -- sv.edicts switched to use malloc()
 	memset (&sv, 0, sizeof(sv));
@@ -763,6 +770,7 @@ void _Host_Frame (float time)
 
 	host_framecount++;
 
+	Memory_EndFrame ();
 }
 
 void Host_Frame (float time)
@@ -927,9 +935,11 @@ void Host_Shutdown(void)
 		CDAudio_Shutdown ();
 		S_Shutdown ();
 		IN_Shutdown ();
+		TexMgr_SaveTextureCache ();
 		VID_Shutdown();
 	}
 
+	COM_ShutdownFilesystem ();
 	LOG_Close ();
 }
 
@@ -60,20 +60,20 @@ void Host_Quit_f (void)
 FileList_Add
 ==================
 */
-void FileList_Add (const char *name, filelist_item_t **list)
+void FileList_Add (const char *name, filelist_item_t **list, tabindex_t *index)
 {
 	filelist_item_t	*item,*cursor,*prev;
 
+	item = (filelist_item_t *) Z_Malloc(sizeof(filelist_item_t));
+	q_strlcpy (item->name, name, sizeof(item->name));
+
 	// ignore duplicate
-	for (item = *list; item; item = item->next)
+	if (!TabIndex_Add (index, item->name, NULL))
 	{
-		if (!Q_strcmp (name, item->name))
-			return;
+		Z_Free (item);
+		return;
 	}
 
-	item = (filelist_item_t *) Z_Malloc(sizeof(filelist_item_t));
-	q_strlcpy (item->name, name, sizeof(item->name));
-
 	// insert each entry in alphabetical order
 	if (*list == NULL ||
 	    q_strcasecmp(item->name, (*list)->name) < 0) //insert at front
@@ -95,10 +95,11 @@ void FileList_Add (const char *name, filelist_item_t **list)
 	}
 }
 
-static void FileList_Clear (filelist_item_t **list)
+static void FileList_Clear (filelist_item_t **list, tabindex_t *index)
 {
 	filelist_item_t *blah;
-	
+
+	TabIndex_Clear (index);
 	while (*list)
 	{
 		blah = (*list)->next;
@@ -108,10 +109,11 @@ static void FileList_Clear (filelist_item_t **list)
 }
 
 filelist_item_t	*extralevels;
+tabindex_t	extralevels_index;
 
 void ExtraMaps_Add (const char *name)
 {
-	FileList_Add(name, &extralevels);
+	FileList_Add(name, &extralevels, &extralevels_index);
 }
 
 void ExtraMaps_Init (void)
@@ -186,7 +188,7 @@ void ExtraMaps_Init (void)
 
 static void ExtraMaps_Clear (void)
 {
-	FileList_Clear(&extralevels);
+	FileList_Clear(&extralevels, &extralevels_index);
 }
 
 void ExtraMaps_NewGame (void)
@@ -219,10 +221,11 @@ void Host_Maps_f (void)
 //==============================================================================
 
 filelist_item_t	*modlist;
+tabindex_t	modlist_index;
 
 void Modlist_Add (const char *name)
 {
-	FileList_Add(name, &modlist);
+	FileList_Add(name, &modlist, &modlist_index);
 }
 
 #ifdef _WIN32
@@ -288,10 +291,11 @@ void Modlist_Init (void)
 //==============================================================================
 
 filelist_item_t	*demolist;
+tabindex_t	demolist_index;
 
 static void DemoList_Clear (void)
 {
-	FileList_Clear (&demolist);
+	FileList_Clear (&demolist, &demolist_index);
 }
 
 void DemoList_Rebuild (void)
@@ -333,7 +337,7 @@ void DemoList_Init (void)
 			do
 			{
 				COM_StripExtension(fdat.cFileName, demname, sizeof(demname));
-				FileList_Add (demname, &demolist);
+				FileList_Add (demname, &demolist, &demolist_index);
 			} while (FindNextFile(fhnd, &fdat));
 			FindClose(fhnd);
 #else
@@ -346,7 +350,7 @@ void DemoList_Init (void)
 				if (q_strcasecmp(COM_FileGetExtension(dir_t->d_name), "dem") != 0)
 					continue;
 				COM_StripExtension(dir_t->d_name, demname, sizeof(demname));
-				FileList_Add (demname, &demolist);
+				FileList_Add (demname, &demolist, &demolist_index);
 			}
 			closedir(dir_p);
 #endif
@@ -360,7 +364,7 @@ void DemoList_Init (void)
 					if (!strcmp(COM_FileGetExtension(pak->files[i].name), "dem"))
 					{
 						COM_StripExtension(pak->files[i].name, demname, sizeof(demname));
-						FileList_Add (demname, &demolist);
+						FileList_Add (demname, &demolist, &demolist_index);
 					}
 				}
 			}
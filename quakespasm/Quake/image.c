@@ -83,12 +83,16 @@ byte *Image_LoadImage (const char *name, int *width, int *height)
 	FILE	*f;
 
 	q_snprintf (loadfilename, sizeof(loadfilename), "%s.tga", name);
+	COM_TraceLoader ("texture");
 	COM_FOpenFile (loadfilename, &f, NULL);
+	COM_TraceLoader (NULL);
 	if (f)
 		return Image_LoadTGA (f, width, height);
 
 	q_snprintf (loadfilename, sizeof(loadfilename), "%s.pcx", name);
+	COM_TraceLoader ("texture");
 	COM_FOpenFile (loadfilename, &f, NULL);
+	COM_TraceLoader (NULL);
 	if (f)
 		return Image_LoadPCX (f, width, height);
 
@@ -88,6 +88,7 @@ static void Sys_InitSDL (void)
 }
 
 #define DEFAULT_MEMORY (256 * 1024 * 1024) // ericw -- was 72MB (64-bit) / 64MB (32-bit)
+#define DEFAULT_MEMORY_64 (1024 * 1024 * 1024) // only reserved, memory is used as the hunk grows
 
 static quakeparms_t	parms;
 
@@ -118,7 +119,7 @@ int main(int argc, char *argv[])
 
 	Sys_Init();
 
-	parms.memsize = DEFAULT_MEMORY;
+	parms.memsize = (sizeof(void *) > 4) ? DEFAULT_MEMORY_64 : DEFAULT_MEMORY;
 	if (COM_CheckParm("-heapsize"))
 	{
 		t = COM_CheckParm("-heapsize") + 1;
@@ -126,10 +127,7 @@ int main(int argc, char *argv[])
 			parms.memsize = Q_atoi(com_argv[t]) * 1024;
 	}
 
-	parms.membase = malloc (parms.memsize);
-
-	if (!parms.membase)
-		Sys_Error ("Not enough memory free; check disk space\n");
+	parms.membase = NULL;	// Memory_Init reserves it
 
 	Sys_Printf("Quake %1.2f (c) id Software\n", VERSION);
 	Sys_Printf("GLQuake %1.2f (c) id Software\n", GLQUAKE_VERSION);
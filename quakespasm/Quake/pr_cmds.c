@@ -1092,6 +1092,7 @@ static void PF_precache_sound (void)
 		if (!sv.sound_precache[i])
 		{
 			sv.sound_precache[i] = s;
+			S_TouchSound (s);	// the local client will need it soon
 			return;
 		}
 		if (!strcmp(sv.sound_precache[i], s))
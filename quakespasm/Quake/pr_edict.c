@@ -57,19 +57,18 @@ int		type_size[8] = {
 static ddef_t	*ED_FieldAtOfs (int ofs);
 static qboolean	ED_ParseEpair (void *base, ddef_t *key, const char *s);
 
-#define	MAX_FIELD_LEN	64
-#define	GEFV_CACHESIZE	2
-
-typedef struct {
-	ddef_t	*pcache;
-	char	field[MAX_FIELD_LEN];
-} gefv_cache;
-
-static gefv_cache	gefvCache[GEFV_CACHESIZE] =
+/* name lookups, see ED_BuildNameHash */
+typedef struct
 {
-		{ NULL,	"" },
-		{ NULL,	"" }
-};
+	int		*heads;
+	int		*next;
+	unsigned int	mask;
+	const byte	*names;		/* the s_name of the first entry */
+	int		stride;		/* bytes from one s_name to the next */
+} prnamehash_t;
+
+static prnamehash_t	pr_fieldhash, pr_globalhash, pr_functionhash;
+static int		pr_namelookups;
 
 cvar_t	nomonsters = {"nomonsters", "0", CVAR_NONE};
 cvar_t	gamecfg = {"gamecfg", "0", CVAR_NONE};
@@ -83,6 +82,10 @@ cvar_t	saved2 = {"saved2", "0", CVAR_ARCHIVE};
 cvar_t	saved3 = {"saved3", "0", CVAR_ARCHIVE};
 cvar_t	saved4 = {"saved4", "0", CVAR_ARCHIVE};
 
+extern cvar_t	pr_threaded;
+extern cvar_t	pr_jit;
+extern cvar_t	pr_jit_verify;
+
 /*
 =================
 ED_ClearEdict
@@ -204,21 +207,67 @@ static ddef_t *ED_FieldAtOfs (int ofs)
 
 /*
 ============
-ED_FindField
+ED_BuildNameHash
+
+Indexes count names by COM_HashString, for the ED_Find* functions.  The
+chains are built from the back, so that of two entries with the same name
+the first is found, as it was by a linear search.
 ============
 */
-static ddef_t *ED_FindField (const char *name)
+static void ED_BuildNameHash (prnamehash_t *hash, const int *s_name, int stride, int count)
 {
-	ddef_t		*def;
-	int			i;
+	unsigned int	size, bucket;
+	int		i;
 
-	for (i = 0; i < progs->numfielddefs; i++)
+	for (size = 16; size < (unsigned int)count * 2; size <<= 1)
+		;
+	hash->heads = (int *) Hunk_AllocName ((size + count) * sizeof(int), "proghash");
+	hash->next = hash->heads + size;
+	hash->mask = size - 1;
+	hash->names = (const byte *)s_name;
+	hash->stride = stride;
+
+	for (i = 0; i < (int)size; i++)
+		hash->heads[i] = -1;
+	for (i = count - 1; i >= 0; i--)
 	{
-		def = &pr_fielddefs[i];
-		if ( !strcmp(PR_GetString(def->s_name), name) )
-			return def;
+		bucket = COM_HashString (PR_GetString(*(const int *)(hash->names + i * stride))) & hash->mask;
+		hash->next[i] = hash->heads[bucket];
+		hash->heads[bucket] = i;
 	}
-	return NULL;
+}
+
+/*
+============
+ED_FindName
+
+Returns the index of the first entry called name, or -1
+============
+*/
+static int ED_FindName (const prnamehash_t *hash, const char *name)
+{
+	int		i;
+
+	pr_namelookups++;
+	for (i = hash->heads[COM_HashString(name) & hash->mask]; i != -1; i = hash->next[i])
+	{
+		if (!strcmp(PR_GetString(*(const int *)(hash->names + i * hash->stride)), name))
+			return i;
+	}
+	return -1;
+}
+
+/*
+============
+ED_FindField
+============
+*/
+static ddef_t *ED_FindField (const char *name)
+{
+	int		i;
+
+	i = ED_FindName (&pr_fieldhash, name);
+	return (i == -1) ? NULL : &pr_fielddefs[i];
 }
 
 
@@ -229,16 +278,10 @@ ED_FindGlobal
 */
 static ddef_t *ED_FindGlobal (const char *name)
 {
-	ddef_t		*def;
-	int			i;
+	int		i;
 
-	for (i = 0; i < progs->numglobaldefs; i++)
-	{
-		def = &pr_globaldefs[i];
-		if ( !strcmp(PR_GetString(def->s_name), name) )
-			return def;
-	}
-	return NULL;
+	i = ED_FindName (&pr_globalhash, name);
+	return (i == -1) ? NULL : &pr_globaldefs[i];
 }
 
 
@@ -249,16 +292,10 @@ ED_FindFunction
 */
 static dfunction_t *ED_FindFunction (const char *fn_name)
 {
-	dfunction_t		*func;
-	int				i;
+	int		i;
 
-	for (i = 0; i < progs->numfunctions; i++)
-	{
-		func = &pr_functions[i];
-		if ( !strcmp(PR_GetString(func->s_name), fn_name) )
-			return func;
-	}
-	return NULL;
+	i = ED_FindName (&pr_functionhash, fn_name);
+	return (i == -1) ? NULL : &pr_functions[i];
 }
 
 /*
@@ -268,29 +305,9 @@ GetEdictFieldValue
 */
 eval_t *GetEdictFieldValue(edict_t *ed, const char *field)
 {
-	ddef_t			*def = NULL;
-	int				i;
-	static int		rep = 0;
-
-	for (i = 0; i < GEFV_CACHESIZE; i++)
-	{
-		if (!strcmp(field, gefvCache[i].field))
-		{
-			def = gefvCache[i].pcache;
-			goto Done;
-		}
-	}
+	ddef_t			*def;
 
 	def = ED_FindField (field);
-
-	if (strlen(field) < MAX_FIELD_LEN)
-	{
-		gefvCache[rep].pcache = def;
-		strcpy (gefvCache[rep].field, field);
-		rep ^= 1;
-	}
-
-Done:
 	if (!def)
 		return NULL;
 
@@ -973,7 +990,11 @@ void ED_LoadFromFile (const char *data)
 	dfunction_t	*func;
 	edict_t		*ent = NULL;
 	int		inhibit = 0;
+	int		count = 0;
+	double		start;
 
+	start = Sys_DoubleTime ();
+	pr_namelookups = 0;
 	pr_global_struct->time = sv.time;
 
 	// parse ents
@@ -990,6 +1011,7 @@ void ED_LoadFromFile (const char *data)
 			ent = EDICT_NUM(0);
 		else
 			ent = ED_Alloc ();
+		count++;
 		data = ED_ParseEdict (data, ent);
 
 		// remove things from different skill levels or deathmatch
@@ -1038,8 +1060,724 @@ void ED_LoadFromFile (const char *data)
 	}
 
 	Con_DPrintf ("%i entities inhibited\n", inhibit);
+	Con_DPrintf ("%i entities loaded in %.1f ms, %i name lookups\n", count, (Sys_DoubleTime () - start) * 1000.0, pr_namelookups);
+}
+
+
+/*
+==============================================================================
+
+PROGS OPTIMIZER
+
+With pr_optimize 1, PR_LoadProgs rewrites pr_statements before they're
+decoded for execution. The passes are:
+- jump threading, and dropping branches to the next statement;
+- folding IF/IFNOT and scalar arithmetic on immutable globals;
+- writing results straight into the variable a temporary is copied to;
+- removing stores whose result is never read, and unreachable code.
+They repeat until nothing changes, and the survivors are then compacted.
+
+A global is only treated as immutable, or as a temporary that can be
+dropped, if nothing outside the statements can see it. That rules out
+the system globals and anything saved in savegames. Function locals are
+never immutable, since PR_EnterFunction and PR_LeaveFunction write them,
+but they can still be dropped: only the statements read them, and qcc
+puts its temporaries there.
+
+Function boundaries are remapped, so PR_StackTrace and PR_Profile_f
+still see the same functions. pr_optreport lists what was removed.
+==============================================================================
+*/
+
+cvar_t	pr_optimize = {"pr_optimize", "0", CVAR_NONE};
+
+#define	OPT_MAXPASSES	8
+
+#define	OPT_ENGINE	1	/* global flags: visible outside the statements */
+#define	OPT_WRITTEN	2
+#define	OPT_LOCAL	4	/* written on function entry and exit */
+
+#define	OPT_REMOVED	1	/* statement flags */
+#define	OPT_TARGET	2
+#define	OPT_FIRST	4
+#define	OPT_REACHED	8
+
+typedef struct
+{
+	int		num;
+	int		ofs[3];
+	int		width[3];
+	qboolean	write[3];
+} optoperands_t;
+
+static int	*pr_optremoved;		/* statements removed per function */
+static int	pr_optoriginal;		/* statements before optimizing */
+
+static int	opt_numstatements;
+static byte	*opt_sflags;
+static byte	*opt_gflags;
+static int	*opt_refs;
+static int	*opt_constants;		/* hash of immutable values to globals */
+static int	opt_constantmask;
+
+static void PR_OptOperand (optoperands_t *ops, int ofs, int width, qboolean write)
+{
+	ops->ofs[ops->num] = (unsigned short)ofs;
+	ops->width[ops->num] = width;
+	ops->write[ops->num] = write;
+	ops->num++;
+}
+
+/*
+============
+PR_OptOperands
+
+The global ranges a statement reads and writes. Returns false for an
+opcode it doesn't know.
+============
+*/
+static qboolean PR_OptOperands (dstatement_t *st, optoperands_t *ops)
+{
+	ops->num = 0;
+
+	switch (st->op)
+	{
+	case OP_MUL_F:
+	case OP_DIV_F:
+	case OP_ADD_F:
+	case OP_SUB_F:
+	case OP_EQ_F:
+	case OP_EQ_S:
+	case OP_EQ_E:
+	case OP_EQ_FNC:
+	case OP_NE_F:
+	case OP_NE_S:
+	case OP_NE_E:
+	case OP_NE_FNC:
+	case OP_LE:
+	case OP_GE:
+	case OP_LT:
+	case OP_GT:
+	case OP_AND:
+	case OP_OR:
+	case OP_BITAND:
+	case OP_BITOR:
+	case OP_LOAD_F:
+	case OP_LOAD_S:
+	case OP_LOAD_ENT:
+	case OP_LOAD_FLD:
+	case OP_LOAD_FNC:
+	case OP_ADDRESS:
+		PR_OptOperand (ops, st->a, 1, false);
+		PR_OptOperand (ops, st->b, 1, false);
+		PR_OptOperand (ops, st->c, 1, true);
+		break;
+	case OP_LOAD_V:
+		PR_OptOperand (ops, st->a, 1, false);
+		PR_OptOperand (ops, st->b, 1, false);
+		PR_OptOperand (ops, st->c, 3, true);
+		break;
+	case OP_MUL_V:
+	case OP_EQ_V:
+	case OP_NE_V:
+		PR_OptOperand (ops, st->a, 3, false);
+		PR_OptOperand (ops, st->b, 3, false);
+		PR_OptOperand (ops, st->c, 1, true);
+		break;
+	case OP_ADD_V:
+	case OP_SUB_V:
+		PR_OptOperand (ops, st->a, 3, false);
+		PR_OptOperand (ops, st->b, 3, false);
+		PR_OptOperand (ops, st->c, 3, true);
+		break;
+	case OP_MUL_FV:
+		PR_OptOperand (ops, st->a, 1, false);
+		PR_OptOperand (ops, st->b, 3, false);
+		PR_OptOperand (ops, st->c, 3, true);
+		break;
+	case OP_MUL_VF:
+		PR_OptOperand (ops, st->a, 3, false);
+		PR_OptOperand (ops, st->b, 1, false);
+		PR_OptOperand (ops, st->c, 3, true);
+		break;
+	case OP_NOT_F:
+	case OP_NOT_S:
+	case OP_NOT_ENT:
+	case OP_NOT_FNC:
+		PR_OptOperand (ops, st->a, 1, false);
+		PR_OptOperand (ops, st->c, 1, true);
+		break;
+	case OP_NOT_V:
+		PR_OptOperand (ops, st->a, 3, false);
+		PR_OptOperand (ops, st->c, 1, true);
+		break;
+	case OP_STORE_F:
+	case OP_STORE_S:
+	case OP_STORE_ENT:
+	case OP_STORE_FLD:
+	case OP_STORE_FNC:
+		PR_OptOperand (ops, st->a, 1, false);
+		PR_OptOperand (ops, st->b, 1, true);
+		break;
+	case OP_STORE_V:
+		PR_OptOperand (ops, st->a, 3, false);
+		PR_OptOperand (ops, st->b, 3, true);
+		break;
+	case OP_STOREP_F:
+	case OP_STOREP_S:
+	case OP_STOREP_ENT:
+	case OP_STOREP_FLD:
+	case OP_STOREP_FNC:
+	case OP_STATE:
+		PR_OptOperand (ops, st->a, 1, false);
+		PR_OptOperand (ops, st->b, 1, false);
+		break;
+	case OP_STOREP_V:
+		PR_OptOperand (ops, st->a, 3, false);
+		PR_OptOperand (ops, st->b, 1, false);
+		break;
+	case OP_DONE:
+	case OP_RETURN:
+		PR_OptOperand (ops, st->a, 3, false);
+		break;
+	case OP_IF:
+	case OP_IFNOT:
+	case OP_CALL0:
+	case OP_CALL1:
+	case OP_CALL2:
+	case OP_CALL3:
+	case OP_CALL4:
+	case OP_CALL5:
+	case OP_CALL6:
+	case OP_CALL7:
+	case OP_CALL8:
+		PR_OptOperand (ops, st->a, 1, false);
+		break;
+	case OP_GOTO:
+		break;
+	default:
+		return false;
+	}
+
+	return true;
 }
 
+/*
+============
+PR_OptBranch
+
+Returns the branch offset of IF, IFNOT and GOTO, or 0 for other ops
+============
+*/
+static int PR_OptBranch (dstatement_t *st)
+{
+	if (st->op == OP_IF || st->op == OP_IFNOT)
+		return st->b;
+	if (st->op == OP_GOTO)
+		return st->a;
+	return 0;
+}
+
+static void PR_OptSetBranch (dstatement_t *st, int ofs)
+{
+	if (st->op == OP_GOTO)
+		st->a = ofs;
+	else
+		st->b = ofs;
+}
+
+/* first statement at or after s that hasn't been removed */
+static int PR_OptLive (int s)
+{
+	while (s < opt_numstatements && (opt_sflags[s] & OPT_REMOVED))
+		s++;
+	return s;
+}
+
+static qboolean PR_OptImmutable (int ofs, int width)
+{
+	int		i;
+
+	for (i = 0; i < width; i++)
+	{
+		if (ofs + i >= progs->numglobals || (opt_gflags[ofs + i] & (OPT_ENGINE | OPT_WRITTEN | OPT_LOCAL)))
+			return false;
+	}
+	return true;
+}
+
+/* only touched by one statement and written there, locals included */
+static qboolean PR_OptUnused (int ofs, int width, int refs)
+{
+	int		i;
+
+	for (i = 0; i < width; i++)
+	{
+		if (ofs + i >= progs->numglobals || (opt_gflags[ofs + i] & OPT_ENGINE) || opt_refs[ofs + i] != refs)
+			return false;
+	}
+	return true;
+}
+
+static qboolean PR_OptOverlaps (int a, int awidth, int b, int bwidth)
+{
+	return a < b + bwidth && b < a + awidth;
+}
+
+/*
+============
+PR_OptScan
+
+Works out what every global and statement is used for
+============
+*/
+static qboolean PR_OptScan (void)
+{
+	dstatement_t	*st;
+	optoperands_t	ops;
+	dfunction_t	*f;
+	int		i, j, k, s, sp, *stack;
+	int		numsysglobals;
+
+	numsysglobals = sizeof(globalvars_t) / 4;
+	memset (opt_gflags, 0, progs->numglobals);
+	memset (opt_refs, 0, progs->numglobals * sizeof(int));
+	for (i = 0; i < numsysglobals && i < progs->numglobals; i++)
+		opt_gflags[i] |= OPT_ENGINE;
+	for (i = 0; i < progs->numglobaldefs; i++)
+	{
+		if (!(pr_globaldefs[i].type & DEF_SAVEGLOBAL))
+			continue;
+		k = ((pr_globaldefs[i].type & ~DEF_SAVEGLOBAL) == ev_vector) ? 3 : 1;
+		for (j = pr_globaldefs[i].ofs; j < pr_globaldefs[i].ofs + k && j < progs->numglobals; j++)
+			opt_gflags[j] |= OPT_ENGINE;
+	}
+	for (i = 0, f = pr_functions; i < progs->numfunctions; i++, f++)
+	{
+		if (f->first_statement <= 0)
+			continue;
+		if (f->first_statement >= opt_numstatements || f->parm_start < 0 || f->parm_start + f->locals > progs->numglobals)
+			return false;
+		for (j = f->parm_start; j < f->parm_start + f->locals; j++)
+			opt_gflags[j] |= OPT_LOCAL;
+	}
+
+	for (s = 0; s < opt_numstatements; s++)
+	{
+		opt_sflags[s] &= OPT_REMOVED | OPT_FIRST;
+		if (opt_sflags[s] & OPT_REMOVED)
+			continue;
+		st = &pr_statements[s];
+		if (!PR_OptOperands (st, &ops))
+			return false;
+		for (i = 0; i < ops.num; i++)
+		{
+			if (ops.ofs[i] + ops.width[i] > progs->numglobals)
+				return false;
+			for (j = ops.ofs[i]; j < ops.ofs[i] + ops.width[i]; j++)
+			{
+				opt_refs[j]++;
+				if (ops.write[i])
+					opt_gflags[j] |= OPT_WRITTEN;
+			}
+		}
+		if (PR_OptBranch (st))
+		{
+			j = s + PR_OptBranch (st);
+			if (j <= 0 || j >= opt_numstatements)
+				return false;
+			opt_sflags[PR_OptLive (j)] |= OPT_TARGET;
+		}
+	}
+
+	// flood fill from each function to find the live code
+	stack = (int *) Scratch_Alloc (opt_numstatements * sizeof(int));
+	for (i = 0, sp = 0; i < progs->numfunctions; i++)
+	{
+		s = pr_functions[i].first_statement;
+		if (s > 0 && !(opt_sflags[s] & OPT_REACHED))
+		{
+			opt_sflags[s] |= OPT_REACHED;
+			stack[sp++] = s;
+		}
+	}
+	while (sp)
+	{
+		s = stack[--sp];
+		st = &pr_statements[s];
+		for (k = 0; k < 2; k++)
+		{
+			if (k == 0)
+			{
+				if (st->op == OP_GOTO || st->op == OP_RETURN || st->op == OP_DONE)
+					continue;
+				j = s + 1;
+			}
+			else
+			{
+				if (!PR_OptBranch (st))
+					continue;
+				j = s + PR_OptBranch (st);
+			}
+			if (j >= opt_numstatements)
+				return false;
+			if (!(opt_sflags[j] & OPT_REACHED))
+			{
+				opt_sflags[j] |= OPT_REACHED;
+				stack[sp++] = j;
+			}
+		}
+	}
+
+	return true;
+}
+
+/*
+============
+PR_OptFold
+
+Evaluates a statement whose operands are all constant. Returns false for
+ops it leaves alone.
+============
+*/
+static qboolean PR_OptFold (dstatement_t *st, eval_t *result)
+{
+	eval_t	*a, *b;
+
+	a = (eval_t *)&pr_globals[(unsigned short)st->a];
+	b = (eval_t *)&pr_globals[(unsigned short)st->b];
+
+	switch (st->op)
+	{
+	case OP_ADD_F:	result->_float = a->_float + b->_float; break;
+	case OP_SUB_F:	result->_float = a->_float - b->_float; break;
+	case OP_MUL_F:	result->_float = a->_float * b->_float; break;
+	case OP_DIV_F:	result->_float = a->_float / b->_float; break;
+	case OP_BITAND:	result->_float = (int)a->_float & (int)b->_float; break;
+	case OP_BITOR:	result->_float = (int)a->_float | (int)b->_float; break;
+	case OP_GE:	result->_float = a->_float >= b->_float; break;
+	case OP_LE:	result->_float = a->_float <= b->_float; break;
+	case OP_GT:	result->_float = a->_float > b->_float; break;
+	case OP_LT:	result->_float = a->_float < b->_float; break;
+	case OP_AND:	result->_float = a->_float && b->_float; break;
+	case OP_OR:	result->_float = a->_float || b->_float; break;
+	case OP_EQ_F:	result->_float = a->_float == b->_float; break;
+	case OP_NE_F:	result->_float = a->_float != b->_float; break;
+	case OP_NOT_F:	result->_float = !a->_float; break;
+	case OP_MUL_V:
+		result->_float = a->vector[0] * b->vector[0] +
+				 a->vector[1] * b->vector[1] +
+				 a->vector[2] * b->vector[2];
+		break;
+	default:
+		return false;
+	}
+
+	return true;
+}
+
+/*
+============
+PR_OptConstant
+
+Finds an immutable global holding the value, or returns -1
+============
+*/
+static int PR_OptConstant (int value)
+{
+	int		i;
+
+	for (i = (unsigned int)value * 2654435761u & opt_constantmask; opt_constants[i] >= 0; i = (i + 1) & opt_constantmask)
+	{
+		if (((int *)pr_globals)[opt_constants[i]] == value)
+			return opt_constants[i];
+	}
+	return -1;
+}
+
+static void PR_OptAddConstant (int ofs)
+{
+	int		i, value;
+
+	value = ((int *)pr_globals)[ofs];
+	if (PR_OptConstant (value) >= 0)
+		return;
+	for (i = (unsigned int)value * 2654435761u & opt_constantmask; opt_constants[i] >= 0; i = (i + 1) & opt_constantmask)
+		;
+	opt_constants[i] = ofs;
+}
+
+/*
+============
+PR_OptPass
+
+One round of the rewrites, returns the number of changes
+============
+*/
+static int PR_OptPass (void)
+{
+	dstatement_t	*st, *next;
+	optoperands_t	ops, nextops;
+	eval_t		value;
+	int		s, n, t, k, i, changes, w;
+
+	changes = 0;
+
+	for (s = 1; s < opt_numstatements; s++)
+	{
+		if (opt_sflags[s] & OPT_REMOVED)
+			continue;
+		st = &pr_statements[s];
+
+		if (!(opt_sflags[s] & OPT_REACHED))
+		{
+			opt_sflags[s] |= OPT_REMOVED;
+			changes++;
+			continue;
+		}
+
+		n = PR_OptLive (s + 1);
+
+		if (PR_OptBranch (st))
+		{
+		// branch to a constant condition
+			if (st->op != OP_GOTO && PR_OptImmutable ((unsigned short)st->a, 1))
+			{
+				if ((st->op == OP_IF) == (((int *)pr_globals)[(unsigned short)st->a] != 0))
+				{
+					st->a = st->b;
+					st->b = 0;
+					st->op = OP_GOTO;
+				}
+				else
+				{
+					opt_sflags[s] |= OPT_REMOVED;
+					changes++;
+					continue;
+				}
+				changes++;
+			}
+
+		// thread jumps to jumps
+			t = PR_OptLive (s + PR_OptBranch (st));
+			for (k = 0; k < 16 && t < opt_numstatements && pr_statements[t].op == OP_GOTO && t != s; k++)
+				t = PR_OptLive (t + pr_statements[t].a);
+			if (t >= opt_numstatements)
+				continue;
+			if (t != PR_OptLive (s + PR_OptBranch (st)))
+			{
+				PR_OptSetBranch (st, t - s);
+				changes++;
+			}
+
+		// a branch to the next statement does nothing
+			if (t == n)
+			{
+				opt_sflags[s] |= OPT_REMOVED;
+				changes++;
+				continue;
+			}
+
+		// goto return is return
+			if (st->op == OP_GOTO && (pr_statements[t].op == OP_RETURN || pr_statements[t].op == OP_DONE))
+			{
+				*st = pr_statements[t];
+				changes++;
+			}
+			continue;
+		}
+
+		if (!PR_OptOperands (st, &ops))
+			continue;
+		for (i = 0; i < ops.num && !ops.write[i]; i++)
+			;
+		if (i == ops.num)
+			continue;	// writes nothing
+		w = ops.width[i];
+
+	// fold constants
+		if (ops.num == 3 || st->op == OP_NOT_F)
+		{
+			if (PR_OptImmutable (ops.ofs[0], ops.width[0]) && (ops.num == 2 || PR_OptImmutable (ops.ofs[1], ops.width[1])) && PR_OptFold (st, &value))
+			{
+				k = PR_OptConstant (value._int);
+				if (k >= 0)
+				{
+					st->op = OP_STORE_F;
+					st->a = k;
+					st->b = ops.ofs[i];
+					st->c = 0;
+					changes++;
+					continue;
+				}
+			}
+		}
+
+	// stores nobody reads
+		if (st->op != OP_ADDRESS && st->op != OP_EQ_S && st->op != OP_NE_S && st->op != OP_NOT_S &&
+			(st->op < OP_LOAD_F || st->op > OP_LOAD_FNC) && PR_OptUnused (ops.ofs[i], w, 1))
+		{
+			opt_sflags[s] |= OPT_REMOVED;
+			changes++;
+			continue;
+		}
+
+	// result copied out of a temporary that isn't used anywhere else
+		if (n >= opt_numstatements || (opt_sflags[n] & (OPT_TARGET | OPT_FIRST)))
+			continue;
+		next = &pr_statements[n];
+		if (next->op < OP_STORE_F || next->op > OP_STORE_FNC || (unsigned short)next->a != ops.ofs[i])
+			continue;
+		if (!PR_OptOperands (next, &nextops) || nextops.width[0] != w || !PR_OptUnused (ops.ofs[i], w, 2))
+			continue;
+		for (k = 0; k < ops.num; k++)
+		{
+			if (k != i && PR_OptOverlaps (ops.ofs[k], ops.width[k], nextops.ofs[1], w))
+				break;
+		}
+		if (k < ops.num)
+			continue;
+
+		if (st->op >= OP_STORE_F && st->op <= OP_STORE_FNC)
+			st->b = next->b;
+		else
+			st->c = next->b;
+		opt_sflags[n] |= OPT_REMOVED;
+		changes++;
+	}
+
+	return changes;
+}
+
+/*
+============
+PR_OptimizeProgs
+
+Called by PR_LoadProgs once everything has been byte swapped
+============
+*/
+static void PR_OptimizeProgs (void)
+{
+	dstatement_t	*st;
+	dfunction_t	*f;
+	int		mark, pass, changes, i, s, t, *newindex, *order;
+
+	pr_optremoved = NULL;
+	pr_optoriginal = progs->numstatements;
+	if (!pr_optimize.value || progs->numstatements <= 1)
+		return;
+
+	mark = Scratch_Mark ();
+	opt_numstatements = progs->numstatements;
+	opt_sflags = (byte *) Scratch_Alloc (opt_numstatements);
+	opt_gflags = (byte *) Scratch_Alloc (progs->numglobals);
+	opt_refs = (int *) Scratch_Alloc (progs->numglobals * sizeof(int));
+	memset (opt_sflags, 0, opt_numstatements);
+	for (i = 0; i < progs->numfunctions; i++)
+	{
+		if (pr_functions[i].first_statement > 0 && pr_functions[i].first_statement < opt_numstatements)
+			opt_sflags[pr_functions[i].first_statement] |= OPT_FIRST;
+	}
+
+	if (!PR_OptScan ())
+	{
+		Con_Printf ("PR_OptimizeProgs: progs.dat not understood, left alone\n");
+		Scratch_FreeToMark (mark);
+		return;
+	}
+
+	for (opt_constantmask = 1; opt_constantmask < progs->numglobals * 2; opt_constantmask <<= 1)
+		;
+	opt_constants = (int *) Scratch_Alloc (opt_constantmask * sizeof(int));
+	memset (opt_constants, -1, opt_constantmask * sizeof(int));
+	opt_constantmask--;
+	for (i = 0; i < progs->numglobals; i++)
+	{
+		if (PR_OptImmutable (i, 1))
+			PR_OptAddConstant (i);
+	}
+
+	for (pass = 0; pass < OPT_MAXPASSES; pass++)
+	{
+		changes = PR_OptPass ();
+		if (!changes)
+			break;
+		t = Scratch_Mark ();
+		PR_OptScan ();
+		Scratch_FreeToMark (t);
+	}
+
+// compact what's left, fixing up branches and function starts
+	newindex = (int *) Scratch_Alloc ((opt_numstatements + 1) * sizeof(int));
+	for (s = 0, t = 0; s < opt_numstatements; s++)
+	{
+		newindex[s] = t;
+		if (!(opt_sflags[s] & OPT_REMOVED))
+			t++;
+	}
+	newindex[opt_numstatements] = t;
+
+	for (s = 0; s < opt_numstatements; s++)
+	{
+		st = &pr_statements[s];
+		if (!(opt_sflags[s] & OPT_REMOVED) && PR_OptBranch (st))
+			PR_OptSetBranch (st, newindex[PR_OptLive (s + PR_OptBranch (st))] - newindex[s]);
+	}
+
+	pr_optremoved = (int *) Hunk_AllocName (progs->numfunctions * sizeof(int), "progopt");
+	order = (int *) Scratch_Alloc (opt_numstatements * sizeof(int));
+	memset (order, -1, opt_numstatements * sizeof(int));
+	for (i = 0, f = pr_functions; i < progs->numfunctions; i++, f++)
+	{
+		if (f->first_statement > 0)
+			order[f->first_statement] = i;
+	}
+	for (s = 1, i = -1; s < opt_numstatements; s++)
+	{
+		if (order[s] >= 0)
+			i = order[s];
+		if (i >= 0 && (opt_sflags[s] & OPT_REMOVED))
+			pr_optremoved[i]++;
+	}
+	for (i = 0, f = pr_functions; i < progs->numfunctions; i++, f++)
+	{
+		if (f->first_statement > 0)
+			f->first_statement = newindex[PR_OptLive (f->first_statement)];
+	}
+
+	for (s = 0; s < opt_numstatements; s++)
+	{
+		if (!(opt_sflags[s] & OPT_REMOVED))
+			pr_statements[newindex[s]] = pr_statements[s];
+	}
+	progs->numstatements = newindex[opt_numstatements];
+
+	Con_DPrintf ("Optimized progs from %i to %i statements in %i passes\n", pr_optoriginal, progs->numstatements, pass + 1);
+	Scratch_FreeToMark (mark);
+}
+
+/*
+============
+PR_OptReport_f
+============
+*/
+static void PR_OptReport_f (void)
+{
+	int		i;
+
+	if (!sv.active || !pr_optremoved)
+	{
+		Con_Printf ("progs not optimized\n");
+		return;
+	}
+
+	for (i = 0; i < progs->numfunctions; i++)
+	{
+		if (pr_optremoved[i])
+			Con_Printf ("%5i %s\n", pr_optremoved[i], PR_GetString(pr_functions[i].s_name));
+	}
+	Con_Printf ("%i of %i statements removed\n", pr_optoriginal - progs->numstatements, pr_optoriginal);
+}
 
 /*
 ===============
@@ -1050,19 +1788,12 @@ void PR_LoadProgs (void)
 {
 	int			i;
 
-	// flush the non-C variable lookup cache
-	for (i = 0; i < GEFV_CACHESIZE; i++)
-		gefvCache[i].field[0] = 0;
-
-	CRC_Init (&pr_crc);
-
 	progs = (dprograms_t *)COM_LoadHunkFile ("progs.dat", NULL);
 	if (!progs)
 		Host_Error ("PR_LoadProgs: couldn't load progs.dat");
 	Con_DPrintf ("Programs occupy %iK.\n", com_filesize/1024);
 
-	for (i = 0; i < com_filesize; i++)
-		CRC_ProcessByte (&pr_crc, ((byte *)progs)[i]);
+	pr_crc = CRC_Block ((byte *)progs, com_filesize);
 
 	// byte swap the header
 	for (i = 0; i < (int) sizeof(*progs) / 4; i++)
@@ -1139,12 +1870,19 @@ void PR_LoadProgs (void)
 	for (i = 0; i < progs->numglobals; i++)
 		((int *)pr_globals)[i] = LittleLong (((int *)pr_globals)[i]);
 
+	ED_BuildNameHash (&pr_fieldhash, &pr_fielddefs[0].s_name, sizeof(ddef_t), progs->numfielddefs);
+	ED_BuildNameHash (&pr_globalhash, &pr_globaldefs[0].s_name, sizeof(ddef_t), progs->numglobaldefs);
+	ED_BuildNameHash (&pr_functionhash, &pr_functions[0].s_name, sizeof(dfunction_t), progs->numfunctions);
+
 	pr_edict_size = progs->entityfields * 4 + sizeof(edict_t) - sizeof(entvars_t);
 	// round off to next highest whole word address (esp for Alpha)
 	// this ensures that pointers in the engine data area are always
 	// properly aligned
 	pr_edict_size += sizeof(void *) - 1;
 	pr_edict_size &= ~(sizeof(void *) - 1);
+
+	PR_OptimizeProgs ();
+	PR_DecodeProgs ();
 }
 
 
@@ -1159,6 +1897,11 @@ void PR_Init (void)
 	Cmd_AddCommand ("edicts", ED_PrintEdicts);
 	Cmd_AddCommand ("edictcount", ED_Count);
 	Cmd_AddCommand ("profile", PR_Profile_f);
+	Cmd_AddCommand ("profile_start", PR_ProfileStart_f);
+	Cmd_AddCommand ("profile_stop", PR_ProfileStop_f);
+	Cmd_AddCommand ("profile_top", PR_ProfileTop_f);
+	Cmd_AddCommand ("profile_dump", PR_ProfileDump_f);
+	Cmd_AddCommand ("pr_optreport", PR_OptReport_f);
 	Cvar_RegisterVariable (&nomonsters);
 	Cvar_RegisterVariable (&gamecfg);
 	Cvar_RegisterVariable (&scratch1);
@@ -1170,6 +1913,10 @@ void PR_Init (void)
 	Cvar_RegisterVariable (&saved2);
 	Cvar_RegisterVariable (&saved3);
 	Cvar_RegisterVariable (&saved4);
+	Cvar_RegisterVariable (&pr_threaded);
+	Cvar_RegisterVariable (&pr_jit);
+	Cvar_RegisterVariable (&pr_jit_verify);
+	Cvar_RegisterVariable (&pr_optimize);
 }
 
 
@@ -20,6 +20,12 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 
 #include "quakedef.h"
+#include "q_ctype.h"
+#include <setjmp.h>
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define PR_JIT	/* see NATIVE CODE below */
+#endif
 
 typedef struct
 {
@@ -40,6 +46,11 @@ dfunction_t	*pr_xfunction;
 int		pr_xstatement;
 int		pr_argc;
 
+#ifdef PR_JIT
+static qboolean	pr_jitverifying;
+static jmp_buf	pr_jitverifyabort;
+#endif
+
 static const char *pr_opnames[] =
 {
 	"DONE",
@@ -122,223 +133,2232 @@ static const char *pr_opnames[] =
 
 	"GOTO",
 
-	"AND",
-	"OR",
+	"AND",
+	"OR",
+
+	"BITAND",
+	"BITOR"
+};
+
+const char *PR_GlobalString (int ofs);
+const char *PR_GlobalStringNoContents (int ofs);
+
+
+//=============================================================================
+
+/*
+=================
+PR_PrintStatement
+=================
+*/
+static void PR_PrintStatement (dstatement_t *s)
+{
+	int	i;
+
+	if ((unsigned int)s->op < sizeof(pr_opnames)/sizeof(pr_opnames[0]))
+	{
+		Con_Printf("%s ", pr_opnames[s->op]);
+		i = strlen(pr_opnames[s->op]);
+		for ( ; i < 10; i++)
+			Con_Printf(" ");
+	}
+
+	if (s->op == OP_IF || s->op == OP_IFNOT)
+		Con_Printf("%sbranch %i", PR_GlobalString(s->a), s->b);
+	else if (s->op == OP_GOTO)
+	{
+		Con_Printf("branch %i", s->a);
+	}
+	else if ((unsigned int)(s->op-OP_STORE_F) < 6)
+	{
+		Con_Printf("%s", PR_GlobalString(s->a));
+		Con_Printf("%s", PR_GlobalStringNoContents(s->b));
+	}
+	else
+	{
+		if (s->a)
+			Con_Printf("%s", PR_GlobalString(s->a));
+		if (s->b)
+			Con_Printf("%s", PR_GlobalString(s->b));
+		if (s->c)
+			Con_Printf("%s", PR_GlobalStringNoContents(s->c));
+	}
+	Con_Printf("\n");
+}
+
+/*
+============
+PR_StackTrace
+============
+*/
+static void PR_StackTrace (void)
+{
+	int		i;
+	dfunction_t	*f;
+
+	if (pr_depth == 0)
+	{
+		Con_Printf("<NO STACK>\n");
+		return;
+	}
+
+	pr_stack[pr_depth].f = pr_xfunction;
+	for (i = pr_depth; i >= 0; i--)
+	{
+		f = pr_stack[i].f;
+		if (!f)
+		{
+			Con_Printf("<NO FUNCTION>\n");
+		}
+		else
+		{
+			Con_Printf("%12s : %s\n", PR_GetString(f->s_file), PR_GetString(f->s_name));
+		}
+	}
+}
+
+
+/*
+============
+PR_Profile_f
+
+============
+*/
+void PR_Profile_f (void)
+{
+	int		i, num;
+	int		pmax;
+	dfunction_t	*f, *best;
+
+	if (!sv.active)
+		return;
+
+	num = 0;
+	do
+	{
+		pmax = 0;
+		best = NULL;
+		for (i = 0; i < progs->numfunctions; i++)
+		{
+			f = &pr_functions[i];
+			if (f->profile > pmax)
+			{
+				pmax = f->profile;
+				best = f;
+			}
+		}
+		if (best)
+		{
+			if (num < 10)
+				Con_Printf("%7i %s\n", best->profile, PR_GetString(best->s_name));
+			num++;
+			best->profile = 0;
+		}
+	} while (best);
+}
+
+
+/*
+==============================================================================
+
+CALL PROFILE
+
+profile_start records wall time and calls for every QuakeC function and
+builtin, as a tree of call paths, so the cost of a builtin like traceline
+is kept apart from the functions calling it.  A nested PR_ExecuteProgram
+from a builtin, like a touch function run by SV_Move, shows up under that
+builtin.  profile_top ranks the functions, or lists the callers and
+callees of one, and profile_dump writes the paths in the collapsed stack
+format read by flamegraph tools.
+
+==============================================================================
+*/
+
+#define	PROFILE_MAXNODES	262144
+#define	PROFILE_MAXDEPTH	(MAX_STACK_DEPTH * 2 + 2)	/* a builtin between each function */
+
+typedef struct
+{
+	int		func;		/* pr_functions index, -1 for the root */
+	int		parent;
+	int		child;		/* first callee */
+	int		next;		/* next callee of the same caller */
+	int		calls;
+	double		total;		/* including the callees */
+	double		self;
+} prprofnode_t;
+
+typedef struct
+{
+	int		node;
+	double		start;
+	double		callees;
+} prprofframe_t;
+
+static qboolean		pr_profiling;
+static double		pr_profstart, pr_profend, pr_profstop;
+static double		pr_proftime;		/* in the outermost calls */
+static prprofnode_t	*pr_profnodes;
+static int		pr_profnumnodes, pr_profmaxnodes;
+static prprofframe_t	pr_profstack[PROFILE_MAXDEPTH];
+static int		pr_profdepth;
+static int		pr_profskipped;		/* innermost calls that weren't recorded */
+
+/*
+============
+PR_ProfileClear
+
+Called from PR_DecodeProgs, the nodes refer to the old functions
+============
+*/
+static void PR_ProfileClear (void)
+{
+	pr_profiling = false;
+	pr_profnumnodes = 0;
+	pr_proftime = 0;
+}
+
+/*
+============
+PR_ProfileEnter
+============
+*/
+static void PR_ProfileEnter (dfunction_t *f)
+{
+	prprofnode_t	*n;
+	int		i, parent;
+
+#ifdef PR_JIT
+	if (pr_jitverifying)	// the native run is the one that counts
+		return;
+#endif
+	if (pr_profskipped || pr_profdepth == PROFILE_MAXDEPTH - 1)
+	{
+		pr_profskipped++;
+		return;
+	}
+
+	parent = pr_profstack[pr_profdepth].node;
+	for (i = pr_profnodes[parent].child; i >= 0; i = pr_profnodes[i].next)
+	{
+		if (pr_profnodes[i].func == f - pr_functions)
+			break;
+	}
+	if (i < 0)
+	{
+		if (pr_profnumnodes == pr_profmaxnodes)
+		{
+			if (pr_profmaxnodes == PROFILE_MAXNODES)
+			{
+				pr_profskipped++;
+				return;
+			}
+			pr_profmaxnodes *= 2;
+			pr_profnodes = (prprofnode_t *) realloc (pr_profnodes, pr_profmaxnodes * sizeof(prprofnode_t));
+			if (!pr_profnodes)
+				Sys_Error ("PR_ProfileEnter: out of memory on %i nodes", pr_profmaxnodes);
+		}
+		i = pr_profnumnodes++;
+		n = &pr_profnodes[i];
+		n->func = f - pr_functions;
+		n->parent = parent;
+		n->child = -1;
+		n->next = pr_profnodes[parent].child;
+		n->calls = 0;
+		n->total = n->self = 0;
+		pr_profnodes[parent].child = i;
+	}
+
+	pr_profnodes[i].calls++;
+	pr_profdepth++;
+	pr_profstack[pr_profdepth].node = i;
+	pr_profstack[pr_profdepth].callees = 0;
+	pr_profstack[pr_profdepth].start = Sys_PreciseTime ();
+}
+
+/*
+============
+PR_ProfileLeave
+============
+*/
+static void PR_ProfileLeave (void)
+{
+	prprofframe_t	*frame;
+	prprofnode_t	*n;
+	double		time;
+
+#ifdef PR_JIT
+	if (pr_jitverifying)
+		return;
+#endif
+	if (pr_profskipped)
+	{
+		pr_profskipped--;
+		return;
+	}
+	if (!pr_profdepth)
+		return;
+
+	frame = &pr_profstack[pr_profdepth--];
+	time = Sys_PreciseTime () - frame->start;
+	n = &pr_profnodes[frame->node];
+	n->total += time;
+	n->self += time - frame->callees;
+	pr_profstack[pr_profdepth].callees += time;
+	if (!pr_profdepth)
+		pr_proftime += time;
+}
+
+/*
+============
+PR_ProfileBuiltin
+============
+*/
+static void PR_ProfileBuiltin (dfunction_t *f, int num)
+{
+	PR_ProfileEnter (f);
+	pr_builtins[num]();
+	PR_ProfileLeave ();
+}
+
+/*
+============
+PR_ProfileStop
+============
+*/
+static void PR_ProfileStop (void)
+{
+	if (!pr_profiling)
+		return;
+	pr_profiling = false;
+	pr_profstop = realtime;
+	Con_Printf ("profiled %.1f seconds, %.2f ms in QuakeC, see profile_top and profile_dump\n",
+			pr_profstop - pr_profstart, pr_proftime * 1000.0);
+}
+
+/*
+============
+PR_ProfileFrame
+
+Called by PR_ExecuteProgram when no program is running.  A Host_Error can
+leave frames behind, they're dropped here.
+============
+*/
+static void PR_ProfileFrame (void)
+{
+	pr_profdepth = 0;
+	pr_profskipped = 0;
+	if (pr_profend && realtime >= pr_profend)
+		PR_ProfileStop ();
+}
+
+/*
+============
+PR_ProfileStart_f
+============
+*/
+void PR_ProfileStart_f (void)
+{
+	if (!sv.active)
+	{
+		Con_Printf ("no server running\n");
+		return;
+	}
+
+	if (!pr_profnodes)
+	{
+		pr_profmaxnodes = 4096;
+		pr_profnodes = (prprofnode_t *) malloc (pr_profmaxnodes * sizeof(prprofnode_t));
+		if (!pr_profnodes)
+			Sys_Error ("PR_ProfileStart_f: out of memory on %i nodes", pr_profmaxnodes);
+	}
+	pr_profnodes[0].func = -1;
+	pr_profnodes[0].parent = -1;
+	pr_profnodes[0].child = -1;
+	pr_profnodes[0].next = -1;
+	pr_profnodes[0].calls = 0;
+	pr_profnodes[0].total = pr_profnodes[0].self = 0;
+	pr_profnumnodes = 1;
+	pr_profstack[0].node = 0;
+	pr_profstack[0].callees = 0;
+	pr_profdepth = 0;
+	pr_profskipped = 0;
+	pr_proftime = 0;
+
+	pr_profiling = true;
+	pr_profstart = realtime;
+	pr_profend = (Cmd_Argc() > 1) ? realtime + Q_atof (Cmd_Argv(1)) : 0;
+	if (pr_profend)
+		Con_Printf ("profiling QuakeC for %g seconds\n", pr_profend - realtime);
+	else
+		Con_Printf ("profiling QuakeC, profile_stop to finish\n");
+}
+
+/*
+============
+PR_ProfileStop_f
+============
+*/
+void PR_ProfileStop_f (void)
+{
+	if (!pr_profiling)
+		Con_Printf ("not profiling, see profile_start\n");
+	PR_ProfileStop ();
+}
+
+static double	*pr_profsort;
+
+static int PR_ProfileCompare (const void *a, const void *b)
+{
+	double	ta = pr_profsort[*(const int *)a];
+	double	tb = pr_profsort[*(const int *)b];
+
+	return (ta < tb) - (ta > tb);
+}
+
+/*
+============
+PR_ProfileSum
+
+Adds up the nodes under n by function.  A recursive function only adds
+the total of its outermost call, so it isn't counted twice.
+============
+*/
+static void PR_ProfileSum (int n, int *calls, double *total, double *self, int *active)
+{
+	prprofnode_t	*node;
+	int		i;
+
+	node = &pr_profnodes[n];
+	calls[node->func] += node->calls;
+	self[node->func] += node->self;
+	if (!active[node->func]++)
+		total[node->func] += node->total;
+	for (i = node->child; i >= 0; i = pr_profnodes[i].next)
+		PR_ProfileSum (i, calls, total, self, active);
+	active[node->func]--;
+}
+
+/*
+============
+PR_ProfileList
+============
+*/
+static void PR_ProfileList (const char *title, int *order, int *calls, double *total, double *self, int count)
+{
+	dfunction_t	*f;
+	int		i, num;
+
+	Con_Printf ("%s\n  calls   total ms    self ms  function\n", title);
+	for (i = 0, num = 0; i < progs->numfunctions && num < count; i++)
+	{
+		if (!calls[order[i]])
+			continue;
+		f = &pr_functions[order[i]];
+		Con_Printf ("%7i %10.2f %10.2f  %s%s\n", calls[order[i]], total[order[i]] * 1000.0,
+				self[order[i]] * 1000.0, PR_GetString(f->s_name), (f->first_statement < 0) ? " (builtin)" : "");
+		num++;
+	}
+}
+
+/*
+============
+PR_ProfileTop_f
+
+profile_top [count] ranks the functions by their own time.
+profile_top <function> lists what calls it and what it calls.
+============
+*/
+void PR_ProfileTop_f (void)
+{
+	const char	*name;
+	prprofnode_t	*node;
+	int		*calls, *order, *active;
+	double		*total, *self;
+	int		i, j, func, count, numfuncs, mark;
+
+	if (!pr_profnumnodes || !progs)
+	{
+		Con_Printf ("nothing profiled, see profile_start\n");
+		return;
+	}
+
+	numfuncs = progs->numfunctions;
+	mark = Scratch_Mark ();
+	calls = (int *) Scratch_Alloc (numfuncs * 3 * sizeof(int));
+	order = calls + numfuncs;
+	active = order + numfuncs;
+	total = (double *) Scratch_Alloc (numfuncs * 2 * sizeof(double));
+	self = total + numfuncs;
+	memset (calls, 0, numfuncs * 3 * sizeof(int));
+	memset (total, 0, numfuncs * 2 * sizeof(double));
+	for (i = 0; i < numfuncs; i++)
+		order[i] = i;
+
+	name = (Cmd_Argc() > 1) ? Cmd_Argv(1) : "";
+	if (*name && !q_isdigit (*name))
+	{
+		for (func = 0; func < numfuncs; func++)
+		{
+			if (!strcmp (PR_GetString(pr_functions[func].s_name), name))
+				break;
+		}
+		if (func == numfuncs)
+		{
+			Con_Printf ("no function %s\n", name);
+			Scratch_FreeToMark (mark);
+			return;
+		}
+
+		// callers: the nodes of func, by their parent's function
+		for (i = 1, node = pr_profnodes + 1; i < pr_profnumnodes; i++, node++)
+		{
+			if (node->func != func || !node->parent)
+				continue;
+			j = pr_profnodes[node->parent].func;
+			calls[j] += node->calls;
+			total[j] += node->total;
+			self[j] += node->self;
+		}
+		pr_profsort = total;
+		qsort (order, numfuncs, sizeof(int), PR_ProfileCompare);
+		PR_ProfileList (va("callers of %s:", name), order, calls, total, self, numfuncs);
+
+		// callees: the children of the nodes of func
+		memset (calls, 0, numfuncs * sizeof(int));
+		memset (total, 0, numfuncs * 2 * sizeof(double));
+		for (i = 0; i < numfuncs; i++)
+			order[i] = i;
+		for (i = 1, node = pr_profnodes + 1; i < pr_profnumnodes; i++, node++)
+		{
+			if (!node->parent || pr_profnodes[node->parent].func != func)
+				continue;
+			calls[node->func] += node->calls;
+			total[node->func] += node->total;
+			self[node->func] += node->self;
+		}
+		qsort (order, numfuncs, sizeof(int), PR_ProfileCompare);
+		PR_ProfileList (va("called by %s:", name), order, calls, total, self, numfuncs);
+		Scratch_FreeToMark (mark);
+		return;
+	}
+
+	count = *name ? Q_atoi (name) : 20;
+	for (i = pr_profnodes[0].child; i >= 0; i = pr_profnodes[i].next)
+		PR_ProfileSum (i, calls, total, self, active);
+	pr_profsort = self;
+	qsort (order, numfuncs, sizeof(int), PR_ProfileCompare);
+	PR_ProfileList (va("%.2f ms in QuakeC over %.1f seconds%s:", pr_proftime * 1000.0,
+			(pr_profiling ? realtime : pr_profstop) - pr_profstart,
+			pr_profiling ? ", still profiling" : ""), order, calls, total, self, count);
+	Scratch_FreeToMark (mark);
+}
+
+/*
+============
+PR_ProfileDump_f
+
+Writes one line per call path, the function names from the outermost in,
+separated by semicolons, followed by the time spent in the last one in
+microseconds
+============
+*/
+void PR_ProfileDump_f (void)
+{
+	char		name[MAX_OSPATH];
+	FILE		*f;
+	prprofnode_t	*node;
+	int		path[PROFILE_MAXDEPTH];
+	int		i, j, depth, lines;
+
+	if (Cmd_Argc() < 2)
+	{
+		Con_Printf ("usage: profile_dump <name>\n");
+		return;
+	}
+	if (!pr_profnumnodes || !progs)
+	{
+		Con_Printf ("nothing profiled, see profile_start\n");
+		return;
+	}
+
+	q_snprintf (name, sizeof(name), "%s/%s", com_gamedir, Cmd_Argv(1));
+	if (!*COM_FileGetExtension(name))
+		COM_AddExtension (name, ".txt", sizeof(name));
+	COM_CreatePath (name);
+	f = fopen (name, "w");
+	if (!f)
+	{
+		Con_Printf ("ERROR: couldn't open file %s.\n", name);
+		return;
+	}
+
+	for (i = 1, node = pr_profnodes + 1, lines = 0; i < pr_profnumnodes; i++, node++)
+	{
+		if (node->self < 0.0000005)
+			continue;
+		for (j = i, depth = 0; j > 0 && depth < PROFILE_MAXDEPTH; j = pr_profnodes[j].parent)
+			path[depth++] = j;
+		while (depth--)
+			fprintf (f, "%s%c", PR_GetString(pr_functions[pr_profnodes[path[depth]].func].s_name), depth ? ';' : ' ');
+		fprintf (f, "%.0f\n", node->self * 1000000.0);
+		lines++;
+	}
+	fclose (f);
+	Con_Printf ("wrote %i call paths to %s\n", lines, name);
+}
+
+/*
+============
+PR_RunError
+
+Aborts the currently executing function
+============
+*/
+void PR_RunError (const char *error, ...)
+{
+	va_list	argptr;
+	char	string[1024];
+
+#ifdef PR_JIT
+	if (pr_jitverifying)	// the native run will report it
+		longjmp (pr_jitverifyabort, 1);
+#endif
+
+	va_start (argptr, error);
+	q_vsnprintf (string, sizeof(string), error, argptr);
+	va_end (argptr);
+
+	PR_PrintStatement(pr_statements + pr_xstatement);
+	PR_StackTrace();
+
+	Con_Printf("%s\n", string);
+
+	pr_depth = 0;	// dump the stack so host_error can shutdown functions
+
+	Host_Error("Program error");
+}
+
+/*
+====================
+PR_EnterFunction
+
+Returns the new program statement counter
+====================
+*/
+static int PR_EnterFunction (dfunction_t *f)
+{
+	int	i, j, c, o;
+
+	pr_stack[pr_depth].s = pr_xstatement;
+	pr_stack[pr_depth].f = pr_xfunction;
+	pr_depth++;
+	if (pr_depth >= MAX_STACK_DEPTH)
+		PR_RunError("stack overflow");
+
+	// save off any locals that the new function steps on
+	c = f->locals;
+	if (localstack_used + c > LOCALSTACK_SIZE)
+		PR_RunError("PR_ExecuteProgram: locals stack overflow\n");
+
+	for (i = 0; i < c ; i++)
+		localstack[localstack_used + i] = ((int *)pr_globals)[f->parm_start + i];
+	localstack_used += c;
+
+	// copy parameters
+	o = f->parm_start;
+	for (i = 0; i < f->numparms; i++)
+	{
+		for (j = 0; j < f->parm_size[i]; j++)
+		{
+			((int *)pr_globals)[o] = ((int *)pr_globals)[OFS_PARM0 + i*3 + j];
+			o++;
+		}
+	}
+
+	if (pr_profiling)
+		PR_ProfileEnter (f);
+
+	pr_xfunction = f;
+	return f->first_statement - 1;	// offset the s++
+}
+
+/*
+====================
+PR_LeaveFunction
+====================
+*/
+static int PR_LeaveFunction (void)
+{
+	int	i, c;
+
+	if (pr_depth <= 0)
+		Host_Error("prog stack underflow");
+
+	// Restore locals from the stack
+	c = pr_xfunction->locals;
+	localstack_used -= c;
+	if (localstack_used < 0)
+		PR_RunError("PR_ExecuteProgram: locals stack underflow");
+
+	for (i = 0; i < c; i++)
+		((int *)pr_globals)[pr_xfunction->parm_start + i] = localstack[localstack_used + i];
+
+	if (pr_profiling)
+		PR_ProfileLeave ();
+
+	// up stack
+	pr_depth--;
+	pr_xfunction = pr_stack[pr_depth].f;
+	return pr_stack[pr_depth].s;
+}
+
+
+/*
+==============================================================================
+
+DECODED PROGRAMS
+
+PR_DecodeProgs translates pr_statements at load time into prdecoded_t,
+with the operands resolved to global pointers and, when the compiler
+supports computed goto, the address of the handler for each opcode. Ops
+that share an implementation are folded together (the CALLs keep their
+argument count in branch), so the interpreter needs one handler apiece.
+
+The runaway check and the pr_trace test are merged into a single
+comparison per statement: profilelimit is dropped to zero while tracing,
+which sends every statement through the slow path. pr_trace can only
+change while a builtin runs, so the limit is recomputed after each one.
+Selected with the pr_threaded cvar.
+==============================================================================
+*/
+
+#if defined(__GNUC__)
+#define PR_COMPUTED_GOTO
+#endif
+
+#define	PR_RUNAWAY	100000
+#define	PR_BADOP	(OP_BITOR + 1)	/* handler slot for bad opcodes */
+
+typedef struct
+{
+	const void	*handler;	/* computed goto label */
+	eval_t		*a, *b, *c;
+	int		op;		/* folded opcode */
+	int		branch;		/* IF/IFNOT/GOTO offset, CALL argc */
+} prdecoded_t;
+
+/* statement counts for the current PR_ExecuteProgram, shared between
+ * PR_RunDecoded and native code so either can pick up where the other
+ * left off */
+typedef struct
+{
+	int		profile;
+	int		startprofile;
+	int		profilelimit;	/* only kept up to date for native code */
+} prcount_t;
+
+cvar_t		pr_threaded = {"pr_threaded", "1", CVAR_NONE};
+
+static prdecoded_t	*pr_decoded;
+static prcount_t	pr_count;
+#ifdef PR_COMPUTED_GOTO
+static const void	*pr_handlers[PR_BADOP + 1];
+#endif
+
+static void PR_RunDecoded (int s, int exitdepth);
+#ifdef PR_JIT
+static void PR_JitInit (void);
+#endif
+
+/*
+====================
+PR_DecodeProgs
+
+Called by PR_LoadProgs once the statements have been byte swapped
+====================
+*/
+void PR_DecodeProgs (void)
+{
+	dstatement_t	*st;
+	prdecoded_t	*d;
+	int		i, op;
+
+#ifdef PR_COMPUTED_GOTO
+	if (!pr_handlers[PR_BADOP])
+		PR_RunDecoded (0, -1);	/* fill in the label addresses */
+#endif
+
+	pr_decoded = (prdecoded_t *) Hunk_AllocName (progs->numstatements * sizeof(prdecoded_t), "progdec");
+#ifdef PR_JIT
+	PR_JitInit ();
+#endif
+	PR_ProfileClear ();
+
+	for (i = 0, st = pr_statements, d = pr_decoded; i < progs->numstatements; i++, st++, d++)
+	{
+		op = st->op;
+		d->a = (eval_t *)&pr_globals[(unsigned short)st->a];
+		d->b = (eval_t *)&pr_globals[(unsigned short)st->b];
+		d->c = (eval_t *)&pr_globals[(unsigned short)st->c];
+		d->branch = 0;
+
+		switch (op)
+		{
+		case OP_IF:
+		case OP_IFNOT:
+			d->branch = st->b;
+			break;
+		case OP_GOTO:
+			d->branch = st->a;
+			break;
+
+		case OP_EQ_FNC:
+			op = OP_EQ_E;
+			break;
+		case OP_NE_FNC:
+			op = OP_NE_E;
+			break;
+
+		case OP_LOAD_FLD:
+		case OP_LOAD_ENT:
+		case OP_LOAD_S:
+		case OP_LOAD_FNC:
+			op = OP_LOAD_F;
+			break;
+
+		case OP_STORE_ENT:
+		case OP_STORE_FLD:
+		case OP_STORE_S:
+		case OP_STORE_FNC:
+			op = OP_STORE_F;
+			break;
+
+		case OP_STOREP_ENT:
+		case OP_STOREP_FLD:
+		case OP_STOREP_S:
+		case OP_STOREP_FNC:
+			op = OP_STOREP_F;
+			break;
+
+		case OP_CALL1:
+		case OP_CALL2:
+		case OP_CALL3:
+		case OP_CALL4:
+		case OP_CALL5:
+		case OP_CALL6:
+		case OP_CALL7:
+		case OP_CALL8:
+			d->branch = op - OP_CALL0;
+			op = OP_CALL0;
+			break;
+
+		case OP_DONE:
+			op = OP_RETURN;
+			break;
+
+		default:
+			if (op > OP_BITOR)
+				op = PR_BADOP;
+			break;
+		}
+
+		d->op = op;
+#ifdef PR_COMPUTED_GOTO
+		d->handler = pr_handlers[op];
+#else
+		d->handler = NULL;
+#endif
+	}
+}
+
+/*
+====================
+PR_RunDecoded
+
+The interpretation main loop for decoded programs. Starts after statement
+s and runs until the stack is back down to exitdepth, taking its counts
+from pr_count. With computed goto each handler jumps straight to the next
+one; otherwise the handlers are the cases of a switch.
+====================
+*/
+#ifdef PR_COMPUTED_GOTO
+#define OPCODE(op)	lbl_##op
+#define DEFAULTOP	lbl_PR_BADOP
+#define JUMP()		goto *d->handler
+#else
+#define OPCODE(op)	case op
+#define DEFAULTOP	default
+#define JUMP()		goto dispatch
+#endif
+
+#define NEXT()						\
+	do {						\
+		d++;					\
+		if (++profile > profilelimit)		\
+			goto slowpath;			\
+		JUMP();					\
+	} while (0)
+
+static void PR_RunDecoded (int s, int exitdepth)
+{
+	prdecoded_t	*d;
+	eval_t		*ptr;
+	dfunction_t	*newf;
+	edict_t		*ed;
+	int		profile, startprofile, profilelimit;
+	int		i;
+
+#ifdef PR_COMPUTED_GOTO
+	if (exitdepth < 0)
+	{
+		for (i = 0; i <= PR_BADOP; i++)
+			pr_handlers[i] = &&lbl_PR_BADOP;
+		pr_handlers[OP_ADD_F] = &&lbl_OP_ADD_F;
+		pr_handlers[OP_ADD_V] = &&lbl_OP_ADD_V;
+		pr_handlers[OP_SUB_F] = &&lbl_OP_SUB_F;
+		pr_handlers[OP_SUB_V] = &&lbl_OP_SUB_V;
+		pr_handlers[OP_MUL_F] = &&lbl_OP_MUL_F;
+		pr_handlers[OP_MUL_V] = &&lbl_OP_MUL_V;
+		pr_handlers[OP_MUL_FV] = &&lbl_OP_MUL_FV;
+		pr_handlers[OP_MUL_VF] = &&lbl_OP_MUL_VF;
+		pr_handlers[OP_DIV_F] = &&lbl_OP_DIV_F;
+		pr_handlers[OP_BITAND] = &&lbl_OP_BITAND;
+		pr_handlers[OP_BITOR] = &&lbl_OP_BITOR;
+		pr_handlers[OP_GE] = &&lbl_OP_GE;
+		pr_handlers[OP_LE] = &&lbl_OP_LE;
+		pr_handlers[OP_GT] = &&lbl_OP_GT;
+		pr_handlers[OP_LT] = &&lbl_OP_LT;
+		pr_handlers[OP_AND] = &&lbl_OP_AND;
+		pr_handlers[OP_OR] = &&lbl_OP_OR;
+		pr_handlers[OP_NOT_F] = &&lbl_OP_NOT_F;
+		pr_handlers[OP_NOT_V] = &&lbl_OP_NOT_V;
+		pr_handlers[OP_NOT_S] = &&lbl_OP_NOT_S;
+		pr_handlers[OP_NOT_FNC] = &&lbl_OP_NOT_FNC;
+		pr_handlers[OP_NOT_ENT] = &&lbl_OP_NOT_ENT;
+		pr_handlers[OP_EQ_F] = &&lbl_OP_EQ_F;
+		pr_handlers[OP_EQ_V] = &&lbl_OP_EQ_V;
+		pr_handlers[OP_EQ_S] = &&lbl_OP_EQ_S;
+		pr_handlers[OP_EQ_E] = &&lbl_OP_EQ_E;
+		pr_handlers[OP_NE_F] = &&lbl_OP_NE_F;
+		pr_handlers[OP_NE_V] = &&lbl_OP_NE_V;
+		pr_handlers[OP_NE_S] = &&lbl_OP_NE_S;
+		pr_handlers[OP_NE_E] = &&lbl_OP_NE_E;
+		pr_handlers[OP_STORE_F] = &&lbl_OP_STORE_F;
+		pr_handlers[OP_STORE_V] = &&lbl_OP_STORE_V;
+		pr_handlers[OP_STOREP_F] = &&lbl_OP_STOREP_F;
+		pr_handlers[OP_STOREP_V] = &&lbl_OP_STOREP_V;
+		pr_handlers[OP_ADDRESS] = &&lbl_OP_ADDRESS;
+		pr_handlers[OP_LOAD_F] = &&lbl_OP_LOAD_F;
+		pr_handlers[OP_LOAD_V] = &&lbl_OP_LOAD_V;
+		pr_handlers[OP_IFNOT] = &&lbl_OP_IFNOT;
+		pr_handlers[OP_IF] = &&lbl_OP_IF;
+		pr_handlers[OP_GOTO] = &&lbl_OP_GOTO;
+		pr_handlers[OP_CALL0] = &&lbl_OP_CALL0;
+		pr_handlers[OP_RETURN] = &&lbl_OP_RETURN;
+		pr_handlers[OP_STATE] = &&lbl_OP_STATE;
+		return;
+	}
+#endif
+
+	d = &pr_decoded[s];
+	profile = pr_count.profile;
+	startprofile = pr_count.startprofile;
+	profilelimit = pr_trace ? 0 : PR_RUNAWAY;
+	NEXT ();
+
+slowpath:
+	if (profile > PR_RUNAWAY)
+	{
+		pr_xstatement = d - pr_decoded;
+		PR_RunError("runaway loop error");
+	}
+	PR_PrintStatement(&pr_statements[d - pr_decoded]);
+#ifdef PR_COMPUTED_GOTO
+	JUMP();
+#else
+dispatch:
+	switch (d->op)
+	{
+#endif
+
+	OPCODE(OP_ADD_F):
+		d->c->_float = d->a->_float + d->b->_float;
+		NEXT ();
+	OPCODE(OP_ADD_V):
+		d->c->vector[0] = d->a->vector[0] + d->b->vector[0];
+		d->c->vector[1] = d->a->vector[1] + d->b->vector[1];
+		d->c->vector[2] = d->a->vector[2] + d->b->vector[2];
+		NEXT ();
+
+	OPCODE(OP_SUB_F):
+		d->c->_float = d->a->_float - d->b->_float;
+		NEXT ();
+	OPCODE(OP_SUB_V):
+		d->c->vector[0] = d->a->vector[0] - d->b->vector[0];
+		d->c->vector[1] = d->a->vector[1] - d->b->vector[1];
+		d->c->vector[2] = d->a->vector[2] - d->b->vector[2];
+		NEXT ();
+
+	OPCODE(OP_MUL_F):
+		d->c->_float = d->a->_float * d->b->_float;
+		NEXT ();
+	OPCODE(OP_MUL_V):
+		d->c->_float = d->a->vector[0] * d->b->vector[0] +
+			       d->a->vector[1] * d->b->vector[1] +
+			       d->a->vector[2] * d->b->vector[2];
+		NEXT ();
+	OPCODE(OP_MUL_FV):
+		d->c->vector[0] = d->a->_float * d->b->vector[0];
+		d->c->vector[1] = d->a->_float * d->b->vector[1];
+		d->c->vector[2] = d->a->_float * d->b->vector[2];
+		NEXT ();
+	OPCODE(OP_MUL_VF):
+		d->c->vector[0] = d->b->_float * d->a->vector[0];
+		d->c->vector[1] = d->b->_float * d->a->vector[1];
+		d->c->vector[2] = d->b->_float * d->a->vector[2];
+		NEXT ();
+
+	OPCODE(OP_DIV_F):
+		d->c->_float = d->a->_float / d->b->_float;
+		NEXT ();
+
+	OPCODE(OP_BITAND):
+		d->c->_float = (int)d->a->_float & (int)d->b->_float;
+		NEXT ();
+	OPCODE(OP_BITOR):
+		d->c->_float = (int)d->a->_float | (int)d->b->_float;
+		NEXT ();
+
+	OPCODE(OP_GE):
+		d->c->_float = d->a->_float >= d->b->_float;
+		NEXT ();
+	OPCODE(OP_LE):
+		d->c->_float = d->a->_float <= d->b->_float;
+		NEXT ();
+	OPCODE(OP_GT):
+		d->c->_float = d->a->_float > d->b->_float;
+		NEXT ();
+	OPCODE(OP_LT):
+		d->c->_float = d->a->_float < d->b->_float;
+		NEXT ();
+	OPCODE(OP_AND):
+		d->c->_float = d->a->_float && d->b->_float;
+		NEXT ();
+	OPCODE(OP_OR):
+		d->c->_float = d->a->_float || d->b->_float;
+		NEXT ();
+
+	OPCODE(OP_NOT_F):
+		d->c->_float = !d->a->_float;
+		NEXT ();
+	OPCODE(OP_NOT_V):
+		d->c->_float = !d->a->vector[0] && !d->a->vector[1] && !d->a->vector[2];
+		NEXT ();
+	OPCODE(OP_NOT_S):
+		d->c->_float = !d->a->string || !*PR_GetString(d->a->string);
+		NEXT ();
+	OPCODE(OP_NOT_FNC):
+		d->c->_float = !d->a->function;
+		NEXT ();
+	OPCODE(OP_NOT_ENT):
+		d->c->_float = (PROG_TO_EDICT(d->a->edict) == sv.edicts);
+		NEXT ();
+
+	OPCODE(OP_EQ_F):
+		d->c->_float = d->a->_float == d->b->_float;
+		NEXT ();
+	OPCODE(OP_EQ_V):
+		d->c->_float = (d->a->vector[0] == d->b->vector[0]) &&
+			       (d->a->vector[1] == d->b->vector[1]) &&
+			       (d->a->vector[2] == d->b->vector[2]);
+		NEXT ();
+	OPCODE(OP_EQ_S):
+		d->c->_float = !strcmp(PR_GetString(d->a->string), PR_GetString(d->b->string));
+		NEXT ();
+	OPCODE(OP_EQ_E):	/* and EQ_FNC */
+		d->c->_float = d->a->_int == d->b->_int;
+		NEXT ();
+
+	OPCODE(OP_NE_F):
+		d->c->_float = d->a->_float != d->b->_float;
+		NEXT ();
+	OPCODE(OP_NE_V):
+		d->c->_float = (d->a->vector[0] != d->b->vector[0]) ||
+			       (d->a->vector[1] != d->b->vector[1]) ||
+			       (d->a->vector[2] != d->b->vector[2]);
+		NEXT ();
+	OPCODE(OP_NE_S):
+		d->c->_float = strcmp(PR_GetString(d->a->string), PR_GetString(d->b->string));
+		NEXT ();
+	OPCODE(OP_NE_E):	/* and NE_FNC */
+		d->c->_float = d->a->_int != d->b->_int;
+		NEXT ();
+
+	OPCODE(OP_STORE_F):	/* all the integer and pointer stores */
+		d->b->_int = d->a->_int;
+		NEXT ();
+	OPCODE(OP_STORE_V):
+		d->b->vector[0] = d->a->vector[0];
+		d->b->vector[1] = d->a->vector[1];
+		d->b->vector[2] = d->a->vector[2];
+		NEXT ();
+
+	OPCODE(OP_STOREP_F):	/* all the integer and pointer stores */
+		ptr = (eval_t *)((byte *)sv.edicts + d->b->_int);
+		ptr->_int = d->a->_int;
+		NEXT ();
+	OPCODE(OP_STOREP_V):
+		ptr = (eval_t *)((byte *)sv.edicts + d->b->_int);
+		ptr->vector[0] = d->a->vector[0];
+		ptr->vector[1] = d->a->vector[1];
+		ptr->vector[2] = d->a->vector[2];
+		NEXT ();
+
+	OPCODE(OP_ADDRESS):
+		ed = PROG_TO_EDICT(d->a->edict);
+#ifdef PARANOID
+		NUM_FOR_EDICT(ed);	// Make sure it's in range
+#endif
+		if (ed == (edict_t *)sv.edicts && sv.state == ss_active)
+		{
+			pr_xstatement = d - pr_decoded;
+			PR_RunError("assignment to world entity");
+		}
+		d->c->_int = (byte *)((int *)&ed->v + d->b->_int) - (byte *)sv.edicts;
+		NEXT ();
+
+	OPCODE(OP_LOAD_F):	/* all the integer and pointer loads */
+		ed = PROG_TO_EDICT(d->a->edict);
+#ifdef PARANOID
+		NUM_FOR_EDICT(ed);	// Make sure it's in range
+#endif
+		d->c->_int = ((eval_t *)((int *)&ed->v + d->b->_int))->_int;
+		NEXT ();
+	OPCODE(OP_LOAD_V):
+		ed = PROG_TO_EDICT(d->a->edict);
+#ifdef PARANOID
+		NUM_FOR_EDICT(ed);	// Make sure it's in range
+#endif
+		ptr = (eval_t *)((int *)&ed->v + d->b->_int);
+		d->c->vector[0] = ptr->vector[0];
+		d->c->vector[1] = ptr->vector[1];
+		d->c->vector[2] = ptr->vector[2];
+		NEXT ();
+
+	OPCODE(OP_IFNOT):
+		if (!d->a->_int)
+			d += d->branch - 1;	/* -1 to offset the d++ */
+		NEXT ();
+	OPCODE(OP_IF):
+		if (d->a->_int)
+			d += d->branch - 1;	/* -1 to offset the d++ */
+		NEXT ();
+	OPCODE(OP_GOTO):
+		d += d->branch - 1;		/* -1 to offset the d++ */
+		NEXT ();
+
+	OPCODE(OP_CALL0):	/* all the CALLs, argc in branch */
+		pr_xfunction->profile += profile - startprofile;
+		startprofile = profile;
+		pr_xstatement = d - pr_decoded;
+		pr_argc = d->branch;
+		if (!d->a->function)
+			PR_RunError("NULL function");
+		newf = &pr_functions[d->a->function];
+		if (newf->first_statement < 0)
+		{ // Built-in function
+			i = -newf->first_statement;
+			if (i >= pr_numbuiltins)
+				PR_RunError("Bad builtin call number %d", i);
+			if (pr_profiling)
+				PR_ProfileBuiltin (newf, i);
+			else
+				pr_builtins[i]();
+			profilelimit = pr_trace ? 0 : PR_RUNAWAY;
+			NEXT ();
+		}
+		// Normal function
+		d = &pr_decoded[PR_EnterFunction(newf)];
+		NEXT ();
+
+	OPCODE(OP_RETURN):	/* and DONE */
+		pr_xfunction->profile += profile - startprofile;
+		startprofile = profile;
+		pr_xstatement = d - pr_decoded;
+		pr_globals[OFS_RETURN] = d->a->vector[0];
+		pr_globals[OFS_RETURN + 1] = d->a->vector[1];
+		pr_globals[OFS_RETURN + 2] = d->a->vector[2];
+		d = &pr_decoded[PR_LeaveFunction()];
+		if (pr_depth == exitdepth)
+		{ // Done
+			pr_count.profile = profile;
+			pr_count.startprofile = startprofile;
+			return;
+		}
+		NEXT ();
+
+	OPCODE(OP_STATE):
+		ed = PROG_TO_EDICT(pr_global_struct->self);
+		ed->v.nextthink = pr_global_struct->time + 0.1;
+		ed->v.frame = d->a->_float;
+		ed->v.think = d->b->function;
+		NEXT ();
+
+	DEFAULTOP:
+		pr_xstatement = d - pr_decoded;
+		PR_RunError("Bad opcode %i", pr_statements[pr_xstatement].op);
+
+#ifndef PR_COMPUTED_GOTO
+	}
+#endif
+}
+#undef OPCODE
+#undef DEFAULTOP
+#undef JUMP
+#undef NEXT
+
+/*
+==============================================================================
+
+NATIVE CODE
+
+On x86-64 unix, PR_JitCompile turns the body of a function into machine
+code the first time it's called with pr_jit 1. With pr_jit 2 it waits
+until the function's profile count passes PR_JIT_HOTCOUNT statements.
+Functions it can't handle are left to the decoded interpreter.
+
+Generated code keeps no QuakeC state in registers between statements.
+Each basic block adds its length to pr_count.profile on entry, and when
+that would pass pr_count.profilelimit the frame is handed over to
+PR_RunDecoded at the start of the block. So runaway loops and pr_trace
+come out exactly as they do in the interpreter. Calls, returns and the
+string and entity ops that need the engine go through C helpers that
+mirror the interpreter.
+
+With pr_jit_verify 1, each native frame is first run on the interpreter
+with the builtins stubbed out. The globals and edicts are then put back,
+the frame is run natively, and the two results are compared. Frames that
+call a builtin or hit an error can't be replayed, so they're skipped.
+==============================================================================
+*/
+
+cvar_t		pr_jit = {"pr_jit", "0", CVAR_NONE};
+cvar_t		pr_jit_verify = {"pr_jit_verify", "0", CVAR_NONE};
+
+#ifdef PR_JIT
+
+#define	PR_JIT_CODESIZE		(16 * 1024 * 1024)
+#define	PR_JIT_MAXOPSIZE	160	/* block check plus the longest statement */
+#define	PR_JIT_HOTCOUNT		10000
+
+#define	JIT_REACHED		1
+#define	JIT_LEADER		2
+
+#define	JIT_DEOPT		-1	/* fixup targets besides statements */
+#define	JIT_EPILOGUE		-2
+
+#define	JIT_EAX			0
+#define	JIT_ECX			1
+#define	JIT_EDX			2
+
+typedef void (*jitfunc_t) (void);
+
+typedef struct
+{
+	int		pos;		/* of the rel32 */
+	int		target;		/* statement in the function, or JIT_DEOPT etc */
+} jitfixup_t;
+
+static byte		*pr_jitcode;	/* reserved on first use, kept for good */
+static int		pr_jitcodeused;
+static jitfunc_t	*pr_jitfuncs;	/* per function, NULL until tried */
+
+static byte		*jit_out;
+
+static int		pr_jitverifydepth = -1;	/* frame being checked natively */
+static builtin_t	*pr_jitnobuiltins;
+static int		pr_jitnumnobuiltins;
+static byte		*pr_jitsnapshot;
+static int		pr_jitsnapshotsize;
+
+/* marks functions that failed to compile */
+static void PR_JitUnsupported (void)
+{
+}
+
+static void Jit_Byte (int b)
+{
+	*jit_out++ = b;
+}
+
+static void Jit_Int (int i)
+{
+	memcpy (jit_out, &i, 4);
+	jit_out += 4;
+}
+
+static void Jit_Pointer (const void *p)
+{
+	memcpy (jit_out, &p, sizeof(p));
+	jit_out += sizeof(p);
+}
+
+/* modrm for [rbx + ofs*4], rbx holds pr_globals */
+static void Jit_Global (int reg, int ofs)
+{
+	Jit_Byte (0x80 | (reg << 3) | 3);
+	Jit_Int (ofs * 4);
+}
+
+/* mov reg, [global] */
+static void Jit_Load (int reg, int ofs)
+{
+	Jit_Byte (0x8b);
+	Jit_Global (reg, ofs);
+}
+
+/* mov [global], reg */
+static void Jit_Store (int reg, int ofs)
+{
+	Jit_Byte (0x89);
+	Jit_Global (reg, ofs);
+}
+
+/* scalar single op xmm, [global]: 0x10 movss, 0x58 addss, 0x59 mulss,
+ * 0x5c subss, 0x5e divss, 0x11 movss the other way */
+static void Jit_FloatOp (int op, int xmm, int ofs)
+{
+	Jit_Byte (0xf3);
+	Jit_Byte (0x0f);
+	Jit_Byte (op);
+	Jit_Global (xmm, ofs);
+}
+
+/* ucomiss xmm, [global] */
+static void Jit_FloatCompare (int xmm, int ofs)
+{
+	Jit_Byte (0x0f);
+	Jit_Byte (0x2e);
+	Jit_Global (xmm, ofs);
+}
+
+/* setcc reg8 */
+static void Jit_SetCC (int cc, int reg)
+{
+	Jit_Byte (0x0f);
+	Jit_Byte (0x90 | cc);
+	Jit_Byte (0xc0 | reg);
+}
+
+#define	CC_P	0xa
+#define	CC_NP	0xb
+#define	CC_E	0x4
+#define	CC_NE	0x5
+#define	CC_AE	0x3
+#define	CC_A	0x7
+
+/* al = a == b, false when either is a NaN */
+static void Jit_FloatEqual (int a, int b)
+{
+	Jit_FloatOp (0x10, 0, a);
+	Jit_FloatCompare (0, b);
+	Jit_SetCC (CC_E, JIT_EAX);
+	Jit_SetCC (CC_NP, JIT_ECX);
+	Jit_Byte (0x20); Jit_Byte (0xc8);	/* and al, cl */
+}
+
+/* al = a != b, true when either is a NaN */
+static void Jit_FloatNotEqual (int a, int b)
+{
+	Jit_FloatOp (0x10, 0, a);
+	Jit_FloatCompare (0, b);
+	Jit_SetCC (CC_NE, JIT_EAX);
+	Jit_SetCC (CC_P, JIT_ECX);
+	Jit_Byte (0x08); Jit_Byte (0xc8);	/* or al, cl */
+}
+
+/* al = a == 0 */
+static void Jit_FloatIsZero (int a)
+{
+	Jit_Byte (0x0f); Jit_Byte (0x57); Jit_Byte (0xc9);	/* xorps xmm1, xmm1 */
+	Jit_FloatCompare (1, a);
+	Jit_SetCC (CC_E, JIT_EAX);
+	Jit_SetCC (CC_NP, JIT_ECX);
+	Jit_Byte (0x20); Jit_Byte (0xc8);	/* and al, cl */
+}
+
+/* al = a != 0 */
+static void Jit_FloatNotZero (int a)
+{
+	Jit_Byte (0x0f); Jit_Byte (0x57); Jit_Byte (0xc9);	/* xorps xmm1, xmm1 */
+	Jit_FloatCompare (1, a);
+	Jit_SetCC (CC_NE, JIT_EAX);
+	Jit_SetCC (CC_P, JIT_ECX);
+	Jit_Byte (0x08); Jit_Byte (0xc8);	/* or al, cl */
+}
+
+/* global = (float)al */
+static void Jit_StoreBool (int c)
+{
+	Jit_Byte (0x0f); Jit_Byte (0xb6); Jit_Byte (0xc0);		/* movzx eax, al */
+	Jit_Byte (0xf3); Jit_Byte (0x0f); Jit_Byte (0x2a); Jit_Byte (0xc0);	/* cvtsi2ss xmm0, eax */
+	Jit_FloatOp (0x11, 0, c);
+}
+
+/* rax = sv.edicts + global, r13 holds &sv.edicts */
+static void Jit_EdictAddress (int ofs)
+{
+	Jit_Byte (0x48); Jit_Byte (0x63);	/* movsxd rax, [global] */
+	Jit_Global (JIT_EAX, ofs);
+	Jit_Byte (0x49); Jit_Byte (0x03); Jit_Byte (0x45); Jit_Byte (0x00);	/* add rax, [r13] */
+}
+
+/* mov edi, arg; mov rax, func; call rax */
+static void Jit_Call (void (*func) (int), int arg)
+{
+	Jit_Byte (0xbf);
+	Jit_Int (arg);
+	Jit_Byte (0x48); Jit_Byte (0xb8);
+	Jit_Pointer ((const void *)func);
+	Jit_Byte (0xff); Jit_Byte (0xd0);
+}
+
+/* jmp or jcc rel32 to a statement or label, patched once the code is laid out */
+static void Jit_Jump (int cc, int target, jitfixup_t *fixups, int *numfixups, byte *start)
+{
+	if (cc < 0)
+		Jit_Byte (0xe9);
+	else
+	{
+		Jit_Byte (0x0f);
+		Jit_Byte (0x80 | cc);
+	}
+	fixups[*numfixups].pos = jit_out - start;
+	fixups[*numfixups].target = target;
+	(*numfixups)++;
+	Jit_Int (0);
+}
+
+/*
+====================
+PR_JitResume
+
+Native code that has run out of budget for a block lets the interpreter
+finish the frame from there
+====================
+*/
+static void PR_JitResume (int s)
+{
+	PR_RunDecoded (s - 1, pr_depth - 1);
+}
+
+/*
+====================
+PR_JitOp
+
+The ops that native code leaves to C
+====================
+*/
+static void PR_JitOp (int s)
+{
+	dstatement_t	*st;
+	eval_t		*a, *b, *c;
+	edict_t		*ed;
+
+	st = &pr_statements[s];
+	a = (eval_t *)&pr_globals[(unsigned short)st->a];
+	b = (eval_t *)&pr_globals[(unsigned short)st->b];
+	c = (eval_t *)&pr_globals[(unsigned short)st->c];
+
+	switch (st->op)
+	{
+	case OP_NOT_S:
+		c->_float = !a->string || !*PR_GetString(a->string);
+		break;
+	case OP_EQ_S:
+		c->_float = !strcmp(PR_GetString(a->string), PR_GetString(b->string));
+		break;
+	case OP_NE_S:
+		c->_float = strcmp(PR_GetString(a->string), PR_GetString(b->string));
+		break;
+
+	case OP_ADDRESS:
+		ed = PROG_TO_EDICT(a->edict);
+#ifdef PARANOID
+		NUM_FOR_EDICT(ed);	// Make sure it's in range
+#endif
+		if (ed == (edict_t *)sv.edicts && sv.state == ss_active)
+		{
+			pr_xstatement = s;
+			PR_RunError("assignment to world entity");
+		}
+		c->_int = (byte *)((int *)&ed->v + b->_int) - (byte *)sv.edicts;
+		break;
+
+	case OP_STATE:
+		ed = PROG_TO_EDICT(pr_global_struct->self);
+		ed->v.nextthink = pr_global_struct->time + 0.1;
+		ed->v.frame = a->_float;
+		ed->v.think = b->function;
+		break;
+	}
+}
+
+static void PR_JitFrame (dfunction_t *f);
+
+/*
+====================
+PR_JitCall
+====================
+*/
+static void PR_JitCall (int s)
+{
+	dstatement_t	*st;
+	dfunction_t	*newf;
+	func_t		fnum;
+	int		i;
+
+	st = &pr_statements[s];
+	fnum = ((eval_t *)&pr_globals[(unsigned short)st->a])->function;
+
+	pr_xfunction->profile += pr_count.profile - pr_count.startprofile;
+	pr_count.startprofile = pr_count.profile;
+	pr_xstatement = s;
+	pr_argc = st->op - OP_CALL0;
+	if (!fnum)
+		PR_RunError("NULL function");
+	newf = &pr_functions[fnum];
+	if (newf->first_statement < 0)
+	{ // Built-in function
+		i = -newf->first_statement;
+		if (i >= pr_numbuiltins)
+			PR_RunError("Bad builtin call number %d", i);
+		if (pr_profiling)
+			PR_ProfileBuiltin (newf, i);
+		else
+			pr_builtins[i]();
+	}
+	else
+		PR_JitFrame (newf);
+
+	pr_count.profilelimit = pr_trace ? 0 : PR_RUNAWAY;
+}
+
+/*
+====================
+PR_JitReturn
+====================
+*/
+static void PR_JitReturn (int s)
+{
+	dstatement_t	*st;
+
+	st = &pr_statements[s];
+
+	pr_xfunction->profile += pr_count.profile - pr_count.startprofile;
+	pr_count.startprofile = pr_count.profile;
+	pr_xstatement = s;
+	pr_globals[OFS_RETURN] = pr_globals[(unsigned short)st->a];
+	pr_globals[OFS_RETURN + 1] = pr_globals[(unsigned short)st->a + 1];
+	pr_globals[OFS_RETURN + 2] = pr_globals[(unsigned short)st->a + 2];
+	PR_LeaveFunction ();
+}
+
+/*
+====================
+PR_JitScan
+
+Finds the statements reachable from the start of a function and the ones
+that begin basic blocks. Fails on anything the code generator doesn't
+know, and on branches that leave the function.
+====================
+*/
+static qboolean PR_JitScan (int first, int count, byte *flags, int *stack)
+{
+	dstatement_t	*st;
+	int		i, j, n, sp, next[2];
+	qboolean	leader;
+
+	memset (flags, 0, count);
+	flags[0] = JIT_REACHED | JIT_LEADER;
+	stack[0] = 0;
+	sp = 1;
+
+	while (sp)
+	{
+		i = stack[--sp];
+		st = &pr_statements[first + i];
+		n = 0;
+		leader = false;
+
+		switch (st->op)
+		{
+		case OP_IF:
+		case OP_IFNOT:
+			next[n++] = i + st->b;
+			next[n++] = i + 1;
+			leader = true;
+			break;
+		case OP_GOTO:
+			next[n++] = i + st->a;
+			leader = true;
+			break;
+		case OP_CALL0:
+		case OP_CALL1:
+		case OP_CALL2:
+		case OP_CALL3:
+		case OP_CALL4:
+		case OP_CALL5:
+		case OP_CALL6:
+		case OP_CALL7:
+		case OP_CALL8:
+			next[n++] = i + 1;
+			leader = true;
+			break;
+		case OP_DONE:
+		case OP_RETURN:
+			break;
+		default:
+			if (st->op > OP_BITOR)
+				return false;
+			next[n++] = i + 1;
+			break;
+		}
+
+		for (j = 0; j < n; j++)
+		{
+			if (next[j] < 0 || next[j] >= count)
+				return false;
+			if (leader)
+				flags[next[j]] |= JIT_LEADER;
+			if (!(flags[next[j]] & JIT_REACHED))
+			{
+				flags[next[j]] |= JIT_REACHED;
+				stack[sp++] = next[j];
+			}
+		}
+	}
+
+	return true;
+}
+
+/*
+====================
+PR_JitEnds
+
+True for statements that end a basic block
+====================
+*/
+static qboolean PR_JitEnds (int op)
+{
+	return op == OP_IF || op == OP_IFNOT || op == OP_GOTO ||
+		(op >= OP_CALL0 && op <= OP_CALL8) ||
+		op == OP_DONE || op == OP_RETURN;
+}
+
+/*
+====================
+PR_JitStatement
+
+Emits the code for one statement
+====================
+*/
+static void PR_JitStatement (int s, int i, jitfixup_t *fixups, int *numfixups, byte *start)
+{
+	dstatement_t	*st;
+	int		a, b, c, k;
+
+	st = &pr_statements[s];
+	a = (unsigned short)st->a;
+	b = (unsigned short)st->b;
+	c = (unsigned short)st->c;
+
+	switch (st->op)
+	{
+	case OP_ADD_F:
+	case OP_SUB_F:
+	case OP_MUL_F:
+	case OP_DIV_F:
+		Jit_FloatOp (0x10, 0, a);
+		Jit_FloatOp (st->op == OP_ADD_F ? 0x58 : st->op == OP_SUB_F ? 0x5c : st->op == OP_MUL_F ? 0x59 : 0x5e, 0, b);
+		Jit_FloatOp (0x11, 0, c);
+		break;
+	case OP_ADD_V:
+	case OP_SUB_V:
+		for (k = 0; k < 3; k++)
+		{
+			Jit_FloatOp (0x10, 0, a + k);
+			Jit_FloatOp (st->op == OP_ADD_V ? 0x58 : 0x5c, 0, b + k);
+			Jit_FloatOp (0x11, 0, c + k);
+		}
+		break;
+	case OP_MUL_V:
+		Jit_FloatOp (0x10, 0, a);
+		Jit_FloatOp (0x59, 0, b);
+		for (k = 1; k < 3; k++)
+		{
+			Jit_FloatOp (0x10, 1, a + k);
+			Jit_FloatOp (0x59, 1, b + k);
+			Jit_Byte (0xf3); Jit_Byte (0x0f); Jit_Byte (0x58); Jit_Byte (0xc1);	/* addss xmm0, xmm1 */
+		}
+		Jit_FloatOp (0x11, 0, c);
+		break;
+	case OP_MUL_FV:
+		for (k = 0; k < 3; k++)
+		{
+			Jit_FloatOp (0x10, 0, a);
+			Jit_FloatOp (0x59, 0, b + k);
+			Jit_FloatOp (0x11, 0, c + k);
+		}
+		break;
+	case OP_MUL_VF:
+		for (k = 0; k < 3; k++)
+		{
+			Jit_FloatOp (0x10, 0, b);
+			Jit_FloatOp (0x59, 0, a + k);
+			Jit_FloatOp (0x11, 0, c + k);
+		}
+		break;
+
+	case OP_BITAND:
+	case OP_BITOR:
+		Jit_FloatOp (0x2c, JIT_EAX, a);	/* cvttss2si */
+		Jit_FloatOp (0x2c, JIT_ECX, b);
+		Jit_Byte (st->op == OP_BITAND ? 0x21 : 0x09); Jit_Byte (0xc8);	/* and/or eax, ecx */
+		Jit_Byte (0xf3); Jit_Byte (0x0f); Jit_Byte (0x2a); Jit_Byte (0xc0);	/* cvtsi2ss xmm0, eax */
+		Jit_FloatOp (0x11, 0, c);
+		break;
+
+	case OP_GE:
+	case OP_GT:
+		Jit_FloatOp (0x10, 0, a);
+		Jit_FloatCompare (0, b);
+		Jit_SetCC (st->op == OP_GE ? CC_AE : CC_A, JIT_EAX);
+		Jit_StoreBool (c);
+		break;
+	case OP_LE:
+	case OP_LT:
+		Jit_FloatOp (0x10, 0, b);
+		Jit_FloatCompare (0, a);
+		Jit_SetCC (st->op == OP_LE ? CC_AE : CC_A, JIT_EAX);
+		Jit_StoreBool (c);
+		break;
+	case OP_AND:
+	case OP_OR:
+		Jit_FloatNotZero (a);
+		Jit_Byte (0x88); Jit_Byte (0xc2);	/* mov dl, al */
+		Jit_FloatNotZero (b);
+		Jit_Byte (st->op == OP_AND ? 0x20 : 0x08); Jit_Byte (0xd0);	/* and/or al, dl */
+		Jit_StoreBool (c);
+		break;
+
+	case OP_NOT_F:
+		Jit_FloatIsZero (a);
+		Jit_StoreBool (c);
+		break;
+	case OP_NOT_V:
+		for (k = 0; k < 3; k++)
+		{
+			Jit_FloatIsZero (a + k);
+			Jit_Byte (k ? 0x20 : 0x88); Jit_Byte (0xc2);	/* and/mov dl, al */
+		}
+		Jit_Byte (0x88); Jit_Byte (0xd0);	/* mov al, dl */
+		Jit_StoreBool (c);
+		break;
+	case OP_NOT_FNC:
+	case OP_NOT_ENT:	/* edict offset 0 is the world */
+		Jit_Load (JIT_EAX, a);
+		Jit_Byte (0x85); Jit_Byte (0xc0);	/* test eax, eax */
+		Jit_SetCC (CC_E, JIT_EAX);
+		Jit_StoreBool (c);
+		break;
+
+	case OP_EQ_F:
+		Jit_FloatEqual (a, b);
+		Jit_StoreBool (c);
+		break;
+	case OP_NE_F:
+		Jit_FloatNotEqual (a, b);
+		Jit_StoreBool (c);
+		break;
+	case OP_EQ_V:
+	case OP_NE_V:
+		for (k = 0; k < 3; k++)
+		{
+			if (st->op == OP_EQ_V)
+				Jit_FloatEqual (a + k, b + k);
+			else
+				Jit_FloatNotEqual (a + k, b + k);
+			Jit_Byte (!k ? 0x88 : st->op == OP_EQ_V ? 0x20 : 0x08); Jit_Byte (0xc2);	/* mov/and/or dl, al */
+		}
+		Jit_Byte (0x88); Jit_Byte (0xd0);	/* mov al, dl */
+		Jit_StoreBool (c);
+		break;
+	case OP_EQ_E:
+	case OP_EQ_FNC:
+	case OP_NE_E:
+	case OP_NE_FNC:
+		Jit_Load (JIT_EAX, a);
+		Jit_Byte (0x3b);	/* cmp eax, [global] */
+		Jit_Global (JIT_EAX, b);
+		Jit_SetCC ((st->op == OP_EQ_E || st->op == OP_EQ_FNC) ? CC_E : CC_NE, JIT_EAX);
+		Jit_StoreBool (c);
+		break;
+
+	case OP_STORE_F:
+	case OP_STORE_ENT:
+	case OP_STORE_FLD:
+	case OP_STORE_S:
+	case OP_STORE_FNC:
+		Jit_Load (JIT_EAX, a);
+		Jit_Store (JIT_EAX, b);
+		break;
+	case OP_STORE_V:
+		for (k = 0; k < 3; k++)
+		{
+			Jit_Load (JIT_EAX, a + k);
+			Jit_Store (JIT_EAX, b + k);
+		}
+		break;
+
+	case OP_STOREP_F:
+	case OP_STOREP_ENT:
+	case OP_STOREP_FLD:
+	case OP_STOREP_S:
+	case OP_STOREP_FNC:
+	case OP_STOREP_V:
+		Jit_EdictAddress (b);
+		for (k = 0; k < (st->op == OP_STOREP_V ? 3 : 1); k++)
+		{
+			Jit_Load (JIT_ECX, a + k);
+			Jit_Byte (0x89); Jit_Byte (0x48); Jit_Byte (k * 4);	/* mov [rax+k*4], ecx */
+		}
+		break;
+
+	case OP_LOAD_F:
+	case OP_LOAD_FLD:
+	case OP_LOAD_ENT:
+	case OP_LOAD_S:
+	case OP_LOAD_FNC:
+	case OP_LOAD_V:
+		Jit_EdictAddress (a);
+		Jit_Byte (0x48); Jit_Byte (0x63);	/* movsxd rdx, [global] */
+		Jit_Global (JIT_EDX, b);
+		for (k = 0; k < (st->op == OP_LOAD_V ? 3 : 1); k++)
+		{
+			Jit_Byte (0x8b); Jit_Byte (0x8c); Jit_Byte (0x90);	/* mov ecx, [rax+rdx*4+ofs] */
+			Jit_Int ((int)offsetof(edict_t, v) + k * 4);
+			Jit_Store (JIT_ECX, c + k);
+		}
+		break;
 
-	"BITAND",
-	"BITOR"
-};
+	case OP_NOT_S:
+	case OP_EQ_S:
+	case OP_NE_S:
+	case OP_ADDRESS:
+	case OP_STATE:
+		Jit_Call (PR_JitOp, s);
+		break;
 
-const char *PR_GlobalString (int ofs);
-const char *PR_GlobalStringNoContents (int ofs);
+	case OP_IF:
+	case OP_IFNOT:
+		Jit_Load (JIT_EAX, a);
+		Jit_Byte (0x85); Jit_Byte (0xc0);	/* test eax, eax */
+		Jit_Jump (st->op == OP_IF ? CC_NE : CC_E, i + st->b, fixups, numfixups, start);
+		break;
+	case OP_GOTO:
+		Jit_Jump (-1, i + st->a, fixups, numfixups, start);
+		break;
 
+	case OP_CALL0:
+	case OP_CALL1:
+	case OP_CALL2:
+	case OP_CALL3:
+	case OP_CALL4:
+	case OP_CALL5:
+	case OP_CALL6:
+	case OP_CALL7:
+	case OP_CALL8:
+		Jit_Call (PR_JitCall, s);
+		break;
 
-//=============================================================================
+	case OP_DONE:
+	case OP_RETURN:
+		Jit_Call (PR_JitReturn, s);
+		Jit_Jump (-1, JIT_EPILOGUE, fixups, numfixups, start);
+		break;
+	}
+}
 
 /*
-=================
-PR_PrintStatement
-=================
+====================
+PR_JitDisable
+
+Drops back to the interpreter for the rest of this progs when the code
+buffer can't be set up or made writable
+====================
 */
-static void PR_PrintStatement (dstatement_t *s)
+static void PR_JitDisable (const char *reason)
 {
-	int	i;
+	Con_Printf ("%s, pr_jit disabled\n", reason);
+	Cvar_SetQuick (&pr_jit, "0");
+	pr_jitfuncs = NULL;
+}
 
-	if ((unsigned int)s->op < sizeof(pr_opnames)/sizeof(pr_opnames[0]))
-	{
-		Con_Printf("%s ", pr_opnames[s->op]);
-		i = strlen(pr_opnames[s->op]);
-		for ( ; i < 10; i++)
-			Con_Printf(" ");
-	}
+/*
+====================
+PR_JitAllocCode
 
-	if (s->op == OP_IF || s->op == OP_IFNOT)
-		Con_Printf("%sbranch %i", PR_GlobalString(s->a), s->b);
-	else if (s->op == OP_GOTO)
-	{
-		Con_Printf("branch %i", s->a);
-	}
-	else if ((unsigned int)(s->op-OP_STORE_F) < 6)
+Sets up the code buffer the first time something is compiled, so it
+costs nothing while pr_jit is off
+====================
+*/
+static qboolean PR_JitAllocCode (void)
+{
+	pr_jitcode = (byte *) Sys_ReserveMemory (PR_JIT_CODESIZE);
+	if (!pr_jitcode)
 	{
-		Con_Printf("%s", PR_GlobalString(s->a));
-		Con_Printf("%s", PR_GlobalStringNoContents(s->b));
+		PR_JitDisable ("No memory for generated code");
+		return false;
 	}
-	else
+	if (!Sys_CommitMemory (pr_jitcode, PR_JIT_CODESIZE) ||
+	    !Sys_ProtectMemory (pr_jitcode, PR_JIT_CODESIZE, true))
 	{
-		if (s->a)
-			Con_Printf("%s", PR_GlobalString(s->a));
-		if (s->b)
-			Con_Printf("%s", PR_GlobalString(s->b));
-		if (s->c)
-			Con_Printf("%s", PR_GlobalStringNoContents(s->c));
+		PR_JitDisable ("Generated code can't be executed");
+		Sys_DecommitMemory (pr_jitcode, PR_JIT_CODESIZE);
+		pr_jitcode = NULL;
+		return false;
 	}
-	Con_Printf("\n");
+	return true;
 }
 
 /*
-============
-PR_StackTrace
-============
+====================
+PR_JitCompile
+
+Returns NULL if the function can't be compiled
+====================
 */
-static void PR_StackTrace (void)
+static jitfunc_t PR_JitCompile (dfunction_t *f)
 {
-	int		i;
-	dfunction_t	*f;
-
-	if (pr_depth == 0)
+	int		first, count, i, j, len, mark, numfixups, target;
+	int		*ofs, *stack;
+	byte		*flags, *start;
+	jitfixup_t	*fixups;
+	qboolean	ok;
+
+	// statements run up to the start of the next function
+	first = f->first_statement;
+	count = progs->numstatements - first;
+	for (i = 0; i < progs->numfunctions; i++)
 	{
-		Con_Printf("<NO STACK>\n");
-		return;
+		if (pr_functions[i].first_statement > first && pr_functions[i].first_statement - first < count)
+			count = pr_functions[i].first_statement - first;
+	}
+	if (first <= 0 || count <= 0)
+		return NULL;
+	if (!pr_jitcode && !PR_JitAllocCode ())
+		return NULL;
+
+	mark = Scratch_Mark ();
+	flags = (byte *) Scratch_Alloc (count);
+	ofs = (int *) Scratch_Alloc ((count + 2) * sizeof(int));
+	stack = (int *) Scratch_Alloc (count * sizeof(int));
+	fixups = (jitfixup_t *) Scratch_Alloc ((2 * count + 1) * sizeof(jitfixup_t));
+	numfixups = 0;
+	ok = PR_JitScan (first, count, flags, stack);
+
+	if (ok && !Sys_ProtectMemory (pr_jitcode, PR_JIT_CODESIZE, false))
+	{
+		PR_JitDisable ("Generated code can't be written");
+		ok = false;
 	}
 
-	pr_stack[pr_depth].f = pr_xfunction;
-	for (i = pr_depth; i >= 0; i--)
+	if (ok)
 	{
-		f = pr_stack[i].f;
-		if (!f)
+		jit_out = start = pr_jitcode + pr_jitcodeused;
+
+	// prologue: keep pr_globals in rbx, &pr_count in r12 and &sv.edicts
+	// in r13, which also leaves the stack 16 byte aligned for calls
+		Jit_Byte (0x53);			/* push rbx */
+		Jit_Byte (0x41); Jit_Byte (0x54);	/* push r12 */
+		Jit_Byte (0x41); Jit_Byte (0x55);	/* push r13 */
+		Jit_Byte (0x48); Jit_Byte (0xbb); Jit_Pointer (pr_globals);
+		Jit_Byte (0x49); Jit_Byte (0xbc); Jit_Pointer (&pr_count);
+		Jit_Byte (0x49); Jit_Byte (0xbd); Jit_Pointer (&sv.edicts);
+
+		for (i = 0; i < count && ok; i++)
 		{
-			Con_Printf("<NO FUNCTION>\n");
+			if (!(flags[i] & JIT_REACHED))
+				continue;
+			if (pr_jitcodeused + (jit_out - start) + PR_JIT_MAXOPSIZE > PR_JIT_CODESIZE)
+			{
+				ok = false;
+				break;
+			}
+
+			ofs[i] = jit_out - start;
+			if (flags[i] & JIT_LEADER)
+			{
+				for (len = 1, j = i; !PR_JitEnds (pr_statements[first + j].op) && !(flags[j + 1] & JIT_LEADER); j++)
+					len++;
+
+				Jit_Byte (0x41); Jit_Byte (0x8b); Jit_Byte (0x04); Jit_Byte (0x24);	/* mov eax, [r12] */
+				Jit_Byte (0x05); Jit_Int (len);						/* add eax, len */
+				Jit_Byte (0x41); Jit_Byte (0x3b); Jit_Byte (0x44); Jit_Byte (0x24);	/* cmp eax, [r12+limit] */
+				Jit_Byte ((int)offsetof(prcount_t, profilelimit));
+				Jit_Byte (0x7e); Jit_Byte (0x0a);					/* jle +10 */
+				Jit_Byte (0xbf); Jit_Int (first + i);					/* mov edi, s */
+				Jit_Jump (-1, JIT_DEOPT, fixups, &numfixups, start);
+				Jit_Byte (0x41); Jit_Byte (0x89); Jit_Byte (0x04); Jit_Byte (0x24);	/* mov [r12], eax */
+			}
+			PR_JitStatement (first + i, i, fixups, &numfixups, start);
 		}
-		else
+
+		if (ok)
 		{
-			Con_Printf("%12s : %s\n", PR_GetString(f->s_file), PR_GetString(f->s_name));
+			ofs[count] = jit_out - start;	/* JIT_DEOPT */
+			Jit_Byte (0x48); Jit_Byte (0xb8); Jit_Pointer ((const void *)PR_JitResume);
+			Jit_Byte (0xff); Jit_Byte (0xd0);	/* call rax */
+			ofs[count + 1] = jit_out - start;	/* JIT_EPILOGUE */
+			Jit_Byte (0x41); Jit_Byte (0x5d);	/* pop r13 */
+			Jit_Byte (0x41); Jit_Byte (0x5c);	/* pop r12 */
+			Jit_Byte (0x5b);			/* pop rbx */
+			Jit_Byte (0xc3);			/* ret */
+
+			for (i = 0; i < numfixups; i++)
+			{
+				target = fixups[i].target;
+				if (target == JIT_DEOPT)
+					target = count;
+				else if (target == JIT_EPILOGUE)
+					target = count + 1;
+				j = ofs[target] - (fixups[i].pos + 4);
+				memcpy (start + fixups[i].pos, &j, 4);
+			}
+			pr_jitcodeused += jit_out - start;
 		}
+
+	// outer frames may be running code in these pages, so there's no
+	// going back to the interpreter from here
+		if (!Sys_ProtectMemory (pr_jitcode, PR_JIT_CODESIZE, true))
+			Sys_Error ("PR_JitCompile: generated code can't be made executable");
 	}
-}
 
+	Scratch_FreeToMark (mark);
+
+	if (!ok)
+	{
+		Con_DPrintf ("PR_JitCompile: %s left to the interpreter\n", PR_GetString(f->s_name));
+		return NULL;
+	}
+	return (jitfunc_t)(void *)start;
+}
 
 /*
-============
-PR_Profile_f
+====================
+PR_JitNoBuiltin
 
-============
+Builtins can't be run twice, so a frame that calls one isn't verified
+====================
 */
-void PR_Profile_f (void)
+static void PR_JitNoBuiltin (void)
 {
-	int		i, num;
-	int		pmax;
-	dfunction_t	*f, *best;
-
-	if (!sv.active)
-		return;
-
-	num = 0;
-	do
-	{
-		pmax = 0;
-		best = NULL;
-		for (i = 0; i < progs->numfunctions; i++)
-		{
-			f = &pr_functions[i];
-			if (f->profile > pmax)
-			{
-				pmax = f->profile;
-				best = f;
-			}
-		}
-		if (best)
-		{
-			if (num < 10)
-				Con_Printf("%7i %s\n", best->profile, PR_GetString(best->s_name));
-			num++;
-			best->profile = 0;
-		}
-	} while (best);
+	longjmp (pr_jitverifyabort, 1);
 }
 
-
 /*
-============
-PR_RunError
+====================
+PR_JitVerify
 
-Aborts the currently executing function
-============
+Runs a frame on the interpreter, then again natively from the same
+state, and reports where the results differ
+====================
 */
-void PR_RunError (const char *error, ...)
+static void PR_JitVerify (dfunction_t *f, jitfunc_t code, int s, int exitdepth)
 {
-	va_list	argptr;
-	char	string[1024];
-
-	va_start (argptr, error);
-	q_vsnprintf (string, sizeof(string), error, argptr);
-	va_end (argptr);
-
-	PR_PrintStatement(pr_statements + pr_xstatement);
-	PR_StackTrace();
+	static prstack_t	stack[MAX_STACK_DEPTH];
+	static int		locals[LOCALSTACK_SIZE];
+	static prcount_t	count;
+	static dfunction_t	*xfunction;
+	static int		xstatement, argc, depth, used, globalsize, edictsize, i;
+	static int		interpreted;
+	static builtin_t	*builtins;
+	static byte		*before, *after;
+	static int		*profiles;
+
+	globalsize = progs->numglobals * 4;
+	edictsize = sv.edicts ? sv.num_edicts * pr_edict_size : 0;
+	if (pr_jitsnapshotsize < 2 * (globalsize + edictsize) + progs->numfunctions * 4)
+	{
+		pr_jitsnapshotsize = 2 * (globalsize + edictsize) + progs->numfunctions * 4;
+		pr_jitsnapshot = (byte *) realloc (pr_jitsnapshot, pr_jitsnapshotsize);
+		if (!pr_jitsnapshot)
+			Sys_Error ("PR_JitVerify: out of memory on %i bytes", pr_jitsnapshotsize);
+	}
+	if (pr_jitnumnobuiltins < pr_numbuiltins)
+	{
+		pr_jitnumnobuiltins = pr_numbuiltins;
+		pr_jitnobuiltins = (builtin_t *) realloc (pr_jitnobuiltins, pr_jitnumnobuiltins * sizeof(builtin_t));
+		if (!pr_jitnobuiltins)
+			Sys_Error ("PR_JitVerify: out of memory");
+		for (i = 0; i < pr_jitnumnobuiltins; i++)
+			pr_jitnobuiltins[i] = PR_JitNoBuiltin;
+	}
+	before = pr_jitsnapshot;
+	after = before + globalsize + edictsize;
+	profiles = (int *)(after + globalsize + edictsize);
+
+	memcpy (before, pr_globals, globalsize);
+	memcpy (before + globalsize, sv.edicts, edictsize);
+	for (i = 0; i < progs->numfunctions; i++)
+		profiles[i] = pr_functions[i].profile;
+	memcpy (stack, pr_stack, sizeof(stack));
+	memcpy (locals, localstack, sizeof(locals));
+	count = pr_count;
+	xfunction = pr_xfunction;
+	xstatement = pr_xstatement;
+	argc = pr_argc;
+	depth = pr_depth;
+	used = localstack_used;
+
+	builtins = pr_builtins;
+	pr_builtins = pr_jitnobuiltins;
+	pr_jitverifying = true;
+	if (setjmp (pr_jitverifyabort))
+	{
+		pr_builtins = builtins;
+		pr_jitverifying = false;
+		after = NULL;
+	}
+	else
+	{
+		PR_RunDecoded (s, exitdepth);
+		pr_builtins = builtins;
+		pr_jitverifying = false;
+		memcpy (after, pr_globals, globalsize);
+		memcpy (after + globalsize, sv.edicts, edictsize);
+		interpreted = pr_count.profile;
+	}
 
-	Con_Printf("%s\n", string);
+	memcpy (pr_globals, before, globalsize);
+	memcpy (sv.edicts, before + globalsize, edictsize);
+	for (i = 0; i < progs->numfunctions; i++)
+		pr_functions[i].profile = profiles[i];
+	memcpy (pr_stack, stack, sizeof(stack));
+	memcpy (localstack, locals, sizeof(locals));
+	pr_count = count;
+	pr_xfunction = xfunction;
+	pr_xstatement = xstatement;
+	pr_argc = argc;
+	pr_depth = depth;
+	localstack_used = used;
+
+	if (!after)
+	{	// callees can still be checked on their own
+		code ();
+		return;
+	}
 
-	pr_depth = 0;	// dump the stack so host_error can shutdown functions
+	pr_jitverifydepth = depth;
+	code ();
+	pr_jitverifydepth = -1;
 
-	Host_Error("Program error");
+	if (pr_count.profile != interpreted)
+		Con_Printf ("PR_JitVerify: %s ran %i statements natively, %i interpreted\n", PR_GetString(f->s_name), pr_count.profile - count.profile, interpreted - count.profile);
+	for (i = 0; i < globalsize + edictsize; i += 4)
+	{
+		if (!memcmp (after + i, (i < globalsize) ? (byte *)pr_globals + i : (byte *)sv.edicts + i - globalsize, 4))
+			continue;
+		if (i < globalsize)
+			Con_Printf ("PR_JitVerify: %s differs at global %i\n", PR_GetString(f->s_name), i / 4);
+		else
+			Con_Printf ("PR_JitVerify: %s differs at edict %i byte %i\n", PR_GetString(f->s_name), (i - globalsize) / pr_edict_size, (i - globalsize) % pr_edict_size);
+		break;
+	}
 }
 
 /*
 ====================
-PR_EnterFunction
+PR_JitFrame
 
-Returns the new program statement counter
+Runs a function from entry to return, natively if it can be compiled
 ====================
 */
-static int PR_EnterFunction (dfunction_t *f)
+static void PR_JitFrame (dfunction_t *f)
 {
-	int	i, j, c, o;
-
-	pr_stack[pr_depth].s = pr_xstatement;
-	pr_stack[pr_depth].f = pr_xfunction;
-	pr_depth++;
-	if (pr_depth >= MAX_STACK_DEPTH)
-		PR_RunError("stack overflow");
-
-	// save off any locals that the new function steps on
-	c = f->locals;
-	if (localstack_used + c > LOCALSTACK_SIZE)
-		PR_RunError("PR_ExecuteProgram: locals stack overflow\n");
+	jitfunc_t	code;
+	int		exitdepth, s;
 
-	for (i = 0; i < c ; i++)
-		localstack[localstack_used + i] = ((int *)pr_globals)[f->parm_start + i];
-	localstack_used += c;
+	exitdepth = pr_depth;
+	s = PR_EnterFunction (f);
 
-	// copy parameters
-	o = f->parm_start;
-	for (i = 0; i < f->numparms; i++)
+	// PR_JitDisable can clear the table under a running native frame
+	code = pr_jitfuncs ? pr_jitfuncs[f - pr_functions] : PR_JitUnsupported;
+	if (!code && (pr_jit.value < 2 || f->profile >= PR_JIT_HOTCOUNT))
 	{
-		for (j = 0; j < f->parm_size[i]; j++)
-		{
-			((int *)pr_globals)[o] = ((int *)pr_globals)[OFS_PARM0 + i*3 + j];
-			o++;
-		}
+		code = PR_JitCompile (f);
+		if (!code)
+			code = PR_JitUnsupported;
+		if (pr_jitfuncs)
+			pr_jitfuncs[f - pr_functions] = code;
 	}
 
-	pr_xfunction = f;
-	return f->first_statement - 1;	// offset the s++
+	if (!code || code == PR_JitUnsupported)
+		PR_RunDecoded (s, exitdepth);
+	else if (pr_jit_verify.value && pr_jitverifydepth < 0 && !pr_trace)
+		PR_JitVerify (f, code, s, exitdepth);
+	else
+		code ();
 }
 
 /*
 ====================
-PR_LeaveFunction
+PR_JitInit
+
+Called from PR_DecodeProgs, throws away the code for the old progs
 ====================
 */
-static int PR_LeaveFunction (void)
+static void PR_JitInit (void)
 {
-	int	i, c;
+	pr_jitfuncs = NULL;
+	pr_jitcodeused = 0;
+	pr_jitverifydepth = -1;
 
-	if (pr_depth <= 0)
-		Host_Error("prog stack underflow");
+	pr_jitfuncs = (jitfunc_t *) Hunk_AllocName (progs->numfunctions * sizeof(jitfunc_t), "progjit");
+}
 
-	// Restore locals from the stack
-	c = pr_xfunction->locals;
-	localstack_used -= c;
-	if (localstack_used < 0)
-		PR_RunError("PR_ExecuteProgram: locals stack underflow");
+#endif	/* PR_JIT */
 
-	for (i = 0; i < c; i++)
-		((int *)pr_globals)[pr_xfunction->parm_start + i] = localstack[localstack_used + i];
+/*
+====================
+PR_ExecuteDecoded
+====================
+*/
+static void PR_ExecuteDecoded (dfunction_t *f)
+{
+	prcount_t	saved;
+	int		exitdepth, s;
 
-	// up stack
-	pr_depth--;
-	pr_xfunction = pr_stack[pr_depth].f;
-	return pr_stack[pr_depth].s;
+	// a builtin can start a new program inside this one
+	saved = pr_count;
+	pr_count.profile = pr_count.startprofile = 0;
+	pr_count.profilelimit = pr_trace ? 0 : PR_RUNAWAY;
+
+#ifdef PR_JIT
+	if (pr_jit.value && pr_jitfuncs)
+		PR_JitFrame (f);
+	else
+#endif
+	{
+	// make a stack frame
+		exitdepth = pr_depth;
+		s = PR_EnterFunction (f);
+		PR_RunDecoded (s, exitdepth);
+	}
+
+	pr_count = saved;
 }
 
 
@@ -372,6 +2392,14 @@ void PR_ExecuteProgram (func_t fnum)
 	f = &pr_functions[fnum];
 
 	pr_trace = false;
+	if (pr_profiling && !pr_depth)
+		PR_ProfileFrame ();
+
+	if ((pr_threaded.value || pr_jit.value) && pr_decoded)
+	{
+		PR_ExecuteDecoded (f);
+		return;
+	}
 
 // make a stack frame
 	exitdepth = pr_depth;
@@ -613,7 +2641,10 @@ void PR_ExecuteProgram (func_t fnum)
 			int i = -newf->first_statement;
 			if (i >= pr_numbuiltins)
 				PR_RunError("Bad builtin call number %d", i);
-			pr_builtins[i]();
+			if (pr_profiling)
+				PR_ProfileBuiltin (newf, i);
+			else
+				pr_builtins[i]();
 			break;
 		}
 		// Normal function
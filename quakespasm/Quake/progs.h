@@ -72,12 +72,17 @@ void PR_Init (void);
 
 void PR_ExecuteProgram (func_t fnum);
 void PR_LoadProgs (void);
+void PR_DecodeProgs (void);
 
 const char *PR_GetString (int num);
 int PR_SetEngineString (const char *s);
 int PR_AllocString (int bufferlength, char **ptr);
 
 void PR_Profile_f (void);
+void PR_ProfileStart_f (void);
+void PR_ProfileStop_f (void);
+void PR_ProfileTop_f (void);
+void PR_ProfileDump_f (void);
 
 edict_t *ED_Alloc (void);
 void ED_Free (edict_t *ed);
@@ -298,6 +298,11 @@ extern filelist_item_t	*modlist;
 extern filelist_item_t	*extralevels;
 extern filelist_item_t	*demolist;
 
+// the same names, sorted for tab completion
+extern tabindex_t	modlist_index;
+extern tabindex_t	extralevels_index;
+extern tabindex_t	demolist_index;
+
 void Host_ClearMemory (void);
 void Host_ServerFrame (void);
 void Host_InitCommands (void);
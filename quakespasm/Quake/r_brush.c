@@ -960,6 +960,8 @@ void GL_BuildLightmaps (void)
 */
 
 GLuint gl_bmodel_vbo = 0;
+static int gl_bmodel_vbo_bytes = 0;
+int gl_vbo_bytes = 0;
 
 void GL_DeleteBModelVertexBuffer (void)
 {
@@ -968,6 +970,8 @@ void GL_DeleteBModelVertexBuffer (void)
 
 	GL_DeleteBuffersFunc (1, &gl_bmodel_vbo);
 	gl_bmodel_vbo = 0;
+	gl_vbo_bytes -= gl_bmodel_vbo_bytes;
+	gl_bmodel_vbo_bytes = 0;
 
 	GL_ClearBufferBindings ();
 }
@@ -1031,6 +1035,8 @@ void GL_BuildBModelVertexBuffer (void)
 // upload to GPU
 	GL_BindBufferFunc (GL_ARRAY_BUFFER, gl_bmodel_vbo);
 	GL_BufferDataFunc (GL_ARRAY_BUFFER, varray_bytes, varray, GL_STATIC_DRAW);
+	gl_vbo_bytes += (int)varray_bytes - gl_bmodel_vbo_bytes;
+	gl_bmodel_vbo_bytes = (int)varray_bytes;
 	free (varray);
 	
 // invalidate the cached bindings
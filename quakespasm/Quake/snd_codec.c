@@ -271,14 +271,10 @@ int S_CodecReadStream (snd_stream_t *stream, int bytes, void *buffer)
 snd_stream_t *S_CodecUtilOpen(const char *filename, snd_codec_t *codec)
 {
 	snd_stream_t *stream;
-	FILE *handle;
-	qboolean pak;
-	long length;
+	fshandle_t fh;
 
 	/* Try to open the file */
-	length = (long) COM_FOpenFile(filename, &handle, NULL);
-	pak = file_from_pak;
-	if (length == -1)
+	if (FS_fopen(filename, &fh, NULL) == -1)
 	{
 		Con_DPrintf("Couldn't open %s\n", filename);
 		return NULL;
@@ -287,11 +283,8 @@ snd_stream_t *S_CodecUtilOpen(const char *filename, snd_codec_t *codec)
 	/* Allocate a stream, Z_Malloc zeroes its content */
 	stream = (snd_stream_t *) Z_Malloc(sizeof(snd_stream_t));
 	stream->codec = codec;
-	stream->fh.file = handle;
-	stream->fh.start = ftell(handle);
-	stream->fh.pos = 0;
-	stream->fh.length = length;
-	stream->fh.pak = stream->pak = pak;
+	stream->fh = fh;
+	stream->pak = fh.pak;
 	q_strlcpy(stream->name, filename, MAX_QPATH);
 
 	return stream;
@@ -299,7 +292,7 @@ snd_stream_t *S_CodecUtilOpen(const char *filename, snd_codec_t *codec)
 
 void S_CodecUtilClose(snd_stream_t **stream)
 {
-	fclose((*stream)->fh.file);
+	FS_fclose(&(*stream)->fh);
 	Z_Free(*stream);
 	*stream = NULL;
 }
@@ -313,7 +313,8 @@ void S_TouchSound (const char *name)
 		return;
 
 	sfx = S_FindName (name);
-	Cache_Check (&sfx->cache);
+	if (!Cache_Check (&sfx->cache))
+		COM_Prefetch (va("sound/%s", name));
 }
 
 /*
@@ -34,11 +34,11 @@
 FGetLittleLong
 =================
 */
-static int FGetLittleLong (FILE *f)
+static int FGetLittleLong (fshandle_t *f)
 {
 	int		v;
 
-	fread(&v, 1, sizeof(v), f);
+	FS_fread(&v, 1, sizeof(v), f);
 
 	return LittleLong(v);
 }
@@ -48,11 +48,11 @@ static int FGetLittleLong (FILE *f)
 FGetLittleShort
 =================
 */
-static short FGetLittleShort(FILE *f)
+static short FGetLittleShort(fshandle_t *f)
 {
 	short	v;
 
-	fread(&v, 1, sizeof(v), f);
+	FS_fread(&v, 1, sizeof(v), f);
 
 	return LittleShort(v);
 }
@@ -62,13 +62,13 @@ static short FGetLittleShort(FILE *f)
 WAV_ReadChunkInfo
 =================
 */
-static int WAV_ReadChunkInfo(FILE *f, char *name)
+static int WAV_ReadChunkInfo(fshandle_t *f, char *name)
 {
 	int len, r;
 
 	name[4] = 0;
 
-	r = fread(name, 1, 4, f);
+	r = FS_fread(name, 1, 4, f);
 	if (r != 4)
 		return -1;
 
@@ -89,7 +89,7 @@ WAV_FindRIFFChunk
 Returns the length of the data in the chunk, or -1 if not found
 =================
 */
-static int WAV_FindRIFFChunk(FILE *f, const char *chunk)
+static int WAV_FindRIFFChunk(fshandle_t *f, const char *chunk)
 {
 	char	name[5];
 	int		len;
@@ -102,7 +102,7 @@ static int WAV_FindRIFFChunk(FILE *f, const char *chunk)
 		len = ((len + 1) & ~1);	/* pad by 2 . */
 
 		/* Not the right chunk - skip it */
-		fseek(f, len, SEEK_CUR);
+		FS_fseek(f, len, SEEK_CUR);
 	}
 
 	return -1;
@@ -113,13 +113,13 @@ static int WAV_FindRIFFChunk(FILE *f, const char *chunk)
 WAV_ReadRIFFHeader
 =================
 */
-static qboolean WAV_ReadRIFFHeader(const char *name, FILE *file, snd_info_t *info)
+static qboolean WAV_ReadRIFFHeader(const char *name, fshandle_t *file, snd_info_t *info)
 {
 	char dump[16];
 	int wav_format;
 	int fmtlen = 0;
 
-	if (fread(dump, 1, 12, file) < 12 ||
+	if (FS_fread(dump, 1, 12, file) < 12 ||
 	    strncmp(dump, "RIFF", 4) != 0 ||
 	    strncmp(&dump[8], "WAVE", 4) != 0)
 	{
@@ -161,7 +161,7 @@ static qboolean WAV_ReadRIFFHeader(const char *name, FILE *file, snd_info_t *inf
 	if (fmtlen > 16)
 	{
 		fmtlen -= 16;
-		fseek(file, fmtlen, SEEK_CUR);
+		FS_fseek(file, fmtlen, SEEK_CUR);
 	}
 
 	/* Scan for the data chunk */
@@ -194,22 +194,24 @@ S_WAV_CodecOpenStream
 */
 static qboolean S_WAV_CodecOpenStream(snd_stream_t *stream)
 {
-	long start = stream->fh.start;
+	long data;
 
 	/* Read the RIFF header */
-	/* The file reads are sequential, therefore no need
-	 * for the FS_*() functions: We will manipulate the
-	 * file by ourselves from now on. */
-	if (!WAV_ReadRIFFHeader(stream->name, stream->fh.file, &stream->info))
+	if (!WAV_ReadRIFFHeader(stream->name, &stream->fh, &stream->info))
 		return false;
 
-	stream->fh.start = ftell(stream->fh.file); /* reset to data position */
-	if (stream->fh.start - start + stream->info.size > stream->fh.length)
+	data = FS_ftell(&stream->fh);
+	if (data + stream->info.size > stream->fh.length)
 	{
 		Con_Printf("%s data size mismatch\n", stream->name);
 		return false;
 	}
 
+	/* reset to data position */
+	stream->fh.start += data;
+	stream->fh.length -= data;
+	stream->fh.pos = 0;
+
 	return true;
 }
 
@@ -227,8 +229,7 @@ int S_WAV_CodecReadStream(snd_stream_t *stream, int bytes, void *buffer)
 		return 0;
 	if (bytes > remaining)
 		bytes = remaining;
-	stream->fh.pos += bytes;
-	fread(buffer, 1, bytes, stream->fh.file);
+	bytes = FS_fread(buffer, 1, bytes, &stream->fh);
 	if (stream->info.width == 2)
 	{
 		samples = bytes / 2;
@@ -1356,6 +1356,10 @@ void SV_SpawnServer (const char *server)
 
 	Cvar_SetValue ("skill", (float)current_skill);
 
+// start reading the world while the progs load
+	COM_PrefetchClear ();
+	COM_Prefetch (va("maps/%s.bsp", server));
+
 //
 // set up the new server
 //
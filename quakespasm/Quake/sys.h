@@ -40,6 +40,22 @@ void Sys_FileSeek (int handle, int position);
 int Sys_FileRead (int handle, void *dest, int count);
 int Sys_FileWrite (int handle,const void *data, int count);
 int Sys_FileTime (const char *path);
+
+// maps the whole file read-only into memory, returns NULL if the
+// platform can't do it.  the mapping stays valid after Sys_FileClose.
+void *Sys_FileMap (int handle, int size);
+void Sys_FileUnmap (void *base, int size);
+
+// reserves address space without backing it with memory, returns NULL if
+// the platform can't do it.  pages must be committed before they're used,
+// and read back as zero after they're decommitted.  committing returns
+// false when the system is out of memory.
+void *Sys_ReserveMemory (int size);
+qboolean Sys_CommitMemory (void *base, int size);
+void Sys_DecommitMemory (void *base, int size);
+// switches committed pages between read/write and read/execute, for
+// generated code.  returns false if the platform won't allow it.
+qboolean Sys_ProtectMemory (void *base, int size, qboolean execute);
 void Sys_mkdir (const char *path);
 
 //
@@ -58,11 +74,35 @@ void Sys_Printf (const char *fmt, ...) FUNC_PRINTF(1,2);
 
 double Sys_DoubleTime (void);
 
+double Sys_PreciseTime (void);
+// high resolution monotonic timer for profiling, unrelated to Sys_DoubleTime.
+
 const char *Sys_ConsoleInput (void);
 
 void Sys_Sleep (unsigned long msecs);
 // yield for about 'msecs' milliseconds.
 
+//
+// threads, used for background file I/O only.  the handles are opaque,
+// creating one returns NULL on failure.
+//
+void *Sys_CreateThread (int (*func)(void *), void *data);
+void Sys_WaitThread (void *thread);
+void *Sys_CreateMutex (void);
+void Sys_DestroyMutex (void *mutex);
+void Sys_LockMutex (void *mutex);
+void Sys_UnlockMutex (void *mutex);
+void *Sys_CreateCond (void);
+void Sys_DestroyCond (void *cond);
+void Sys_CondWait (void *cond, void *mutex);	// mutex must be locked
+void Sys_CondBroadcast (void *cond);
+
+// for handing data between one writer and one reader thread without a
+// lock: a store is seen only after everything written before it, and a
+// load before anything read after it.
+int Sys_AtomicLoad (volatile int *p);
+void Sys_AtomicStore (volatile int *p, int value);
+
 void Sys_SendKeyEvents (void);
 // Perform Key_Event () callbacks until the input que is empty
 
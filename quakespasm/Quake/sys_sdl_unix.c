@@ -32,6 +32,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #endif
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <time.h>
 #ifdef DO_USERDIRS
@@ -140,6 +141,56 @@ int Sys_FileWrite (int handle, const void *data, int count)
 	return fwrite (data, 1, count, sys_handles[handle]);
 }
 
+void *Sys_FileMap (int handle, int size)
+{
+	void	*base;
+
+	if (size <= 0)
+		return NULL;
+	base = mmap (NULL, size, PROT_READ, MAP_SHARED, fileno(sys_handles[handle]), 0);
+	if (base == MAP_FAILED)
+		return NULL;
+	return base;
+}
+
+void Sys_FileUnmap (void *base, int size)
+{
+	munmap (base, size);
+}
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS	MAP_ANON
+#endif
+void *Sys_ReserveMemory (int size)
+{
+	void	*base;
+
+	/* inaccessible pages aren't counted against the commit limit, making
+	 * them writable is, so running out of memory shows up there */
+	base = mmap (NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
+		return NULL;
+	return base;
+}
+
+qboolean Sys_CommitMemory (void *base, int size)
+{
+	return mprotect (base, size, PROT_READ | PROT_WRITE) == 0;
+}
+
+void Sys_DecommitMemory (void *base, int size)
+{
+	/* map fresh zero pages over the range, that gives the old ones back
+	 * on every unix, unlike madvise() */
+	if (mmap (base, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+		memset (base, 0, size);	/* still committed, but zeroed */
+}
+
+qboolean Sys_ProtectMemory (void *base, int size, qboolean execute)
+{
+	return mprotect (base, size, execute ? PROT_READ | PROT_EXEC : PROT_READ | PROT_WRITE) == 0;
+}
+
 int Sys_FileTime (const char *path)
 {
 	FILE	*f;
@@ -382,7 +433,11 @@ void Sys_Error (const char *error, ...)
 	va_end (argptr);
 
 	fputs (errortxt1, stderr);
+	Con_DebugLog (errortxt2);
+	Con_DebugLog (text);
+	Con_DebugLog ("\n");
 	Host_Shutdown ();
+	LOG_Close ();	// in case this was a recursive error, which Host_Shutdown skips
 	fputs (errortxt2, stderr);
 	fputs (text, stderr);
 	fputs ("\n\n", stderr);
@@ -413,6 +468,21 @@ double Sys_DoubleTime (void)
 	return SDL_GetTicks() / 1000.0;
 }
 
+double Sys_PreciseTime (void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec	ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+#else	/* older OS X: not monotonic, clock changes show up in the profile */
+	struct timeval	tv;
+
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+#endif
+}
+
 const char *Sys_ConsoleInput (void)
 {
 	static char	con_text[256];
@@ -467,6 +537,74 @@ void Sys_Sleep (unsigned long msecs)
 	SDL_Delay (msecs);
 }
 
+void *Sys_CreateThread (int (*func)(void *), void *data)
+{
+#if SDL_VERSION_ATLEAST(2,0,0)
+	return SDL_CreateThread (func, "quakespasm", data);
+#else
+	return SDL_CreateThread (func, data);
+#endif
+}
+
+void Sys_WaitThread (void *thread)
+{
+	SDL_WaitThread ((SDL_Thread *) thread, NULL);
+}
+
+void *Sys_CreateMutex (void)
+{
+	return SDL_CreateMutex ();
+}
+
+void Sys_DestroyMutex (void *mutex)
+{
+	SDL_DestroyMutex ((SDL_mutex *) mutex);
+}
+
+void Sys_LockMutex (void *mutex)
+{
+	SDL_LockMutex ((SDL_mutex *) mutex);
+}
+
+void Sys_UnlockMutex (void *mutex)
+{
+	SDL_UnlockMutex ((SDL_mutex *) mutex);
+}
+
+void *Sys_CreateCond (void)
+{
+	return SDL_CreateCond ();
+}
+
+void Sys_DestroyCond (void *cond)
+{
+	SDL_DestroyCond ((SDL_cond *) cond);
+}
+
+void Sys_CondWait (void *cond, void *mutex)
+{
+	SDL_CondWait ((SDL_cond *) cond, (SDL_mutex *) mutex);
+}
+
+void Sys_CondBroadcast (void *cond)
+{
+	SDL_CondBroadcast ((SDL_cond *) cond);
+}
+
+int Sys_AtomicLoad (volatile int *p)
+{
+	int	value = *p;
+
+	__sync_synchronize ();
+	return value;
+}
+
+void Sys_AtomicStore (volatile int *p, int value)
+{
+	__sync_synchronize ();
+	*p = value;
+}
+
 void Sys_SendKeyEvents (void)
 {
 	IN_Commands();		//ericw -- allow joysticks to add keys so they can be used to confirm SCR_ModalMessage
@@ -139,6 +139,51 @@ int Sys_FileWrite (int handle, const void *data, int count)
 	return fwrite (data, 1, count, sys_handles[handle]);
 }
 
+void *Sys_FileMap (int handle, int size)
+{
+	HANDLE	hfile, hmap;
+	void	*base;
+
+	if (size <= 0)
+		return NULL;
+	hfile = (HANDLE) _get_osfhandle (_fileno(sys_handles[handle]));
+	if (hfile == INVALID_HANDLE_VALUE)
+		return NULL;
+	hmap = CreateFileMapping (hfile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!hmap)
+		return NULL;
+	base = MapViewOfFile (hmap, FILE_MAP_READ, 0, 0, size);
+	CloseHandle (hmap);	/* the view keeps the mapping alive */
+	return base;
+}
+
+void Sys_FileUnmap (void *base, int size)
+{
+	UnmapViewOfFile (base);
+}
+
+void *Sys_ReserveMemory (int size)
+{
+	return VirtualAlloc (NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+}
+
+qboolean Sys_CommitMemory (void *base, int size)
+{
+	return VirtualAlloc (base, size, MEM_COMMIT, PAGE_READWRITE) != NULL;
+}
+
+void Sys_DecommitMemory (void *base, int size)
+{
+	VirtualFree (base, size, MEM_DECOMMIT);
+}
+
+qboolean Sys_ProtectMemory (void *base, int size, qboolean execute)
+{
+	DWORD	old;
+
+	return VirtualProtect (base, size, execute ? PAGE_EXECUTE_READ : PAGE_READWRITE, &old) != 0;
+}
+
 int Sys_FileTime (const char *path)
 {
 	FILE	*f;
@@ -309,7 +354,11 @@ void Sys_Error (const char *error, ...)
 	/* SDL will put these into its own stderr log,
 	   so print to stderr even in graphical mode. */
 	fputs (errortxt1, stderr);
+	Con_DebugLog (errortxt2);
+	Con_DebugLog (text);
+	Con_DebugLog ("\n");
 	Host_Shutdown ();
+	LOG_Close ();	// in case this was a recursive error, which Host_Shutdown skips
 	fputs (errortxt2, stderr);
 	fputs (text, stderr);
 	fputs ("\n\n", stderr);
@@ -363,6 +412,17 @@ double Sys_DoubleTime (void)
 	return SDL_GetTicks() / 1000.0;
 }
 
+double Sys_PreciseTime (void)
+{
+	static LARGE_INTEGER	freq;
+	LARGE_INTEGER		count;
+
+	if (!freq.QuadPart)
+		QueryPerformanceFrequency (&freq);
+	QueryPerformanceCounter (&count);
+	return (double) count.QuadPart / (double) freq.QuadPart;
+}
+
 const char *Sys_ConsoleInput (void)
 {
 	static char	con_text[256];
@@ -435,6 +495,74 @@ void Sys_Sleep (unsigned long msecs)
 	SDL_Delay (msecs);
 }
 
+void *Sys_CreateThread (int (*func)(void *), void *data)
+{
+#if SDL_VERSION_ATLEAST(2,0,0)
+	return SDL_CreateThread (func, "quakespasm", data);
+#else
+	return SDL_CreateThread (func, data);
+#endif
+}
+
+void Sys_WaitThread (void *thread)
+{
+	SDL_WaitThread ((SDL_Thread *) thread, NULL);
+}
+
+void *Sys_CreateMutex (void)
+{
+	return SDL_CreateMutex ();
+}
+
+void Sys_DestroyMutex (void *mutex)
+{
+	SDL_DestroyMutex ((SDL_mutex *) mutex);
+}
+
+void Sys_LockMutex (void *mutex)
+{
+	SDL_LockMutex ((SDL_mutex *) mutex);
+}
+
+void Sys_UnlockMutex (void *mutex)
+{
+	SDL_UnlockMutex ((SDL_mutex *) mutex);
+}
+
+void *Sys_CreateCond (void)
+{
+	return SDL_CreateCond ();
+}
+
+void Sys_DestroyCond (void *cond)
+{
+	SDL_DestroyCond ((SDL_cond *) cond);
+}
+
+void Sys_CondWait (void *cond, void *mutex)
+{
+	SDL_CondWait ((SDL_cond *) cond, (SDL_mutex *) mutex);
+}
+
+void Sys_CondBroadcast (void *cond)
+{
+	SDL_CondBroadcast ((SDL_cond *) cond);
+}
+
+int Sys_AtomicLoad (volatile int *p)
+{
+	int	value = *p;
+
+	MemoryBarrier ();
+	return value;
+}
+
+void Sys_AtomicStore (volatile int *p, int value)
+{
+	MemoryBarrier ();
+	*p = value;
+}
+
 void Sys_SendKeyEvents (void)
 {
 	IN_Commands();		//ericw -- allow joysticks to add keys so they can be used to confirm SCR_ModalMessage
@@ -340,8 +340,8 @@ void SV_TouchLinks (edict_t *ent)
 	int		i, listcount;
 	int		mark;
 	
-	mark = Hunk_LowMark ();
-	list = (edict_t **) Hunk_Alloc (sv.num_edicts*sizeof(edict_t *));
+	mark = Scratch_Mark ();
+	list = (edict_t **) Scratch_Alloc (sv.num_edicts*sizeof(edict_t *));
 	
 	listcount = 0;
 	SV_AreaTriggerEdicts (ent, sv_areanodes, list, &listcount, sv.num_edicts);
@@ -374,8 +374,8 @@ void SV_TouchLinks (edict_t *ent)
 		pr_global_struct->other = old_other;
 	}
 
-// free hunk-allocated edicts array
-	Hunk_FreeToLowMark (mark);
+// free the edicts array
+	Scratch_FreeToMark (mark);
 }
 
 
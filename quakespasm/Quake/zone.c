@@ -24,6 +24,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "quakedef.h"
 
 #define	DYNAMIC_SIZE	(4 * 1024 * 1024) // ericw -- was 512KB (64-bit) / 384KB (32-bit)
+#define	DEFAULT_CACHE_SIZE	(256 * 1024 * 1024) // for a reserved hunk: the old default hunk size, so nothing is thrown out sooner than before
 
 #define	ZONEID	0x1d4a11
 #define MINFRAGMENT	64
@@ -37,11 +38,19 @@ typedef struct memblock_s
 	struct	memblock_s	*next, *prev;
 } memblock_t;
 
+#define	ZONE_CLASSGRAIN	16	// size classes are this far apart
+#define	ZONE_MAXSMALL	512	// blocks up to this size, header included, are size classed
+#define	NUM_SIZECLASSES	(ZONE_MAXSMALL / ZONE_CLASSGRAIN + 1)
+#define	ZONE_MINSMALL	((int)sizeof(memblock_t) + 16)	// room for the class link and trash tester
+#define	ZONE_CLASSED	-1	// tag of a freed block waiting in a size class
+
 typedef struct
 {
 	int		size;		// total bytes malloced, including header
 	memblock_t	blocklist;	// start / end cap for linked list
 	memblock_t	*rover;
+	memblock_t	*classes[NUM_SIZECLASSES];	// freed small blocks, by size / ZONE_CLASSGRAIN
+	int		classedbytes;
 } memzone_t;
 
 void Cache_FreeLow (int new_low_hunk);
@@ -58,6 +67,13 @@ contiguous free memblocks.
 
 The rover can be left pointing at a non-empty block
 
+Small blocks aren't given back to the block list when they are freed,
+they are kept in a free list for their size class (tagged ZONE_CLASSED,
+so they still count as used for merging), and the next allocation of the
+same class takes one from there without scanning.  When the rover can't
+find room, or too much of the zone is sitting in the size classes, they
+are all really freed and merged again.
+
 The zone calls are pretty much only used for small strings and structures,
 all big things are allocated on the hunk.
 ==============================================================================
@@ -65,24 +81,22 @@ all big things are allocated on the hunk.
 
 static memzone_t	*mainzone;
 
+static int	z_classhits;		// allocations served from a size class
+static int	z_roverallocs;		// allocations that scanned the block list
+static double	z_roverscans;		// blocks looked at by those
+static int	z_classflushes;
+static int	z_used, z_peak, z_blocks;	// allocated blocks, headers included
+
+#define	Z_CLASSLINK(block)	(*(memblock_t **)((byte *)(block) + sizeof(memblock_t)))
 
 /*
 ========================
-Z_Free
+Z_FreeBlock -- returns a block to the block list, merging it with free neighbors
 ========================
 */
-void Z_Free (void *ptr)
+static void Z_FreeBlock (memblock_t *block)
 {
-	memblock_t	*block, *other;
-
-	if (!ptr)
-		Sys_Error ("Z_Free: NULL pointer");
-
-	block = (memblock_t *) ( (byte *)ptr - sizeof(memblock_t));
-	if (block->id != ZONEID)
-		Sys_Error ("Z_Free: freed a pointer without ZONEID");
-	if (block->tag == 0)
-		Sys_Error ("Z_Free: freed a freed pointer");
+	memblock_t	*other;
 
 	block->tag = 0;		// mark as free
 
@@ -108,30 +122,120 @@ void Z_Free (void *ptr)
 	}
 }
 
+/*
+========================
+Z_FlushSizeClasses -- really frees all blocks waiting in the size classes
+========================
+*/
+static void Z_FlushSizeClasses (void)
+{
+	memblock_t	*block, *next;
+	int		i;
+
+	for (i = 0; i < NUM_SIZECLASSES; i++)
+	{
+		for (block = mainzone->classes[i]; block; block = next)
+		{
+			next = Z_CLASSLINK(block);
+			Z_FreeBlock (block);
+		}
+		mainzone->classes[i] = NULL;
+	}
+	mainzone->classedbytes = 0;
+	z_classflushes++;
+}
+
+/*
+========================
+Z_Free
+========================
+*/
+void Z_Free (void *ptr)
+{
+	memblock_t	*block;
+	int		c;
+
+	if (!ptr)
+		Sys_Error ("Z_Free: NULL pointer");
+
+	block = (memblock_t *) ( (byte *)ptr - sizeof(memblock_t));
+	if (block->id != ZONEID)
+		Sys_Error ("Z_Free: freed a pointer without ZONEID");
+	if (block->tag == 0 || block->tag == ZONE_CLASSED)
+		Sys_Error ("Z_Free: freed a freed pointer");
+
+	z_used -= block->size;
+	z_blocks--;
+
+	// don't let the size classes pin down too much of the zone
+	if (block->size <= ZONE_MAXSMALL && block->size >= ZONE_MINSMALL &&
+	    mainzone->classedbytes < mainzone->size / 8)
+	{
+		c = block->size / ZONE_CLASSGRAIN;
+		block->tag = ZONE_CLASSED;
+		Z_CLASSLINK(block) = mainzone->classes[c];
+		mainzone->classes[c] = block;
+		mainzone->classedbytes += block->size;
+		return;
+	}
+
+	Z_FreeBlock (block);
+}
+
 
 static void *Z_TagMalloc (int size, int tag)
 {
-	int		extra;
+	int		extra, c;
 	memblock_t	*start, *rover, *newblock, *base;
+	qboolean	flushed;
 
 	if (!tag)
 		Sys_Error ("Z_TagMalloc: tried to use a 0 tag");
 
-//
-// scan through the block list looking for the first free block
-// of sufficient size
-//
 	size += sizeof(memblock_t);	// account for size of block header
 	size += 4;					// space for memory trash tester
 	size = (size + 7) & ~7;		// align to 8-byte boundary
 
+//
+// small blocks come from their size class if one is waiting there
+//
+	if (size <= ZONE_MAXSMALL)
+	{
+		size = (size + ZONE_CLASSGRAIN - 1) & ~(ZONE_CLASSGRAIN - 1);
+		if (size < ZONE_MINSMALL)
+			size = (ZONE_MINSMALL + ZONE_CLASSGRAIN - 1) & ~(ZONE_CLASSGRAIN - 1);
+		c = size / ZONE_CLASSGRAIN;
+		base = mainzone->classes[c];
+		if (base)
+		{
+			mainzone->classes[c] = Z_CLASSLINK(base);
+			mainzone->classedbytes -= base->size;
+			z_classhits++;
+			goto found;
+		}
+	}
+
+//
+// scan through the block list looking for the first free block
+// of sufficient size
+//
+	flushed = false;
+	z_roverallocs++;
+retry:
 	base = rover = mainzone->rover;
 	start = base->prev;
 
 	do
 	{
+		z_roverscans++;
 		if (rover == start)	// scaned all the way around the list
-			return NULL;
+		{
+			if (flushed || !mainzone->classedbytes)
+				return NULL;
+			Z_FlushSizeClasses ();
+			flushed = true;
+			goto retry;
+		}
 		if (rover->tag)
 			base = rover = rover->next;
 		else
@@ -155,15 +259,21 @@ static void *Z_TagMalloc (int size, int tag)
 		base->size = size;
 	}
 
-	base->tag = tag;				// no longer a free block
-
 	mainzone->rover = base->next;	// next allocation will start looking here
 
+found:
+	base->tag = tag;				// no longer a free block
+
 	base->id = ZONEID;
 
 // marker for memory trash testing
 	*(int *)((byte *)base + base->size - 4) = ZONEID;
 
+	z_used += base->size;
+	z_blocks++;
+	if (z_used > z_peak)
+		z_peak = z_used;
+
 	return (void *) ((byte *)base + sizeof(memblock_t));
 }
 
@@ -175,6 +285,7 @@ Z_CheckHeap
 static void Z_CheckHeap (void)
 {
 	memblock_t	*block;
+	int		i, classed;
 
 	for (block = mainzone->blocklist.next ; ; block = block->next)
 	{
@@ -187,6 +298,21 @@ static void Z_CheckHeap (void)
 		if (!block->tag && !block->next->tag)
 			Sys_Error ("Z_CheckHeap: two consecutive free blocks\n");
 	}
+
+	classed = 0;
+	for (i = 0; i < NUM_SIZECLASSES; i++)
+	{
+		for (block = mainzone->classes[i]; block; block = Z_CLASSLINK(block))
+		{
+			if (block->id != ZONEID || block->tag != ZONE_CLASSED)
+				Sys_Error ("Z_CheckHeap: bad block in size class %i\n", i);
+			if (block->size / ZONE_CLASSGRAIN != i)
+				Sys_Error ("Z_CheckHeap: block of size %i in size class %i\n", block->size, i);
+			classed += block->size;
+		}
+	}
+	if (classed != mainzone->classedbytes)
+		Sys_Error ("Z_CheckHeap: size classes hold %i bytes, not %i\n", classed, mainzone->classedbytes);
 }
 
 
@@ -199,7 +325,9 @@ void *Z_Malloc (int size)
 {
 	void	*buf;
 
-	Z_CheckHeap ();	// DEBUG
+#ifdef PARANOID
+	Z_CheckHeap ();
+#endif
 	buf = Z_TagMalloc (size, 1);
 	if (!buf)
 		Sys_Error ("Z_Malloc: failed on allocation of %i bytes",size);
@@ -216,7 +344,7 @@ Z_Realloc
 void *Z_Realloc(void *ptr, int size)
 {
 	int old_size;
-	void *old_ptr;
+	void *new_ptr;
 	memblock_t *block;
 
 	if (!ptr)
@@ -225,24 +353,28 @@ void *Z_Realloc(void *ptr, int size)
 	block = (memblock_t *) ((byte *) ptr - sizeof (memblock_t));
 	if (block->id != ZONEID)
 		Sys_Error ("Z_Realloc: realloced a pointer without ZONEID");
-	if (block->tag == 0)
+	if (block->tag == 0 || block->tag == ZONE_CLASSED)
 		Sys_Error ("Z_Realloc: realloced a freed pointer");
 
 	old_size = block->size;
 	old_size -= (4 + (int)sizeof(memblock_t));	/* see Z_TagMalloc() */
-	old_ptr = ptr;
 
-	Z_Free (ptr);
-	ptr = Z_TagMalloc (size, 1);
-	if (!ptr)
+	// the block is still good if it isn't more than twice as big as needed
+	if (size <= old_size && size >= old_size / 2)
+		return ptr;
+
+	// allocate before freeing, Z_Free may keep the old block in a size
+	// class and write over its start
+	new_ptr = Z_TagMalloc (size, 1);
+	if (!new_ptr)
 		Sys_Error ("Z_Realloc: failed on allocation of %i bytes", size);
 
-	if (ptr != old_ptr)
-		memmove (ptr, old_ptr, q_min(old_size, size));
+	memcpy (new_ptr, ptr, q_min(old_size, size));
 	if (old_size < size)
-		memset ((byte *)ptr + old_size, 0, size - old_size);
+		memset ((byte *)new_ptr + old_size, 0, size - old_size);
+	Z_Free (ptr);
 
-	return ptr;
+	return new_ptr;
 }
 
 char *Z_Strdup (const char *s)
@@ -282,6 +414,54 @@ void Z_Print (memzone_t *zone)
 }
 
 
+/*
+========================
+Z_Stats_f -- size class use and fragmentation of the free space
+========================
+*/
+static void Z_Stats_f (void)
+{
+	memblock_t	*block;
+	int		used, usedblocks, freebytes, freeblocks, largest, i, count;
+
+	Z_CheckHeap ();
+	if (Cmd_Argc() > 1 && !q_strcasecmp(Cmd_Argv(1), "all"))
+		Z_Print (mainzone);
+
+	used = usedblocks = freebytes = freeblocks = largest = 0;
+	for (block = mainzone->blocklist.next ; block != &mainzone->blocklist ; block = block->next)
+	{
+		if (block->tag == 0)
+		{
+			freebytes += block->size;
+			freeblocks++;
+			if (block->size > largest)
+				largest = block->size;
+		}
+		else if (block->tag != ZONE_CLASSED)
+		{
+			used += block->size;
+			usedblocks++;
+		}
+	}
+
+	Con_Printf ("zone size: %i, %i used in %i blocks\n", mainzone->size, used, usedblocks);
+	Con_Printf ("free: %i in %i blocks, largest %i, %i%% fragmented\n", freebytes, freeblocks, largest,
+		    freebytes ? 100 - (int)((double)largest * 100 / freebytes) : 0);
+	Con_Printf ("size classes: %i bytes waiting\n", mainzone->classedbytes);
+	for (i = 0; i < NUM_SIZECLASSES; i++)
+	{
+		count = 0;
+		for (block = mainzone->classes[i]; block; block = Z_CLASSLINK(block))
+			count++;
+		if (count)
+			Con_Printf ("  %4i bytes: %i\n", i * ZONE_CLASSGRAIN, count);
+	}
+	Con_Printf ("allocations: %i from size classes, %i from the block list (%.1f blocks scanned each), %i flushes\n",
+		    z_classhits, z_roverallocs, z_roverallocs ? z_roverscans / z_roverallocs : 0.0, z_classflushes);
+}
+
+
 //============================================================================
 
 #define	HUNK_SENTINAL	0x1df001ed
@@ -303,6 +483,93 @@ int		hunk_high_used;
 qboolean	hunk_tempactive;
 int		hunk_tempmark;
 
+/*
+when the hunk is a reserved address range, memory is only committed as
+the low and high ends grow, and given back when a big cache block is
+freed.  everything below hunk_lowcommit and above hunk_highcommit is
+committed; the cache commits its own blocks.  freeing to a mark keeps up
+to HUNK_SLACK committed past it, so load-time mark/free cycles and temp
+allocations don't turn into a syscall each, and Hunk_Trim gives the rest
+back between maps.  cache blocks may sit in that slack.
+*/
+#define	HUNK_PAGESIZE	0x10000		// a multiple of any page size
+#define	HUNK_PAGEDOWN(p)	((byte *)((uintptr_t)(p) & ~(uintptr_t)(HUNK_PAGESIZE - 1)))
+#define	HUNK_PAGEUP(p)		HUNK_PAGEDOWN((byte *)(p) + HUNK_PAGESIZE - 1)
+#define	HUNK_SLACK	(8 * 1024 * 1024)
+
+static qboolean	hunk_reserved;
+static int	hunk_peak;
+static byte	*hunk_lowcommit, *hunk_highcommit;
+
+static void Hunk_Decommit (byte *start, byte *end);
+
+/*
+==============
+Hunk_Commit
+==============
+*/
+static void Hunk_Commit (byte *start, byte *end)
+{
+	if (!hunk_reserved || end <= start)
+		return;
+	start = HUNK_PAGEDOWN(start);
+	end = HUNK_PAGEUP(end);
+	if (start < hunk_base)
+		start = hunk_base;
+	if (end > hunk_base + hunk_size)
+		end = hunk_base + hunk_size;
+	if (!Sys_CommitMemory (start, end - start))
+		Sys_Error ("Hunk_Commit: out of memory committing %i bytes", (int)(end - start));
+}
+
+/*
+==============
+Hunk_TrimLow
+
+Decommits what's above the low mark past slack bytes
+==============
+*/
+static void Hunk_TrimLow (int slack)
+{
+	byte	*old;
+
+	if (!hunk_reserved || hunk_low_used + slack >= hunk_lowcommit - hunk_base)
+		return;
+	old = hunk_lowcommit;
+	hunk_lowcommit = HUNK_PAGEUP(hunk_base + hunk_low_used + slack);
+	Hunk_Decommit (hunk_lowcommit, old);
+}
+
+/*
+==============
+Hunk_TrimHigh
+==============
+*/
+static void Hunk_TrimHigh (int slack)
+{
+	byte	*old;
+
+	if (!hunk_reserved || hunk_size - hunk_high_used - slack <= hunk_highcommit - hunk_base)
+		return;
+	old = hunk_highcommit;
+	hunk_highcommit = HUNK_PAGEDOWN(hunk_base + hunk_size - hunk_high_used - slack);
+	Hunk_Decommit (old, hunk_highcommit);
+}
+
+/*
+==============
+Hunk_Trim
+
+Gives back all the committed memory between the marks that the cache
+isn't using, called between maps
+==============
+*/
+void Hunk_Trim (void)
+{
+	Hunk_TrimLow (0);
+	Hunk_TrimHigh (0);
+}
+
 /*
 ==============
 Hunk_Check
@@ -445,6 +712,14 @@ void *Hunk_AllocName (int size, const char *name)
 	hunk_low_used += size;
 
 	Cache_FreeLow (hunk_low_used);
+	if (hunk_low_used + hunk_high_used > hunk_peak)
+		hunk_peak = hunk_low_used + hunk_high_used;
+
+	if (hunk_base + hunk_low_used > hunk_lowcommit)
+	{
+		Hunk_Commit (hunk_lowcommit, hunk_base + hunk_low_used);
+		hunk_lowcommit = HUNK_PAGEUP(hunk_base + hunk_low_used);
+	}
 
 	memset (h, 0, size);
 
@@ -472,10 +747,17 @@ int	Hunk_LowMark (void)
 
 void Hunk_FreeToLowMark (int mark)
 {
+	byte	*end;
+
 	if (mark < 0 || mark > hunk_low_used)
 		Sys_Error ("Hunk_FreeToLowMark: bad mark %i", mark);
-	memset (hunk_base + mark, 0, hunk_low_used - mark);
+	end = hunk_base + hunk_low_used;
 	hunk_low_used = mark;
+	Hunk_TrimLow (HUNK_SLACK);
+	if (hunk_reserved)
+		end = q_min(end, hunk_lowcommit);	// the rest reads back as zero
+	if (end > hunk_base + mark)
+		memset (hunk_base + mark, 0, end - (hunk_base + mark));
 }
 
 int	Hunk_HighMark (void)
@@ -491,6 +773,8 @@ int	Hunk_HighMark (void)
 
 void Hunk_FreeToHighMark (int mark)
 {
+	byte	*start;
+
 	if (hunk_tempactive)
 	{
 		hunk_tempactive = false;
@@ -498,8 +782,13 @@ void Hunk_FreeToHighMark (int mark)
 	}
 	if (mark < 0 || mark > hunk_high_used)
 		Sys_Error ("Hunk_FreeToHighMark: bad mark %i", mark);
-	memset (hunk_base + hunk_size - hunk_high_used, 0, hunk_high_used - mark);
+	start = hunk_base + hunk_size - hunk_high_used;
 	hunk_high_used = mark;
+	Hunk_TrimHigh (HUNK_SLACK);
+	if (hunk_reserved)
+		start = q_max(start, hunk_highcommit);
+	if (start < hunk_base + hunk_size - mark)
+		memset (start, 0, hunk_base + hunk_size - mark - start);
 }
 
 
@@ -535,9 +824,17 @@ void *Hunk_HighAllocName (int size, const char *name)
 
 	hunk_high_used += size;
 	Cache_FreeHigh (hunk_high_used);
+	if (hunk_low_used + hunk_high_used > hunk_peak)
+		hunk_peak = hunk_low_used + hunk_high_used;
 
 	h = (hunk_t *)(hunk_base + hunk_size - hunk_high_used);
 
+	if ((byte *)h < hunk_highcommit)
+	{
+		Hunk_Commit ((byte *)h, hunk_highcommit);
+		hunk_highcommit = HUNK_PAGEDOWN(h);
+	}
+
 	memset (h, 0, size);
 	h->size = size;
 	h->sentinal = HUNK_SENTINAL;
@@ -599,12 +896,21 @@ typedef struct cache_system_s
 	char			name[CACHENAME_LEN];
 	struct cache_system_s	*prev, *next;
 	struct cache_system_s	*lru_prev, *lru_next;	// for LRU flushing
+	struct cache_system_s	*gapleft, *gapright;	// tree of the gaps after blocks
+	int			gapsize;	// 0 when not in the tree
+	unsigned int		gapprio;
 } cache_system_t;
 
 cache_system_t *Cache_TryAlloc (int size, qboolean nobottom);
 
 cache_system_t	cache_head;
 
+static int	cache_used;	// bytes in blocks, including headers
+static int	cache_max;	// Cache_Alloc throws out old data to stay below this
+static int	cache_peak, cache_blocks, cache_evictions;
+static int	cache_frameallocs, cache_frameevictions;
+static int	cache_lastframeallocs, cache_lastframeevictions;
+
 /*
 ===========
 Cache_Move
@@ -709,84 +1015,253 @@ void Cache_MakeLRU (cache_system_t *cs)
 
 /*
 ============
-Cache_TryAlloc
+Cache_GapCompare
 
-Looks for a free block of memory between the high and low hunk marks
-Size should already include the header and padding
+The free gaps between cache blocks are kept in a treap, ordered by size
+and then address, so Cache_TryAlloc finds the best fitting one without
+walking all blocks.  A block's node stands for the gap after it; the
+gaps below the first and above the last block move with the hunk, so
+they aren't in the tree and get checked on their own.
 ============
 */
-cache_system_t *Cache_TryAlloc (int size, qboolean nobottom)
+static cache_system_t	*cache_gaps;
+
+static int Cache_GapCompare (const cache_system_t *a, const cache_system_t *b)
 {
-	cache_system_t	*cs, *new_cs;
+	if (a->gapsize != b->gapsize)
+		return (a->gapsize < b->gapsize) ? -1 : 1;
+	if (a != b)
+		return (a < b) ? -1 : 1;
+	return 0;
+}
 
-// is the cache completely empty?
+static cache_system_t *Cache_GapInsertNode (cache_system_t *root, cache_system_t *cs)
+{
+	cache_system_t	*child;
 
-	if (!nobottom && cache_head.prev == &cache_head)
+	if (!root)
+		return cs;
+
+	if (Cache_GapCompare (cs, root) < 0)
 	{
-		if (hunk_size - hunk_high_used - hunk_low_used < size)
-			Sys_Error ("Cache_TryAlloc: %i is greater then free hunk", size);
+		root->gapleft = Cache_GapInsertNode (root->gapleft, cs);
+		if (root->gapleft->gapprio > root->gapprio)
+		{	// rotate right
+			child = root->gapleft;
+			root->gapleft = child->gapright;
+			child->gapright = root;
+			return child;
+		}
+	}
+	else
+	{
+		root->gapright = Cache_GapInsertNode (root->gapright, cs);
+		if (root->gapright->gapprio > root->gapprio)
+		{	// rotate left
+			child = root->gapright;
+			root->gapright = child->gapleft;
+			child->gapleft = root;
+			return child;
+		}
+	}
+	return root;
+}
 
-		new_cs = (cache_system_t *) (hunk_base + hunk_low_used);
-		memset (new_cs, 0, sizeof(*new_cs));
-		new_cs->size = size;
+static cache_system_t *Cache_GapMerge (cache_system_t *a, cache_system_t *b)
+{
+	if (!a)
+		return b;
+	if (!b)
+		return a;
+	if (a->gapprio > b->gapprio)
+	{
+		a->gapright = Cache_GapMerge (a->gapright, b);
+		return a;
+	}
+	b->gapleft = Cache_GapMerge (a, b->gapleft);
+	return b;
+}
 
-		cache_head.prev = cache_head.next = new_cs;
-		new_cs->prev = new_cs->next = &cache_head;
+static cache_system_t *Cache_GapRemoveNode (cache_system_t *root, cache_system_t *cs)
+{
+	int	cmp;
 
-		Cache_MakeLRU (new_cs);
-		return new_cs;
-	}
+	if (!root)
+		Sys_Error ("Cache_GapRemove: gap not found");
 
-// search from the bottom up for space
+	cmp = Cache_GapCompare (cs, root);
+	if (cmp < 0)
+		root->gapleft = Cache_GapRemoveNode (root->gapleft, cs);
+	else if (cmp > 0)
+		root->gapright = Cache_GapRemoveNode (root->gapright, cs);
+	else
+		return Cache_GapMerge (root->gapleft, root->gapright);
+	return root;
+}
 
-	new_cs = (cache_system_t *) (hunk_base + hunk_low_used);
-	cs = cache_head.next;
+/*
+============
+Cache_GapUpdate
 
-	do
+Takes the gap after cs out of the tree, and puts it back with its
+current size if it's between two blocks
+============
+*/
+static void Cache_GapUpdate (cache_system_t *cs, qboolean reinsert)
+{
+	if (cs == &cache_head)
+		return;
+
+	if (cs->gapsize)
+	{
+		cache_gaps = Cache_GapRemoveNode (cache_gaps, cs);
+		cs->gapsize = 0;
+	}
+	cs->gapleft = cs->gapright = NULL;
+
+	if (reinsert && cs->next && cs->next != &cache_head)
 	{
-		if (!nobottom || cs != cache_head.next)
+		cs->gapsize = (int)((byte *)cs->next - ((byte *)cs + cs->size));
+		if (cs->gapsize)
 		{
-			if ( (byte *)cs - (byte *)new_cs >= size)
-			{	// found space
-				memset (new_cs, 0, sizeof(*new_cs));
-				new_cs->size = size;
+			cs->gapprio = (unsigned int)((uintptr_t)cs >> 4) * 2654435761U;
+			cache_gaps = Cache_GapInsertNode (cache_gaps, cs);
+		}
+	}
+}
 
-				new_cs->next = cs;
-				new_cs->prev = cs->prev;
-				cs->prev->next = new_cs;
-				cs->prev = new_cs;
+/*
+============
+Cache_GapFind
 
-				Cache_MakeLRU (new_cs);
+Returns the block followed by the smallest gap of at least size bytes
+============
+*/
+static cache_system_t *Cache_GapFind (int size)
+{
+	cache_system_t	*cs, *best;
 
-				return new_cs;
-			}
+	best = NULL;
+	for (cs = cache_gaps; cs; )
+	{
+		if (cs->gapsize >= size)
+		{
+			best = cs;
+			cs = cs->gapleft;
 		}
+		else
+			cs = cs->gapright;
+	}
+	return best;
+}
 
-	// continue looking
-		new_cs = (cache_system_t *)((byte *)cs + cs->size);
-		cs = cs->next;
+/*
+============
+Cache_LinkBlock
 
-	} while (cs != &cache_head);
+Puts a new block of size bytes at new_cs, in front of next
+============
+*/
+static cache_system_t *Cache_LinkBlock (cache_system_t *new_cs, int size, cache_system_t *next)
+{
+	Hunk_Commit ((byte *)new_cs, (byte *)new_cs + size);
+	memset (new_cs, 0, sizeof(*new_cs));
+	new_cs->size = size;
+	cache_used += size;
+	cache_blocks++;
+	if (cache_used > cache_peak)
+		cache_peak = cache_used;
+
+	new_cs->next = next;
+	new_cs->prev = next->prev;
+	next->prev->next = new_cs;
+	next->prev = new_cs;
+
+	Cache_GapUpdate (new_cs->prev, true);
+	Cache_GapUpdate (new_cs, true);
+
+	Cache_MakeLRU (new_cs);
+	return new_cs;
+}
 
-// try to allocate one at the very end
-	if ( hunk_base + hunk_size - hunk_high_used - (byte *)new_cs >= size)
-	{
-		memset (new_cs, 0, sizeof(*new_cs));
-		new_cs->size = size;
+/*
+============
+Cache_TryAlloc
 
-		new_cs->next = &cache_head;
-		new_cs->prev = cache_head.prev;
-		cache_head.prev->next = new_cs;
-		cache_head.prev = new_cs;
+Looks for a free block of memory between the high and low hunk marks
+Size should already include the header and padding
+============
+*/
+cache_system_t *Cache_TryAlloc (int size, qboolean nobottom)
+{
+	cache_system_t	*cs;
+	byte		*bottom, *top;
+
+	bottom = hunk_base + hunk_low_used;
+	top = hunk_base + hunk_size - hunk_high_used;
+
+// is the cache completely empty?
 
-		Cache_MakeLRU (new_cs);
+	if (!nobottom && cache_head.prev == &cache_head)
+	{
+		if (top - bottom < size)
+			Sys_Error ("Cache_TryAlloc: %i is greater then free hunk", size);
 
-		return new_cs;
+		return Cache_LinkBlock ((cache_system_t *) bottom, size, &cache_head);
 	}
 
+// below the first block, unless we're clearing up space there
+
+	if (!nobottom && (byte *)cache_head.next - bottom >= size)
+		return Cache_LinkBlock ((cache_system_t *) bottom, size, cache_head.next);
+
+// the best fitting gap between two blocks
+
+	cs = Cache_GapFind (size);
+	if (cs)
+		return Cache_LinkBlock ((cache_system_t *)((byte *)cs + cs->size), size, cs->next);
+
+// try to allocate one at the very end
+
+	cs = cache_head.prev;
+	if (cs != &cache_head)
+		bottom = (byte *)cs + cs->size;
+	if (top - bottom >= size)
+		return Cache_LinkBlock ((cache_system_t *) bottom, size, &cache_head);
+
 	return NULL;		// couldn't allocate
 }
 
+/*
+============
+Cache_FindVictim
+
+Returns the least recently used block that leaves room for size bytes
+when it's freed together with the gaps around it, or just the least
+recently used one if no single block does
+============
+*/
+static cache_system_t *Cache_FindVictim (int size)
+{
+	cache_system_t	*cs;
+	byte		*start, *end;
+
+	for (cs = cache_head.lru_prev; cs != &cache_head; cs = cs->lru_prev)
+	{
+		if (cs->prev == &cache_head)
+			start = hunk_base + hunk_low_used;
+		else
+			start = (byte *)cs->prev + cs->prev->size;
+		if (cs->next == &cache_head)
+			end = hunk_base + hunk_size - hunk_high_used;
+		else
+			end = (byte *)cs->next;
+		if (end - start >= size)
+			return cs;
+	}
+	return cache_head.lru_prev;
+}
+
 /*
 ============
 Cache_Flush
@@ -841,6 +1316,34 @@ void Cache_Init (void)
 	Cmd_AddCommand ("flush", Cache_Flush);
 }
 
+/*
+==============
+Hunk_Decommit
+
+Gives back the whole pages from start to end that aren't committed for
+the hunk and that no cache block touches
+==============
+*/
+static void Hunk_Decommit (byte *start, byte *end)
+{
+	cache_system_t	*cs;
+	byte		*stop;
+
+	start = HUNK_PAGEUP(q_max(start, hunk_lowcommit));
+	end = HUNK_PAGEDOWN(q_min(end, hunk_highcommit));
+	for (cs = cache_head.next; cs != &cache_head && start < end; cs = cs->next)
+	{
+		if ((byte *)cs + cs->size <= start)
+			continue;
+		stop = q_min(HUNK_PAGEDOWN(cs), end);
+		if (stop > start)
+			Sys_DecommitMemory (start, stop - start);
+		start = HUNK_PAGEUP((byte *)cs + cs->size);
+	}
+	if (end > start)
+		Sys_DecommitMemory (start, end - start);
+}
+
 /*
 ==============
 Cache_Free
@@ -851,20 +1354,33 @@ Frees the memory and removes it from the LRU list
 void Cache_Free (cache_user_t *c, qboolean freetextures) //johnfitz -- added second argument
 {
 	cache_system_t	*cs;
+	byte		*start, *end;
 
 	if (!c->data)
 		Sys_Error ("Cache_Free: not allocated");
 
 	cs = ((cache_system_t *)c->data) - 1;
 
+	Cache_GapUpdate (cs, false);
 	cs->prev->next = cs->next;
 	cs->next->prev = cs->prev;
+	Cache_GapUpdate (cs->prev, true);
 	cs->next = cs->prev = NULL;
 
 	c->data = NULL;
 
 	Cache_UnlinkLRU (cs);
 
+	cache_used -= cs->size;
+	cache_blocks--;
+	if (hunk_reserved)
+	{	// give back the whole pages inside the block, unless the hunk keeps them
+		start = HUNK_PAGEUP(q_max((byte *)cs, hunk_lowcommit));
+		end = HUNK_PAGEDOWN(q_min((byte *)cs + cs->size, hunk_highcommit));
+		if (end > start)
+			Sys_DecommitMemory (start, end - start);
+	}
+
 	//johnfitz -- if a model becomes uncached, free the gltextures.  This only works
 	//becuase the cache_user_t is the last component of the qmodel_t struct.  Should
 	//fail harmlessly if *c is actually part of an sfx_t struct.  I FEEL DIRTY
@@ -916,7 +1432,10 @@ void *Cache_Alloc (cache_user_t *c, int size, const char *name)
 // find memory for it
 	while (1)
 	{
-		cs = Cache_TryAlloc (size, false);
+		if (cache_used + size > cache_max && cache_head.lru_prev != &cache_head)
+			cs = NULL;	// over the limit, throw something out first
+		else
+			cs = Cache_TryAlloc (size, false);
 		if (cs)
 		{
 			q_strlcpy (cs->name, name, CACHENAME_LEN);
@@ -929,12 +1448,420 @@ void *Cache_Alloc (cache_user_t *c, int size, const char *name)
 		if (cache_head.lru_prev == &cache_head)
 			Sys_Error ("Cache_Alloc: out of memory"); // not enough memory at all
 
-		Cache_Free (cache_head.lru_prev->user, true); //johnfitz -- added second argument
+		if (cache_used + size > cache_max)
+			cs = cache_head.lru_prev;	// it's the total that's too big, not the gaps
+		else
+			cs = Cache_FindVictim (size);
+		Cache_Free (cs->user, true); //johnfitz -- added second argument
+		cache_evictions++;
+		cache_frameevictions++;
 	}
 
+	cache_frameallocs += size;
+
 	return Cache_Check (c);
 }
 
+/*
+===============================================================================
+
+SCRATCH MEMORY
+
+A bump allocator for memory that doesn't outlive the current frame.
+Allocations are released in bulk with Scratch_FreeToMark, or all at once
+by Scratch_Reset at the end of every host frame, so nothing here may be
+held across frames.  Unlike the hunk it never shifts hunk_low_used, so it
+is safe to use in the middle of loading, and it doesn't touch the page
+commit machinery.
+
+The arena is a list of malloc'd chunks; a mark is a byte position counted
+across all of them.  When a frame spills past the first chunk the list is
+collapsed into a single chunk big enough for that frame, so the steady
+state is one chunk and no allocator calls at all.
+===============================================================================
+*/
+
+#define	SCRATCH_CHUNKSIZE	(256*1024)
+#define	SCRATCH_MAXKEEP		(16*1024*1024)	// don't hold on to more than this after a spike
+
+typedef struct scratchchunk_s
+{
+	struct scratchchunk_s	*next;
+	int			base;	// position of the first byte
+	int			size;
+} scratchchunk_t;
+
+#define	SCRATCH_HEADER	((int)(sizeof(scratchchunk_t) + 15) & ~15)	// keeps the data 16 byte aligned
+
+static scratchchunk_t	*scratch_chunks, *scratch_current;
+static int		scratch_pos;
+static int		scratch_framepeak, scratch_lastframepeak, scratch_peak;
+
+/*
+===================
+Scratch_NewChunk -- appended at the end of the list
+===================
+*/
+static scratchchunk_t *Scratch_NewChunk (int size)
+{
+	scratchchunk_t	*c, *last;
+
+	c = (scratchchunk_t *) malloc (SCRATCH_HEADER + size);
+	if (!c)
+		Sys_Error ("Scratch_Alloc: failed on %i bytes", size);
+	c->next = NULL;
+	c->size = size;
+	c->base = 0;
+	if (scratch_chunks)
+	{
+		for (last = scratch_chunks; last->next; last = last->next)
+			;
+		last->next = c;
+		c->base = last->base + last->size;
+	}
+	else
+		scratch_chunks = c;
+	return c;
+}
+
+/*
+===================
+Scratch_Alloc
+
+The memory is not cleared
+===================
+*/
+void *Scratch_Alloc (int size)
+{
+	scratchchunk_t	*c;
+	void		*buf;
+
+	if (size < 0)
+		Sys_Error ("Scratch_Alloc: bad size: %i", size);
+
+	size = (size + 15) & ~15;
+
+	c = scratch_current;
+	if (!c || scratch_pos + size > c->base + c->size)
+	{
+	// skip to the next chunk that can hold it whole
+		for (c = c ? c->next : scratch_chunks; c && c->size < size; c = c->next)
+			;
+		if (!c)
+			c = Scratch_NewChunk (q_max(size, SCRATCH_CHUNKSIZE));
+		scratch_current = c;
+		scratch_pos = c->base;
+	}
+
+	buf = (byte *)c + SCRATCH_HEADER + (scratch_pos - c->base);
+	scratch_pos += size;
+	if (scratch_framepeak < scratch_pos)
+		scratch_framepeak = scratch_pos;
+
+	return buf;
+}
+
+/*
+===================
+Scratch_Mark / Scratch_FreeToMark
+===================
+*/
+int Scratch_Mark (void)
+{
+	return scratch_pos;
+}
+
+void Scratch_FreeToMark (int mark)
+{
+	scratchchunk_t	*c;
+
+	if (mark < 0 || mark > scratch_pos)
+		Sys_Error ("Scratch_FreeToMark: bad mark %i", mark);
+
+	for (c = scratch_chunks; c && c->next && mark >= c->next->base; c = c->next)
+		;
+	scratch_current = c;
+	scratch_pos = mark;
+}
+
+/*
+===================
+Scratch_Reset -- called at the end of every host frame
+===================
+*/
+void Scratch_Reset (void)
+{
+	scratchchunk_t	*c, *next;
+	int		size;
+
+	if (scratch_chunks && scratch_chunks->next)
+	{
+	// more than one chunk: replace them with one that fits this frame
+		for (c = scratch_chunks; c; c = next)
+		{
+			next = c->next;
+			free (c);
+		}
+		scratch_chunks = NULL;
+		size = q_min((scratch_framepeak + SCRATCH_CHUNKSIZE - 1) & ~(SCRATCH_CHUNKSIZE - 1), SCRATCH_MAXKEEP);
+		Scratch_NewChunk (q_max(size, SCRATCH_CHUNKSIZE));
+	}
+
+	if (scratch_peak < scratch_framepeak)
+		scratch_peak = scratch_framepeak;
+	scratch_lastframepeak = scratch_framepeak;
+	scratch_framepeak = 0;
+	scratch_current = scratch_chunks;
+	scratch_pos = 0;
+}
+
+static int Scratch_Size (void)
+{
+	scratchchunk_t	*c;
+	int		size;
+
+	for (size = 0, c = scratch_chunks; c; c = c->next)
+		size += c->size;
+	return size;
+}
+
+/*
+===============================================================================
+
+MEMORY ACCOUNTING
+
+===============================================================================
+*/
+
+#define	MAX_HUNKNAMES	128
+
+typedef struct
+{
+	char	name[HUNKNAME_LEN];
+	int	size, count;
+} hunkname_t;
+
+static void (*memory_rendererstats) (memstats_t *stats);
+
+/*
+========================
+Memory_SetRendererStats
+========================
+*/
+void Memory_SetRendererStats (void (*func) (memstats_t *stats))
+{
+	memory_rendererstats = func;
+}
+
+/*
+========================
+Memory_GetStats
+========================
+*/
+void Memory_GetStats (memstats_t *stats)
+{
+	stats->hunk_size = hunk_size;
+	stats->hunk_low = hunk_low_used;
+	stats->hunk_high = hunk_high_used;
+	stats->hunk_peak = hunk_peak;
+
+	stats->zone_size = mainzone->size;
+	stats->zone_used = z_used;
+	stats->zone_peak = z_peak;
+	stats->zone_blocks = z_blocks;
+
+	stats->cache_used = cache_used;
+	stats->cache_peak = cache_peak;
+	stats->cache_max = cache_max;
+	stats->cache_blocks = cache_blocks;
+	stats->cache_evictions = cache_evictions;
+	stats->cache_frameallocs = cache_lastframeallocs;
+	stats->cache_frameevictions = cache_lastframeevictions;
+
+	stats->scratch_size = Scratch_Size ();
+	stats->scratch_peak = scratch_peak;
+	stats->scratch_frame = scratch_lastframepeak;
+
+	stats->textures = stats->texture_bytes = 0;
+	stats->vbo_bytes = 0;
+	if (memory_rendererstats)
+		memory_rendererstats (stats);
+}
+
+/*
+========================
+Memory_EndFrame -- called at the end of every host frame
+========================
+*/
+void Memory_EndFrame (void)
+{
+	cache_lastframeallocs = cache_frameallocs;
+	cache_lastframeevictions = cache_frameevictions;
+	cache_frameallocs = cache_frameevictions = 0;
+
+	Scratch_Reset ();
+}
+
+/*
+========================
+Memory_HunkNames -- totals of the low and high hunk by allocation name, biggest first
+========================
+*/
+static int Memory_CompareHunkNames (const void *a, const void *b)
+{
+	return ((const hunkname_t *)b)->size - ((const hunkname_t *)a)->size;
+}
+
+static int Memory_HunkNames (hunkname_t *names)
+{
+	hunk_t	*h, *end;
+	int	i, numnames, pass;
+
+	numnames = 0;
+	for (pass = 0; pass < 2; pass++)
+	{
+		if (!pass)
+		{
+			h = (hunk_t *)hunk_base;
+			end = (hunk_t *)(hunk_base + hunk_low_used);
+		}
+		else
+		{
+			h = (hunk_t *)(hunk_base + hunk_size - hunk_high_used);
+			end = (hunk_t *)(hunk_base + hunk_size);
+		}
+
+		for ( ; h < end; h = (hunk_t *)((byte *)h + h->size))
+		{
+			if (h->sentinal != HUNK_SENTINAL || h->size < (int) sizeof(hunk_t))
+				Sys_Error ("Memory_HunkNames: trahsed sentinal");
+
+			for (i = 0; i < numnames; i++)
+			{
+				if (!strncmp (names[i].name, h->name, HUNKNAME_LEN - 1))
+					break;
+			}
+			if (i == MAX_HUNKNAMES)
+				i = MAX_HUNKNAMES - 1;	// the table is full, see below
+			else if (i == numnames)
+			{
+				if (numnames == MAX_HUNKNAMES - 1)	// the last entry collects all the names that don't fit
+					q_strlcpy (names[i].name, "(others)", HUNKNAME_LEN);
+				else
+				{
+					memcpy (names[i].name, h->name, HUNKNAME_LEN);
+					names[i].name[HUNKNAME_LEN - 1] = 0;
+				}
+				names[i].size = names[i].count = 0;
+				numnames++;
+			}
+			names[i].size += h->size;
+			names[i].count++;
+		}
+	}
+
+	qsort (names, numnames, sizeof(hunkname_t), Memory_CompareHunkNames);
+	return numnames;
+}
+
+/*
+========================
+Memory_Stats_f
+========================
+*/
+static void Memory_Stats_f (void)
+{
+	memstats_t	st;
+	hunkname_t	names[MAX_HUNKNAMES];
+	int		i, numnames, count;
+
+	if (Cmd_Argc() > 1 && !strcmp(Cmd_Argv(1), "dump"))
+	{
+		Memory_DumpStats (sv.active ? sv.name : cl.mapname);
+		return;
+	}
+	count = (Cmd_Argc() > 1) ? Q_atoi(Cmd_Argv(1)) : 10;
+
+	Memory_GetStats (&st);
+	Con_Printf ("hunk:     %8i low %8i high %8i peak of %i\n", st.hunk_low, st.hunk_high, st.hunk_peak, st.hunk_size);
+	Con_Printf ("zone:     %8i used %8i peak in %i blocks, of %i\n", st.zone_used, st.zone_peak, st.zone_blocks, st.zone_size);
+	Con_Printf ("cache:    %8i used %8i peak in %i blocks, limit %i\n", st.cache_used, st.cache_peak, st.cache_blocks, st.cache_max);
+	Con_Printf ("          %8i evictions, last frame %i bytes cached %i evicted\n", st.cache_evictions, st.cache_frameallocs, st.cache_frameevictions);
+	Con_Printf ("scratch:  %8i size %8i peak, last frame %i\n", st.scratch_size, st.scratch_peak, st.scratch_frame);
+	Con_Printf ("textures: %8i bytes in %i textures\n", st.texture_bytes, st.textures);
+	Con_Printf ("vbo:      %8i bytes\n", st.vbo_bytes);
+
+	numnames = Memory_HunkNames (names);
+	Con_Printf ("hunk by name:\n");
+	for (i = 0; i < numnames && i < count; i++)
+		Con_Printf ("%8i %4i %s\n", names[i].size, names[i].count, names[i].name);
+	if (i < numnames)
+		Con_Printf ("(%i more, \"memstats <count>\" to list them)\n", numnames - i);
+}
+
+/*
+========================
+Memory_DumpStats
+
+Appends one JSON object per call to memstats.json in the game directory,
+done at the end of every map when memstats_dump is set
+========================
+*/
+void Memory_DumpStats (const char *mapname)
+{
+	memstats_t	st;
+	hunkname_t	names[MAX_HUNKNAMES];
+	char		path[MAX_OSPATH];
+	const char	*c;
+	FILE		*f;
+	int		i, numnames;
+
+	q_snprintf (path, sizeof(path), "%s/memstats.json", com_gamedir);
+	f = fopen (path, "a");
+	if (!f)
+	{
+		Con_Printf ("Couldn't open %s\n", path);
+		return;
+	}
+
+	Memory_GetStats (&st);
+	fprintf (f, "{\"map\":\"");
+	for (c = mapname; *c; c++)
+	{
+		if (*c == '"' || *c == '\\')
+			fputc ('\\', f);
+		if ((byte)*c >= ' ')
+			fputc (*c, f);
+	}
+	fprintf (f, "\",\"time\":%.1f", realtime);
+	fprintf (f, ",\"hunk\":{\"size\":%i,\"low\":%i,\"high\":%i,\"peak\":%i}",
+		 st.hunk_size, st.hunk_low, st.hunk_high, st.hunk_peak);
+	fprintf (f, ",\"zone\":{\"size\":%i,\"used\":%i,\"peak\":%i,\"blocks\":%i}",
+		 st.zone_size, st.zone_used, st.zone_peak, st.zone_blocks);
+	fprintf (f, ",\"cache\":{\"used\":%i,\"peak\":%i,\"max\":%i,\"blocks\":%i,\"evictions\":%i}",
+		 st.cache_used, st.cache_peak, st.cache_max, st.cache_blocks, st.cache_evictions);
+	fprintf (f, ",\"scratch\":{\"size\":%i,\"peak\":%i}", st.scratch_size, st.scratch_peak);
+	fprintf (f, ",\"textures\":{\"count\":%i,\"bytes\":%i},\"vbo_bytes\":%i",
+		 st.textures, st.texture_bytes, st.vbo_bytes);
+
+	numnames = Memory_HunkNames (names);
+	fprintf (f, ",\"hunk_names\":{");
+	for (i = 0; i < numnames; i++)
+	{
+		fprintf (f, "%s\"", i ? "," : "");
+		for (c = names[i].name; *c; c++)
+		{
+			if (*c == '"' || *c == '\\')
+				fputc ('\\', f);
+			if ((byte)*c >= ' ')
+				fputc (*c, f);
+		}
+		fprintf (f, "\":%i", names[i].size);
+	}
+	fprintf (f, "}}\n");
+	fclose (f);
+}
+
 //============================================================================
 
 
@@ -950,6 +1877,9 @@ static void Memory_InitZone (memzone_t *zone, int size)
 	zone->blocklist.id = 0;
 	zone->blocklist.size = 0;
 	zone->rover = block;
+	zone->size = size;
+	memset (zone->classes, 0, sizeof(zone->classes));
+	zone->classedbytes = 0;
 
 	block->prev = block->next = &zone->blocklist;
 	block->tag = 0;			// free block
@@ -972,7 +1902,28 @@ void Memory_Init (void *buf, int size)
 	hunk_low_used = 0;
 	hunk_high_used = 0;
 
+	hunk_reserved = false;
+	if (!hunk_base)
+	{
+		hunk_base = (byte *) Sys_ReserveMemory (size);
+		if (hunk_base)
+			hunk_reserved = true;
+		else
+			hunk_base = (byte *) malloc (size);
+		if (!hunk_base)
+			Sys_Error ("Not enough memory free; check disk space\n");
+	}
+	hunk_lowcommit = hunk_base;
+	hunk_highcommit = hunk_base + size;
+
 	Cache_Init ();
+	cache_max = size;
+	p = COM_CheckParm ("-cachesize");
+	if (p && p < com_argc-1)
+		cache_max = Q_atoi (com_argv[p+1]) * 1024;
+	else if (hunk_reserved)
+		cache_max = q_min (size, DEFAULT_CACHE_SIZE);
+
 	p = COM_CheckParm ("-zone");
 	if (p)
 	{
@@ -985,5 +1936,7 @@ void Memory_Init (void *buf, int size)
 	Memory_InitZone (mainzone, zonesize);
 
 	Cmd_AddCommand ("hunk_print", Hunk_Print_f); //johnfitz
+	Cmd_AddCommand ("zone_stats", Z_Stats_f);
+	Cmd_AddCommand ("memstats", Memory_Stats_f);
 }
 
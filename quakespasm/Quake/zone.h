@@ -109,8 +109,17 @@ void Hunk_FreeToHighMark (int mark);
 
 void *Hunk_TempAlloc (int size);
 
+void Hunk_Trim (void);	// decommits the free memory kept between the marks
+
 void Hunk_Check (void);
 
+// frame scratch memory: not cleared, and all of it is released at the end
+// of the host frame, so never keep a pointer to it across frames
+void *Scratch_Alloc (int size);
+int Scratch_Mark (void);
+void Scratch_FreeToMark (int mark);
+void Scratch_Reset (void);
+
 typedef struct cache_user_s
 {
 	void	*data;
@@ -130,5 +139,24 @@ void *Cache_Alloc (cache_user_t *c, int size, const char *name);
 
 void Cache_Report (void);
 
+// live memory accounting, for memstats and the scr_memstats overlay
+typedef struct
+{
+	int	hunk_size, hunk_low, hunk_high, hunk_peak;	// peak of low + high
+	int	zone_size, zone_used, zone_peak, zone_blocks;
+	int	cache_used, cache_peak, cache_max, cache_blocks;
+	int	cache_evictions;
+	int	cache_frameallocs, cache_frameevictions;	// during the last frame
+	int	scratch_size, scratch_peak, scratch_frame;	// frame is the last frame's high-water mark
+	int	textures, texture_bytes;
+	int	vbo_bytes;
+} memstats_t;
+
+void Memory_GetStats (memstats_t *stats);
+// the renderer fills in the texture and vbo counts, the zone doesn't know them
+void Memory_SetRendererStats (void (*func) (memstats_t *stats));
+void Memory_EndFrame (void);		// also resets the scratch arena
+void Memory_DumpStats (const char *mapname);
+
 #endif	/* __ZZONE_H */
 